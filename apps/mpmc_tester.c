@@ -0,0 +1,212 @@
+/*
+ * MPMC queue test
+ *
+ * Stress test of the lock-free MPMC queue with several producer and consumer
+ * pthreads, checking that every item is received exactly once and that items
+ * from a given producer are received in order. Then measures the throughput
+ * with 1 to 16 producers feeding a single consumer.
+ */
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <mpmc_queue.h>
+
+#define TEST_ASSERT(assert)				\
+do {									\
+	printf("ASSERT: " #assert " ... ");	\
+	if (assert) {						\
+		printf("PASS\n");				\
+	} else	{							\
+		printf("FAIL\n");				\
+		exit(1);						\
+	}									\
+} while(0)
+
+#define CAPACITY	1024
+#define MAX_THREADS	16
+#define STRESS_ITEMS	100000	/* per producer */
+#define BENCH_ITEMS	1000000	/* in total */
+
+/* Items encode their producer and sequence number, +1 so they are not NULL */
+#define ITEM(p, i)	((void *)(uintptr_t)(((uintptr_t)(p) << 32 | (i)) + 1))
+#define ITEM_PROD(d)	((((uintptr_t)(d) - 1) >> 32))
+#define ITEM_SEQ(d)	((((uintptr_t)(d) - 1) & 0xffffffff))
+
+struct producer {
+	pthread_t thread;
+	mpmc_queue_t q;
+	unsigned int id;
+	size_t count;
+};
+
+struct consumer {
+	pthread_t thread;
+	mpmc_queue_t q;
+	size_t expected;	/* total items to receive by all consumers */
+	size_t *received;	/* shared counter */
+	unsigned char *seen;	/* one flag per item */
+	size_t stride;		/* items per producer in @seen */
+	int ordered;		/* whether per-producer order held */
+};
+
+static void *produce(void *arg)
+{
+	struct producer *p = arg;
+	size_t i;
+
+	for (i = 0; i < p->count; i++)
+		while (mpmc_queue_enqueue(p->q, ITEM(p->id, i)) < 0)
+			sched_yield();
+
+	return NULL;
+}
+
+static void *consume(void *arg)
+{
+	struct consumer *c = arg;
+	size_t last[MAX_THREADS];
+	void *data;
+
+	memset(last, 0, sizeof(last));
+	c->ordered = 1;
+
+	while (__atomic_load_n(c->received, __ATOMIC_RELAXED) < c->expected) {
+		if (mpmc_queue_dequeue(c->q, &data) < 0) {
+			sched_yield();
+			continue;
+		}
+		__atomic_fetch_add(c->received, 1, __ATOMIC_RELAXED);
+
+		if (c->seen) {
+			size_t p = ITEM_PROD(data), seq = ITEM_SEQ(data);
+
+			/* +1 so that 0 means nothing received yet */
+			if (seq + 1 <= last[p])
+				c->ordered = 0;
+			last[p] = seq + 1;
+			__atomic_fetch_add(&c->seen[p * c->stride + seq], 1,
+					   __ATOMIC_RELAXED);
+		}
+	}
+
+	return NULL;
+}
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* Run @nr_prod producers and @nr_cons consumers moving @per_prod items each */
+static double run(size_t nr_prod, size_t nr_cons, size_t per_prod,
+		  unsigned char *seen, int *ordered)
+{
+	struct producer prods[MAX_THREADS];
+	struct consumer cons[MAX_THREADS];
+	mpmc_queue_t q = mpmc_queue_create(CAPACITY);
+	size_t received = 0, i;
+	double start;
+
+	*ordered = 1;
+	start = now();
+	for (i = 0; i < nr_cons; i++) {
+		cons[i] = (struct consumer) {
+			.q = q,
+			.expected = nr_prod * per_prod, .received = &received,
+			.seen = seen, .stride = per_prod,
+		};
+		pthread_create(&cons[i].thread, NULL, consume, &cons[i]);
+	}
+	for (i = 0; i < nr_prod; i++) {
+		prods[i] = (struct producer) {
+			.q = q, .id = i, .count = per_prod,
+		};
+		pthread_create(&prods[i].thread, NULL, produce, &prods[i]);
+	}
+
+	for (i = 0; i < nr_prod; i++)
+		pthread_join(prods[i].thread, NULL);
+	for (i = 0; i < nr_cons; i++) {
+		pthread_join(cons[i].thread, NULL);
+		*ordered &= cons[i].ordered;
+	}
+
+	mpmc_queue_destroy(q);
+
+	return now() - start;
+}
+
+void test_mpmc_simple(void)
+{
+	int data1 = 1, data2 = 2, *ptr;
+	mpmc_queue_t q;
+
+	fprintf(stderr, "*** TEST mpmc_simple ***\n");
+
+	TEST_ASSERT(mpmc_queue_create(0) == NULL);
+	q = mpmc_queue_create(2);
+	TEST_ASSERT(q != NULL);
+	TEST_ASSERT(mpmc_queue_dequeue(q, (void**)&ptr) == -1);
+	TEST_ASSERT(mpmc_queue_enqueue(q, &data1) == 0);
+	TEST_ASSERT(mpmc_queue_enqueue(q, &data2) == 0);
+	TEST_ASSERT(mpmc_queue_enqueue(q, &data1) == -1); /* full */
+	TEST_ASSERT(mpmc_queue_length(q) == 2);
+	TEST_ASSERT(mpmc_queue_destroy(q) == -1);
+	mpmc_queue_dequeue(q, (void**)&ptr);
+	TEST_ASSERT(ptr == &data1);
+	mpmc_queue_dequeue(q, (void**)&ptr);
+	TEST_ASSERT(ptr == &data2);
+	TEST_ASSERT(mpmc_queue_length(q) == 0);
+	TEST_ASSERT(mpmc_queue_enqueue(NULL, &data1) == -1);
+	TEST_ASSERT(mpmc_queue_enqueue(q, NULL) == -1);
+	TEST_ASSERT(mpmc_queue_destroy(q) == 0);
+}
+
+void test_mpmc_stress(void)
+{
+	size_t nr = 4, i, missing = 0;
+	unsigned char *seen = calloc(nr * STRESS_ITEMS, 1);
+	int ordered;
+
+	fprintf(stderr, "*** TEST mpmc_stress ***\n");
+
+	run(nr, nr, STRESS_ITEMS, seen, &ordered);
+	for (i = 0; i < nr * STRESS_ITEMS; i++)
+		if (seen[i] != 1)
+			missing++;
+
+	TEST_ASSERT(missing == 0);
+	TEST_ASSERT(ordered);
+	free(seen);
+}
+
+void bench_mpmc_producers(void)
+{
+	size_t nr;
+	int ordered;
+
+	fprintf(stderr, "*** BENCH mpmc_producers ***\n");
+
+	for (nr = 1; nr <= MAX_THREADS; nr *= 2) {
+		double t = run(nr, 1, BENCH_ITEMS / nr, NULL, &ordered);
+		fprintf(stderr, "%2zu producers -> 1 consumer: %.2f Mitems/s\n",
+			nr, BENCH_ITEMS / nr * nr / t / 1e6);
+	}
+}
+
+int main(void)
+{
+	test_mpmc_simple();
+	test_mpmc_stress();
+	bench_mpmc_producers();
+
+	return 0;
+}
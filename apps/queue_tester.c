@@ -1,6 +1,7 @@
 #include <stdio.h>
 #include <assert.h>
 #include <stdlib.h>
+#include <time.h>
 #include "queue.h"
 #include "uthread.h"
 
@@ -198,6 +199,150 @@ void test_queue_iterate_deletion(void) {
     queue_destroy(q);
 }
 
+void test_queue_push(void) {
+    fprintf(stderr, "*** TEST queue_push ***\n");
+    queue_t q = queue_create();
+    int data1 = 1, data2 = 2, data3 = 3;
+    int *ptr;
+
+    TEST_ASSERT(queue_push(q, &data1) == 0); // into empty queue
+    queue_enqueue(q, &data2);
+    TEST_ASSERT(queue_push(q, &data3) == 0);
+    TEST_ASSERT(queue_length(q) == 3);
+
+    queue_dequeue(q, (void**)&ptr);
+    TEST_ASSERT(ptr == &data3);
+    queue_dequeue(q, (void**)&ptr);
+    TEST_ASSERT(ptr == &data1);
+    queue_dequeue(q, (void**)&ptr);
+    TEST_ASSERT(ptr == &data2);
+
+    queue_push(q, &data1);
+    queue_enqueue(q, &data2); // tail is still right after a push
+    TEST_ASSERT(queue_delete(q, &data2) == 0);
+    queue_dequeue(q, (void**)&ptr);
+    TEST_ASSERT(ptr == &data1 && queue_length(q) == 0);
+
+    TEST_ASSERT(queue_push(NULL, &data1) == -1);
+    TEST_ASSERT(queue_push(q, NULL) == -1);
+}
+
+void test_queue_concat(void) {
+    fprintf(stderr, "*** TEST queue_concat ***\n");
+    queue_t q = queue_create(), other = queue_create();
+    int data[5] = {0, 1, 2, 3, 4};
+    queue_handle_t handle;
+    int *ptr;
+
+    TEST_ASSERT(queue_concat(q, other) == 0); // both empty
+    TEST_ASSERT(queue_length(q) == 0);
+
+    queue_enqueue(other, &data[1]);
+    queue_enqueue_handle(other, &data[2], &handle);
+    TEST_ASSERT(queue_concat(q, other) == 0); // into empty queue
+    TEST_ASSERT(queue_length(q) == 2 && queue_length(other) == 0);
+
+    queue_enqueue(other, &data[3]);
+    queue_enqueue(other, &data[4]);
+    TEST_ASSERT(queue_concat(q, other) == 0);
+    queue_enqueue(other, &data[0]);
+    TEST_ASSERT(queue_concat_front(q, other) == 0);
+    TEST_ASSERT(queue_length(q) == 5 && queue_length(other) == 0);
+
+    // handles of moved items still work
+    TEST_ASSERT(queue_remove_handle(q, handle) == 0);
+    queue_enqueue(q, &data[2]); // tail is right after a concat
+
+    int expected[5] = {0, 1, 3, 4, 2};
+    for (int i = 0; i < 5; i++) {
+        queue_dequeue(q, (void**)&ptr);
+        TEST_ASSERT(ptr == &data[expected[i]]);
+    }
+
+    TEST_ASSERT(queue_concat(NULL, other) == -1);
+    TEST_ASSERT(queue_concat(q, NULL) == -1);
+    TEST_ASSERT(queue_concat(q, q) == -1);
+    queue_destroy(q);
+    queue_destroy(other);
+}
+
+void test_queue_remove_handle(void) {
+    fprintf(stderr, "*** TEST queue_remove_handle ***\n");
+    queue_t q = queue_create();
+    int data1 = 1, data2 = 2, data3 = 3, data4 = 4;
+    queue_handle_t h1, h2, h3, h4;
+    int *ptr;
+
+    queue_enqueue_handle(q, &data1, &h1);
+    queue_enqueue_handle(q, &data2, &h2);
+    queue_enqueue_handle(q, &data3, &h3);
+    queue_enqueue_handle(q, &data4, &h4);
+
+    TEST_ASSERT(queue_remove_handle(q, h2) == 0); // middle
+    TEST_ASSERT(queue_remove_handle(q, h1) == 0); // head
+    TEST_ASSERT(queue_remove_handle(q, h4) == 0); // tail
+    TEST_ASSERT(queue_length(q) == 1);
+
+    queue_enqueue(q, &data1);
+    queue_dequeue(q, (void**)&ptr);
+    TEST_ASSERT(ptr == &data3);
+    queue_dequeue(q, (void**)&ptr);
+    TEST_ASSERT(ptr == &data1);
+    TEST_ASSERT(queue_length(q) == 0);
+
+    queue_enqueue_handle(q, &data1, &h1);
+    TEST_ASSERT(queue_remove_handle(q, h1) == 0); // only item
+    TEST_ASSERT(queue_length(q) == 0);
+    TEST_ASSERT(queue_remove_handle(q, h1) == -1); // empty queue
+    TEST_ASSERT(queue_remove_handle(NULL, h1) == -1);
+    TEST_ASSERT(queue_remove_handle(q, NULL) == -1);
+
+    queue_destroy(q);
+}
+
+#define BENCH_SIZE 100000
+#define BENCH_DELETES 1000
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* Removal from the middle of a 100k-element queue, by value and by handle */
+void bench_queue_remove(void) {
+    fprintf(stderr, "*** BENCH queue_remove ***\n");
+    static int data[BENCH_SIZE];
+    static queue_handle_t handles[BENCH_SIZE];
+    queue_t q = queue_create();
+    double start, by_value, by_handle;
+    int i;
+
+    for (i = 0; i < BENCH_SIZE; i++)
+        queue_enqueue_handle(q, &data[i], &handles[i]);
+
+    start = now();
+    for (i = 0; i < BENCH_DELETES; i++)
+        queue_delete(q, &data[BENCH_SIZE / 2 + i]);
+    by_value = (now() - start) / BENCH_DELETES;
+
+    start = now();
+    for (i = 0; i < BENCH_SIZE; i++) {
+        // stride through the queue so removals hit every position 
+        int j = (i * 7919) % BENCH_SIZE;
+        if (j < BENCH_SIZE / 2 || j >= BENCH_SIZE / 2 + BENCH_DELETES)
+            queue_remove_handle(q, handles[j]);
+    }
+    by_handle = (now() - start) / (BENCH_SIZE - BENCH_DELETES);
+
+    TEST_ASSERT(queue_length(q) == 0);
+    fprintf(stderr, "%d-element queue: queue_delete %.0f ns, "
+            "queue_remove_handle %.0f ns per removal\n",
+            BENCH_SIZE, by_value * 1e9, by_handle * 1e9);
+
+    queue_destroy(q);
+}
+
 int main(void){
     test_create();
     test_queue_simple();
@@ -210,6 +355,10 @@ int main(void){
     test_queue_null_handling();
     test_queue_iterate_increment();
     test_queue_iterate_deletion();
+    test_queue_push();
+    test_queue_concat();
+    test_queue_remove_handle();
+    bench_queue_remove();
 
     return 0;
 }
\ No newline at end of file
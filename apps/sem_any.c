@@ -0,0 +1,229 @@
+/*
+ * Multiple semaphore wait test
+ *
+ * Checks that sem_down_any() takes exactly one semaphore per call and
+ * withdraws a woken thread from the other semaphores, then compares a thread
+ * serving N input queues through sem_down_any() with one helper thread per
+ * queue forwarding to a single semaphore.
+ *
+ * Usage: sem_any.x [N] [ITEMS]
+ */
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include <sem.h>
+#include <uthread.h>
+
+#define TEST_ASSERT(assert)				\
+do {									\
+	printf("ASSERT: " #assert " ... ");	\
+	if (assert) {						\
+		printf("PASS\n");				\
+	} else	{							\
+		printf("FAIL\n");				\
+		exit(1);						\
+	}									\
+} while(0)
+
+#define NR_SEMS		3
+#define NR_MANY		20	/* More than fit on the stack */
+
+static sem_t sems[NR_MANY];
+static ssize_t got[8];
+static size_t nr_got;
+
+static void waiter(void *arg)
+{
+	size_t n = (size_t)arg;
+
+	got[nr_got++] = sem_down_any(sems, n);
+}
+
+static void test_available(void *arg)
+{
+	(void)arg;
+
+	/* Lowest available index first, without blocking */
+	sem_up(sems[2]);
+	sem_up(sems[1]);
+	TEST_ASSERT(sem_down_any(sems, NR_SEMS) == 1);
+	TEST_ASSERT(sem_down_any(sems, NR_SEMS) == 2);
+}
+
+static void test_blocked(void *arg)
+{
+	(void)arg;
+
+	nr_got = 0;
+	uthread_create(waiter, (void *)NR_SEMS);
+	uthread_create(waiter, (void *)NR_SEMS);
+	uthread_yield();
+
+	/* Each release wakes one waiter, which only takes that semaphore */
+	sem_up(sems[2]);
+	sem_up(sems[2]);
+	uthread_yield();
+	TEST_ASSERT(nr_got == 2 && got[0] == 2 && got[1] == 2);
+
+	/* Nobody is left in the other queues */
+	sem_up(sems[0]);
+	sem_up(sems[1]);
+	TEST_ASSERT(sem_down_any(sems, NR_SEMS) == 0);
+	TEST_ASSERT(sem_down_any(sems, NR_SEMS) == 1);
+}
+
+static void test_many(void *arg)
+{
+	(void)arg;
+
+	nr_got = 0;
+	uthread_create(waiter, (void *)NR_MANY);
+	uthread_yield();
+
+	sem_up(sems[NR_MANY - 1]);
+	sem_up(sems[NR_MANY - 2]);
+	uthread_yield();
+	TEST_ASSERT(nr_got == 1 && got[0] == NR_MANY - 1);
+	TEST_ASSERT(sem_down_any(sems, NR_MANY) == NR_MANY - 2);
+}
+
+void test_any(void)
+{
+	size_t i;
+
+	fprintf(stderr, "*** TEST sem_down_any ***\n");
+
+	for (i = 0; i < NR_MANY; i++)
+		sems[i] = sem_create(0);
+
+	TEST_ASSERT(sem_down_any(NULL, 1) == -1);
+	TEST_ASSERT(sem_down_any(sems, 0) == -1);
+
+	uthread_run(false, test_available, NULL);
+	uthread_run(false, test_blocked, NULL);
+	uthread_run(false, test_many, NULL);
+
+	/* Waits of threads on the shared stack can't live on their stack */
+	uthread_set_stack_mode(UTHREAD_STACK_SHARED);
+	uthread_run(false, test_blocked, NULL);
+	uthread_run(false, test_many, NULL);
+	uthread_set_stack_mode(UTHREAD_STACK_PRIVATE);
+
+	/* Destroying fails if a thread were still registered */
+	for (i = 0; i < NR_MANY; i++)
+		TEST_ASSERT(sem_destroy(sems[i]) == 0);
+}
+
+/*
+ * Serving N queues, each fed by its own producer
+ */
+static size_t nr_queues = 16;
+static size_t nr_items = 100000;
+static sem_t *queues;
+static sem_t merged;
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void producer(void *arg)
+{
+	size_t i;
+
+	for (i = 0; i < nr_items / nr_queues; i++) {
+		sem_up(arg);
+		uthread_yield();
+	}
+}
+
+static void multiplexer(void *arg)
+{
+	size_t i;
+
+	(void)arg;
+
+	for (i = 0; i < nr_items / nr_queues * nr_queues; i++)
+		sem_down_any(queues, nr_queues);
+}
+
+/* Forward a queue to the merged semaphore */
+static void helper(void *arg)
+{
+	size_t i;
+
+	for (i = 0; i < nr_items / nr_queues; i++) {
+		sem_down(arg);
+		sem_up(merged);
+	}
+}
+
+static void consumer(void *arg)
+{
+	size_t i;
+
+	(void)arg;
+
+	for (i = 0; i < nr_items / nr_queues * nr_queues; i++)
+		sem_down(merged);
+}
+
+static void spawn(void *arg)
+{
+	bool helpers = arg != NULL;
+	size_t i;
+
+	uthread_create(helpers ? consumer : multiplexer, NULL);
+	for (i = 0; i < nr_queues; i++) {
+		if (helpers)
+			uthread_create(helper, queues[i]);
+		uthread_create(producer, queues[i]);
+	}
+}
+
+static void bench_any(void)
+{
+	static const char *names[] = { "sem_down_any", "helper threads" };
+	size_t i, mode;
+
+	fprintf(stderr, "*** BENCH serving %zu queues ***\n", nr_queues);
+
+	queues = malloc(nr_queues * sizeof(*queues));
+	for (mode = 0; mode < 2; mode++) {
+		double start;
+
+		for (i = 0; i < nr_queues; i++)
+			queues[i] = sem_create(0);
+		merged = sem_create(0);
+
+		start = now();
+		uthread_run(false, spawn, mode ? (void *)1 : NULL);
+		printf("%s: %zu queues, %.0f ns per item\n", names[mode],
+		       nr_queues, (now() - start) / nr_items * 1e9);
+
+		for (i = 0; i < nr_queues; i++)
+			sem_destroy(queues[i]);
+		sem_destroy(merged);
+	}
+	free(queues);
+}
+
+int main(int argc, char **argv)
+{
+	if (argc > 1)
+		nr_queues = strtoul(argv[1], NULL, 0);
+	if (argc > 2)
+		nr_items = strtoul(argv[2], NULL, 0);
+
+	test_any();
+	if (nr_queues)
+		bench_any();
+
+	return 0;
+}
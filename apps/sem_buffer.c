@@ -4,11 +4,21 @@
  * A producer produces N values in a shared buffer, while a consume consumes M
  * of these values. N and M are always less than the size of the buffer but can
  * be different. The synchronization is managed through two semaphores.
+ *
+ * Usage: sem_buffer.x [MAXCOUNT [CONS_SEED [PROD_SEED [SCHED_SEED]]]]
+ *	[size=BUFFER_SIZE] [verbose]
+ *
+ * With SCHED_SEED, threads are scheduled by the seeded random policy, and runs
+ * with the same seeds interleave the same way. Items are only printed with
+ * "verbose". The number of items through the buffer per second and the peak
+ * memory held by the library are reported on stderr.
  */
 
 #include <limits.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <time.h>
 
 #include <sem.h>
 #include <uthread.h>
@@ -22,7 +32,9 @@ struct test4 {
 	sem_t mutex;
 	size_t size, head, tail, maxcount;
 	unsigned int prod_seed, cons_seed;
-	unsigned int buffer[BUFFER_SIZE];
+	size_t buffer_size;
+	unsigned int *buffer;
+	bool verbose;
 };
 
 #define clamp(x, y) (((x) <= (y)) ? (x) : (y))
@@ -33,15 +45,18 @@ static void consumer(void* arg)
 	size_t out = 0;
 
 	while (out < t->maxcount - 1) {
-		size_t i, M = rand_r(&t->cons_seed) % BUFFER_SIZE + 1;
+		size_t i, M = rand_r(&t->cons_seed) % t->buffer_size + 1;
 
 		M = clamp(M, t->maxcount - out - 1);
-		printf("Consumer wants to get %zu items out of buffer...\n", M);
+		if (t->verbose)
+			printf("Consumer wants to get %zu items out of buffer...\n",
+			       M);
 		for (i = 0; i < M; i++) {
 			sem_down(t->empty);
 			out = t->buffer[t->tail];
-			printf("Consumer is taking %zu out of buffer\n", out);
-			t->tail = (t->tail + 1) % BUFFER_SIZE;
+			if (t->verbose)
+				printf("Consumer is taking %zu out of buffer\n", out);
+			t->tail = (t->tail + 1) % t->buffer_size;
 			sem_down(t->mutex);
 			t->size--;
 			sem_up(t->mutex);
@@ -58,15 +73,18 @@ static void producer(void* arg)
 	uthread_create(consumer, arg);
 
 	while (count < t->maxcount) {
-		size_t i, N = rand_r(&t->prod_seed) % BUFFER_SIZE + 1;
+		size_t i, N = rand_r(&t->prod_seed) % t->buffer_size + 1;
 		N = clamp(N, t->maxcount - count);
 
-		printf("Producer wants to put %zu items into buffer...\n", N);
+		if (t->verbose)
+			printf("Producer wants to put %zu items into buffer...\n",
+			       N);
 		for (i = 0; i < N; i++) {
 			sem_down(t->full);
-			printf("Producer is putting %zu into buffer\n", count);
+			if (t->verbose)
+				printf("Producer is putting %zu into buffer\n", count);
 			t->buffer[t->head] = count++;
-			t->head = (t->head + 1) % BUFFER_SIZE;
+			t->head = (t->head + 1) % t->buffer_size;
 			sem_down(t->mutex);
 			t->size++;
 			sem_up(t->mutex);
@@ -85,33 +103,80 @@ static unsigned int get_argv(char *argv)
 	return ret;
 }
 
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
 int main(int argc, char **argv)
 {
 	struct test4 t;
+	struct uthread_mem_stats mem;
 	unsigned int maxcount = MAXCOUNT;
+	int i, pos = 0;
+	double start;
 
 	t.cons_seed = 1;
 	t.prod_seed = 2;
+	t.buffer_size = BUFFER_SIZE;
+	t.verbose = false;
+
+	for (i = 1; i < argc; i++) {
+		if (!strncmp(argv[i], "size=", 5)) {
+			t.buffer_size = get_argv(argv[i] + 5);
+			continue;
+		}
+		if (!strcmp(argv[i], "verbose")) {
+			t.verbose = true;
+			continue;
+		}
 
-	if (argc > 1)
-		maxcount = get_argv(argv[1]);
-	if (argc > 2)
-		t.cons_seed = get_argv(argv[2]);
-	if (argc > 3)
-		t.prod_seed = get_argv(argv[3]);
+		switch (pos++) {
+		case 0:
+			maxcount = get_argv(argv[i]);
+			break;
+		case 1:
+			t.cons_seed = get_argv(argv[i]);
+			break;
+		case 2:
+			t.prod_seed = get_argv(argv[i]);
+			break;
+		case 3:
+			uthread_set_sched(UTHREAD_SCHED_RANDOM);
+			uthread_set_sched_seed(get_argv(argv[i]));
+			break;
+		}
+	}
+
+	t.buffer = malloc(t.buffer_size * sizeof(*t.buffer));
+	if (!t.buffer || t.buffer_size == 0 || maxcount < 2) {
+		fprintf(stderr, "invalid buffer size or item count\n");
+		return 1;
+	}
 
 	t.size = t.head = t.tail = 0;
 	t.maxcount = maxcount;
 
 	t.mutex = sem_create(1);
 	t.empty = sem_create(0);
-	t.full = sem_create(BUFFER_SIZE);
+	t.full = sem_create(t.buffer_size);
 
+	start = now();
 	uthread_run(false, producer, &t);
+	start = now() - start;
+	uthread_mem_stats(&mem);
 
 	sem_destroy(t.empty);
 	sem_destroy(t.full);
 	sem_destroy(t.mutex);
+	free(t.buffer);
+
+	fprintf(stderr, "%u items, buffer of %zu: %.0f items/s, %zu KiB peak "
+		"memory\n", maxcount, t.buffer_size, maxcount / start,
+		mem.total.peak / 1024);
 
 	return 0;
 }
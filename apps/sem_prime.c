@@ -6,11 +6,22 @@
  * pipeline consists of filtering thread, added dynamically each time a new
  * prime number is found and which filters out subsequent numbers that are
  * multiples of that prime.
+ *
+ * With "yield_to", a thread handing a number to the next one switches straight
+ * to it, instead of leaving it to wait behind every other ready thread. Primes
+ * are only printed with "verbose", so that a large MAXPRIME measures the
+ * library rather than the terminal. The average latency of a prime through the
+ * pipeline, the number of numbers sieved per second and the peak memory held
+ * by the library are reported on stderr.
+ *
+ * Usage: sem_prime.x [MAXPRIME] [yield_to] [verbose]
  */
 
 #include <limits.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <time.h>
 #include <unistd.h>
 
 #include <sem.h>
@@ -22,6 +33,7 @@ struct channel {
 	int value;
 	sem_t produce;
 	sem_t consume;
+	uthread_handle_t reader;
 };
 
 struct filter {
@@ -32,6 +44,41 @@ struct filter {
 };
 
 static unsigned int max = MAXPRIME;
+static bool directed;
+static bool verbose;
+
+/* Time at which each number entered the pipeline */
+static double *produced;
+static double total_latency;
+static size_t nr_primes;
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* Hand @value to the reader of @c, and wait until it took it */
+static void channel_put(struct channel *c, int value)
+{
+	c->value = value;
+	sem_up(c->consume);
+	if (directed)
+		uthread_yield_to(c->reader);
+	sem_down(c->produce);
+}
+
+/*
+ * Mark the end of the numbers. The reader frees the channel once it got the
+ * mark, so don't wait on it.
+ */
+static void channel_close(struct channel *c)
+{
+	c->value = -1;
+	sem_up(c->consume);
+}
 
 /* Producer thread: produces all numbers, from 2 to max */
 static void source(void *arg)
@@ -40,15 +87,12 @@ static void source(void *arg)
 	size_t i;
 
 	for (i = 2; i <= max; i++) {
-		c->value = i;
-		sem_up(c->consume);
-		sem_down(c->produce);
+		produced[i] = now();
+		channel_put(c, i);
 	}
 
 	/* mark completion */
-	c->value = -1;
-	sem_up(c->consume);
-	sem_down(c->produce);
+	channel_close(c);
 }
 
 /* Filter thread */
@@ -61,13 +105,12 @@ static void filter(void *arg)
 		sem_down(f->left->consume);
 		value = f->left->value;
 		sem_up(f->left->produce);
-		if ((value == -1) || (value % f->prime != 0)) {
-			f->right->value = value;
-			sem_up(f->right->consume);
-			sem_down(f->right->produce);
-		}
-		if (value == -1)
+		if (value == -1) {
+			channel_close(f->right);
 			break;
+		}
+		if (value % f->prime != 0)
+			channel_put(f->right, value);
 	}
 
 	sem_destroy(f->left->produce);
@@ -89,6 +132,7 @@ static void sink(void *arg)
 	p = init_p;
 	p->produce = sem_create(0);
 	p->consume = sem_create(0);
+	p->reader = uthread_handle();
 
 	uthread_create(source, p);
 
@@ -102,7 +146,10 @@ static void sink(void *arg)
 		if (value == -1)
 			break;
 
-		printf("%d is prime.\n", value);
+		total_latency += now() - produced[value];
+		nr_primes++;
+		if (verbose)
+			printf("%d is prime.\n", value);
 
 		f = malloc(sizeof(*f));
 		f->left = p;
@@ -112,10 +159,12 @@ static void sink(void *arg)
 		p = malloc(sizeof(*p));
 		p->produce = sem_create(0);
 		p->consume = sem_create(0);
+		p->reader = uthread_handle();
 
 		f->right = p;
 
-		uthread_create(filter, f);
+		/* The new filter reads what the sink used to */
+		uthread_create_handle(filter, f, &f->left->reader);
 
 		if (f_head)
 			f->next = f_head;
@@ -140,10 +189,36 @@ static unsigned int get_argv(char *argv)
 
 int main(int argc, char **argv)
 {
+	struct uthread_mem_stats mem;
+	double start;
+	int i;
+
 	if (argc > 1)
 		max = get_argv(argv[1]);
+	for (i = 2; i < argc; i++) {
+		if (!strcmp(argv[i], "yield_to"))
+			directed = true;
+		else if (!strcmp(argv[i], "verbose"))
+			verbose = true;
+	}
+
+	produced = malloc((max + 1) * sizeof(*produced));
+	if (!produced) {
+		perror("malloc");
+		return 1;
+	}
 
+	start = now();
 	uthread_run(false, sink, NULL);
+	start = now() - start;
+	uthread_mem_stats(&mem);
+
+	fprintf(stderr, "%zu primes, %.1f us average latency through the "
+		"pipeline\n", nr_primes,
+		nr_primes ? total_latency / nr_primes * 1e6 : 0);
+	fprintf(stderr, "%.0f numbers/s, %zu KiB peak memory\n",
+		(max - 1) / start, mem.total.peak / 1024);
+	free(produced);
 
 	return 0;
 }
@@ -0,0 +1,85 @@
+/*
+ * Remote semaphore release test
+ *
+ * A pthread running outside of the uthread library hands N items to a uthread
+ * consumer through sem_up_remote(). The consumer must receive every item, even
+ * though the runtime has nothing to run in between and sleeps waiting for the
+ * next release. The wake-up latency of the consumer is reported.
+ */
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <sem.h>
+#include <uthread.h>
+
+#define NR_ITEMS	1000
+
+static sem_t items;
+static size_t nr_items = NR_ITEMS;
+static double *posted;
+static double total_latency;
+static size_t received;
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void *producer(void *arg)
+{
+	size_t i;
+
+	(void)arg;
+
+	for (i = 0; i < nr_items; i++) {
+		usleep(100);
+		posted[i] = now();
+		sem_up_remote(items);
+	}
+
+	sem_remote_release();
+	return NULL;
+}
+
+static void consumer(void *arg)
+{
+	(void)arg;
+
+	while (received < nr_items) {
+		sem_down(items);
+		total_latency += now() - posted[received];
+		received++;
+	}
+}
+
+int main(int argc, char **argv)
+{
+	pthread_t thread;
+
+	if (argc > 1)
+		nr_items = strtoul(argv[1], NULL, 0);
+
+	posted = calloc(nr_items, sizeof(*posted));
+	items = sem_create(0);
+
+	sem_remote_hold();
+	pthread_create(&thread, NULL, producer, NULL);
+
+	uthread_run(false, consumer, NULL);
+
+	pthread_join(thread, NULL);
+	sem_destroy(items);
+	free(posted);
+
+	printf("received %zu/%zu items, average wake-up latency %.1f us\n",
+	       received, nr_items, total_latency / nr_items * 1e6);
+
+	return received == nr_items ? 0 : 1;
+}
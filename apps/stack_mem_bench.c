@@ -0,0 +1,179 @@
+/*
+ * Stack memory benchmark
+ *
+ * Creates N threads which use a bit of stack and then block on a semaphore,
+ * and reports the resident memory per blocked thread for a given stack mode.
+ *
+ * With growable stacks, one thread out of DEEP_EVERY recurses much deeper than
+ * a fixed-size stack would allow before blocking, to show the cost of a mix of
+ * shallow and deep threads.
+ *
+ * Threads first call a function using SCRATCH bytes of stack, like a parser
+ * would, before they block. The optional stack options, separated by commas,
+ * apply to private stacks: "measure" paints them and reports the peak usage of
+ * the threads, "adaptive" first runs a round of threads that exit to learn
+ * their peak usage and sizes the stacks after it, and "trim" releases the
+ * unused pages of threads blocked for TRIM_MS.
+ *
+ * Usage: stack_mem_bench.x [private|shared|growable] [N]
+ *	[measure,adaptive,trim]
+ */
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <sem.h>
+#include <uthread.h>
+
+#define NR_THREADS	10000
+#define DEPTH		4
+#define DEEP_DEPTH	256
+#define DEEP_EVERY	8
+#define SCRATCH		(12 * 1024)
+#define TRIM_MS		10
+#define WARMUP		100
+
+static sem_t gate;
+static size_t nr_threads = NR_THREADS;
+static long rss_before, rss_blocked;
+
+static long rss_bytes(void)
+{
+	long size, resident = 0;
+	FILE *f = fopen("/proc/self/statm", "r");
+
+	if (f) {
+		if (fscanf(f, "%ld %ld", &size, &resident) != 2)
+			resident = 0;
+		fclose(f);
+	}
+	return resident * 4096;
+}
+
+/* Work on a large buffer, then return */
+static __attribute__((noinline)) int scratch(void)
+{
+	volatile char buf[SCRATCH];
+
+	memset((char *)buf, 1, sizeof(buf));
+	return buf[SCRATCH / 2];
+}
+
+/* Use a few frames of stack before blocking, like a typical worker */
+static int descend(int depth)
+{
+	volatile char frame[256];
+
+	memset((char *)frame, depth, sizeof(frame));
+	if (depth == 0) {
+		sem_down(gate);
+		return frame[0];
+	}
+	return descend(depth - 1) + frame[1];
+}
+
+static void worker(void *arg)
+{
+	scratch();
+	descend(arg ? DEEP_DEPTH : DEPTH);
+}
+
+/* Let trimming catch up with the blocked workers */
+static void wait_trim(void)
+{
+	struct timespec start, now;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	do {
+		uthread_yield();
+		clock_gettime(CLOCK_MONOTONIC, &now);
+	} while ((now.tv_sec - start.tv_sec) * 1000 +
+		 (now.tv_nsec - start.tv_nsec) / 1000000 < 2 * TRIM_MS);
+}
+
+static bool trim;
+
+static void spawner(void *arg)
+{
+	bool mixed = arg != NULL;
+	size_t i;
+
+	rss_before = rss_bytes();
+	for (i = 0; i < nr_threads; i++)
+		uthread_create(worker,
+			       mixed && i % DEEP_EVERY == 0 ? arg : NULL);
+
+	/* Let every worker run until it blocks */
+	uthread_yield();
+	if (trim)
+		wait_trim();
+	rss_blocked = rss_bytes();
+
+	for (i = 0; i < nr_threads; i++)
+		sem_up(gate);
+}
+
+int main(int argc, char **argv)
+{
+	static const char *names[] = {
+		[UTHREAD_STACK_PRIVATE] = "private",
+		[UTHREAD_STACK_SHARED] = "shared",
+		[UTHREAD_STACK_GROWABLE] = "growable",
+	};
+	uthread_stack_mode_t mode = UTHREAD_STACK_PRIVATE;
+	uthread_stack_paint_t paint = UTHREAD_STACK_PAINT_OFF;
+	const char *option = argc > 3 ? argv[3] : "";
+	struct uthread_stats stats;
+
+	if (argc > 1 && !strcmp(argv[1], "shared"))
+		mode = UTHREAD_STACK_SHARED;
+	if (argc > 1 && !strcmp(argv[1], "growable"))
+		mode = UTHREAD_STACK_GROWABLE;
+	if (argc > 2)
+		nr_threads = strtoul(argv[2], NULL, 0);
+	if (strstr(option, "measure"))
+		paint = UTHREAD_STACK_PAINT_MEASURE;
+	if (strstr(option, "adaptive"))
+		paint = UTHREAD_STACK_PAINT_ADAPTIVE;
+	trim = strstr(option, "trim") != NULL;
+
+	gate = sem_create(0);
+	uthread_set_stack_mode(mode);
+	uthread_set_stack_paint(paint);
+	uthread_set_stack_trim(trim ? TRIM_MS : 0);
+
+	/* Learn how much stack the workers take */
+	if (paint == UTHREAD_STACK_PAINT_ADAPTIVE) {
+		size_t n = nr_threads;
+
+		nr_threads = WARMUP;
+		uthread_run(false, spawner, NULL);
+		nr_threads = n;
+	}
+
+	uthread_run(false, spawner,
+		    mode == UTHREAD_STACK_GROWABLE ? &nr_threads : NULL);
+	sem_destroy(gate);
+	uthread_get_stats(&stats);
+
+	printf("%s stacks%s%s: %zu blocked threads, %ld bytes per thread",
+	       names[mode], *option ? " " : "", option, nr_threads,
+	       (rss_blocked - rss_before) / (long)nr_threads);
+	if (mode == UTHREAD_STACK_GROWABLE)
+		printf(" (1 in %d deep, %zu stack growths, %zu bytes)",
+		       DEEP_EVERY, stats.stack_grow_events,
+		       stats.stack_grow_bytes);
+	if (stats.stack_measured)
+		printf(" (peak usage %zu bytes max, %zu average)",
+		       stats.stack_peak_max,
+		       stats.stack_peak_total / stats.stack_measured);
+	if (stats.stack_trim_events)
+		printf(" (%zu stacks trimmed, %zu bytes)",
+		       stats.stack_trim_events, stats.stack_trim_bytes);
+	printf("\n");
+
+	return 0;
+}
@@ -0,0 +1,177 @@
+/*
+ * Scalability sweep
+ *
+ * For thread counts growing tenfold from 1 up to MAX, creates that many worker
+ * threads, lets them all block on a semaphore, then hands them ITEMS items. A
+ * worker takes an item, works on a bit of its own stack and yields, until no
+ * item is left. For each count, reports the time to create a thread, the
+ * memory held per blocked thread, as accounted by the library and as resident
+ * in the process, and the number of items processed per second.
+ *
+ * Thread creation is bounded by a memory budget of half the physical memory,
+ * so that the sweep stops at the count the library can't hold anymore rather
+ * than taking the system down.
+ *
+ * Usage: sweep_bench.x [MAX [ITEMS]] [private|shared|growable|arena]
+ */
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <sem.h>
+#include <uthread.h>
+
+#define MAX_THREADS	1000000
+#define NR_ITEMS	1000000
+#define WORK_BYTES	256
+
+static size_t nr_threads, nr_created;
+static size_t nr_items = NR_ITEMS;
+static size_t remaining;
+static sem_t items;
+
+/* Results of a round */
+static double create_ns, items_per_s;
+static size_t accounted, resident;
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static long rss_bytes(void)
+{
+	long size, pages = 0;
+	FILE *f = fopen("/proc/self/statm", "r");
+
+	if (f) {
+		if (fscanf(f, "%ld %ld", &size, &pages) != 2)
+			pages = 0;
+		fclose(f);
+	}
+	return pages * sysconf(_SC_PAGESIZE);
+}
+
+static double started, finished;
+
+static void worker(void *arg)
+{
+	volatile char state[WORK_BYTES];
+	size_t i;
+
+	(void)arg;
+
+	memset((char *)state, 0, sizeof(state));
+	while (1) {
+		sem_down(items);
+		if (!remaining)
+			break;
+		if (--remaining == 0)
+			finished = now();
+
+		for (i = 0; i < WORK_BYTES; i += 64)
+			state[i]++;
+		uthread_yield();
+	}
+}
+
+static void spawner(void *arg)
+{
+	struct uthread_mem_stats mem;
+	long rss;
+	double start;
+	size_t i;
+
+	(void)arg;
+
+	items = sem_create(0);
+	remaining = nr_items;
+
+	rss = rss_bytes();
+	start = now();
+	for (nr_created = 0; nr_created < nr_threads; nr_created++)
+		if (uthread_create(worker, NULL) < 0)
+			break;
+	create_ns = nr_created ? (now() - start) / nr_created * 1e9 : 0;
+
+	/* Let every worker block */
+	uthread_yield();
+	uthread_mem_stats(&mem);
+	accounted = nr_created ? mem.total.live / nr_created : 0;
+	resident = nr_created ? (rss_bytes() - rss) / nr_created : 0;
+
+	/* Out of budget: just let the workers go */
+	if (nr_created < nr_threads)
+		remaining = 0;
+
+	started = now();
+	for (i = 0; i < remaining + nr_created; i++)
+		sem_up(items);
+}
+
+int main(int argc, char **argv)
+{
+	static const char *names[] = {
+		[UTHREAD_STACK_PRIVATE] = "private",
+		[UTHREAD_STACK_SHARED] = "shared",
+		[UTHREAD_STACK_GROWABLE] = "growable",
+		[UTHREAD_STACK_ARENA] = "arena",
+	};
+	uthread_stack_mode_t mode = UTHREAD_STACK_PRIVATE;
+	size_t max = MAX_THREADS, budget;
+	int i, pos = 0;
+
+	for (i = 1; i < argc; i++) {
+		uthread_stack_mode_t m;
+		bool named = false;
+
+		for (m = UTHREAD_STACK_PRIVATE; m <= UTHREAD_STACK_ARENA; m++) {
+			if (!strcmp(argv[i], names[m])) {
+				mode = m;
+				named = true;
+			}
+		}
+		if (named)
+			continue;
+
+		if (pos++ == 0)
+			max = strtoul(argv[i], NULL, 0);
+		else
+			nr_items = strtoul(argv[i], NULL, 0);
+	}
+
+	budget = (size_t)sysconf(_SC_PHYS_PAGES) * sysconf(_SC_PAGESIZE) / 2;
+	uthread_set_mem_budget(budget);
+	uthread_set_stack_mode(mode);
+
+	printf("%s stacks, %zu items, memory budget %zu MiB\n", names[mode],
+	       nr_items, budget >> 20);
+	printf("%10s %12s %14s %14s %12s\n", "threads", "create ns",
+	       "bytes/thread", "rss/thread", "items/s");
+
+	for (nr_threads = 1; nr_threads <= max; nr_threads *= 10) {
+		uthread_run(false, spawner, NULL);
+		sem_destroy(items);
+
+		if (nr_created < nr_threads) {
+			printf("%10zu: thread creation failed after %zu threads, "
+			       "over the memory budget\n", nr_threads,
+			       nr_created);
+			break;
+		}
+
+		items_per_s = nr_items / (finished - started);
+		printf("%10zu %12.0f %14zu %14zu %12.0f\n", nr_threads,
+		       create_ns, accounted, resident, items_per_s);
+		fflush(stdout);
+	}
+
+	return 0;
+}
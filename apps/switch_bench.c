@@ -0,0 +1,129 @@
+/*
+ * Context switch benchmark
+ *
+ * N runnable threads yield to each other K times each, and the average cost of
+ * a switch is reported for a given stack mode, along with the number of data
+ * TLB misses per switch when hardware counters are available.
+ *
+ * Usage: switch_bench.x [private|shared|growable|arena] [N] [K]
+ */
+
+#include <linux/perf_event.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <uthread.h>
+
+#define NR_THREADS	10000
+#define NR_YIELDS	100
+
+static size_t nr_threads = NR_THREADS, nr_yields = NR_YIELDS;
+static size_t nr_started;
+static int tlb_fd = -1;
+static double start, elapsed;
+static uint64_t tlb_misses;
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* Data TLB load misses of this process, or -1 if not available */
+static int open_tlb_counter(void)
+{
+	struct perf_event_attr attr;
+
+	memset(&attr, 0, sizeof(attr));
+	attr.size = sizeof(attr);
+	attr.type = PERF_TYPE_HW_CACHE;
+	attr.config = PERF_COUNT_HW_CACHE_DTLB |
+		      PERF_COUNT_HW_CACHE_OP_READ << 8 |
+		      PERF_COUNT_HW_CACHE_RESULT_MISS << 16;
+	attr.disabled = 1;
+	attr.exclude_kernel = 1;
+
+	return syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+static void yielder(void *arg)
+{
+	size_t i;
+
+	(void)arg;
+
+	/* The last thread to start opens the measurement window */
+	if (++nr_started == nr_threads) {
+		if (tlb_fd >= 0)
+			ioctl(tlb_fd, PERF_EVENT_IOC_ENABLE, 0);
+		start = now();
+	}
+
+	for (i = 0; i < nr_yields; i++)
+		uthread_yield();
+
+	if (--nr_started == 0) {
+		elapsed = now() - start;
+		if (tlb_fd >= 0) {
+			ioctl(tlb_fd, PERF_EVENT_IOC_DISABLE, 0);
+			if (read(tlb_fd, &tlb_misses, sizeof(tlb_misses)) < 0)
+				tlb_misses = 0;
+		}
+	}
+}
+
+static void spawner(void *arg)
+{
+	size_t i;
+
+	(void)arg;
+
+	for (i = 0; i < nr_threads; i++)
+		uthread_create(yielder, NULL);
+}
+
+int main(int argc, char **argv)
+{
+	static const char *names[] = { "private", "shared", "growable", "arena" };
+	uthread_stack_mode_t mode = UTHREAD_STACK_PRIVATE;
+	struct uthread_stats stats;
+	double switches;
+	size_t i;
+
+	for (i = 0; argc > 1 && i < sizeof(names) / sizeof(names[0]); i++)
+		if (!strcmp(argv[1], names[i]))
+			mode = i;
+	if (argc > 2)
+		nr_threads = strtoul(argv[2], NULL, 0);
+	if (argc > 3)
+		nr_yields = strtoul(argv[3], NULL, 0);
+
+	tlb_fd = open_tlb_counter();
+
+	uthread_set_stack_mode(mode);
+	uthread_run(false, spawner, NULL);
+	uthread_get_stats(&stats);
+
+	switches = (double)nr_threads * nr_yields;
+	printf("%s: %zu threads, %.0f ns per switch", names[mode], nr_threads,
+	       elapsed / switches * 1e9);
+	if (tlb_fd >= 0)
+		printf(", %.2f dTLB misses per switch", tlb_misses / switches);
+	else
+		printf(", dTLB misses not available");
+	if (mode == UTHREAD_STACK_ARENA)
+		printf(", %zu huge / %zu hinted / %zu regular arena chunks",
+		       stats.arena_huge_chunks, stats.arena_hinted_chunks,
+		       stats.arena_regular_chunks);
+	printf("\n");
+
+	return 0;
+}
@@ -1,37 +1,90 @@
+/*
+ * Preemption test
+ *
+ * N CPU-bound threads each run ITERATIONS iterations of a busy loop of SPIN
+ * steps, and never yield: they only make progress together if the library
+ * preempts them. Iterations are only printed with "verbose". The number of
+ * iterations per second, the number of preemptions and the peak memory held by
+ * the library are reported on stderr.
+ *
+ * Usage: test_preempt.x [N [ITERATIONS [SPIN]]] [verbose]
+ */
+
+#include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
-#include <stdlib.h>
+#include <string.h>
+#include <time.h>
 #include "uthread.h"
 #include <unistd.h>
 //#include "queue.h"
 
+static size_t nr_threads = 5;
+static size_t nr_iterations = 5;
+static size_t spin = 100000000;
+static bool verbose;
+
+static double now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
 /*Test 1*/
-void iterate_five_times(void *arg) {
-    int id = *(int *)arg;
+void iterate(void *arg) {
+    size_t id = (size_t)arg;
 
     if (id == 0) { //first thread creates others
-        for (int i = 1; i < 5; i++) {
-            int *thread_id = malloc(sizeof(int)); //allocate memory for each thread ID
-            *thread_id = i;
-            uthread_create(iterate_five_times, thread_id); //create new thread
+        for (size_t i = 1; i < nr_threads; i++) {
+            uthread_create(iterate, (void *)i); //create new thread
         }
     }
 
-    for (int i = 0; i < 5; i++) {
-        printf("Thread %d running iteration %d\n", id, i);
-        for (volatile int j = 0; j < 100000000; j++); // burn CPU time
+    for (size_t i = 0; i < nr_iterations; i++) {
+        if (verbose)
+            printf("Thread %zu running iteration %zu\n", id, i);
+        for (volatile size_t j = 0; j < spin; j++); // burn CPU time
     }
-
-    free(arg); //Free allocated memory
 }
 
-int main() {
-    fprintf(stderr, "*** TEST: Five-Thread-Preemption ***\n");
+int main(int argc, char **argv) {
+    struct uthread_stats stats;
+    struct uthread_mem_stats mem;
+    int pos = 0;
+    double start;
+
+    for (int i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "verbose")) {
+            verbose = true;
+            continue;
+        }
+        switch (pos++) {
+        case 0:
+            nr_threads = strtoul(argv[i], NULL, 0);
+            break;
+        case 1:
+            nr_iterations = strtoul(argv[i], NULL, 0);
+            break;
+        case 2:
+            spin = strtoul(argv[i], NULL, 0);
+            break;
+        }
+    }
+
+    fprintf(stderr, "*** TEST: %zu-Thread-Preemption ***\n", nr_threads);
 
-    int *thread_zero = malloc(sizeof(int));
-    *thread_zero = 0;
+    start = now();
+    uthread_run(true, iterate, (void *)0); //first thread with argument 0
+    start = now() - start;
 
-    uthread_run(true, iterate_five_times, thread_zero); //first thread with argument 0
+    uthread_get_stats(&stats);
+    uthread_mem_stats(&mem);
+    fprintf(stderr, "%zu threads: %.0f iterations/s, %zu context switches, "
+            "%zu KiB peak memory\n", nr_threads,
+            nr_threads * nr_iterations / start, stats.context_switches,
+            mem.total.peak / 1024);
 
     return 0;
 }
\ No newline at end of file
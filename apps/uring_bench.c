@@ -0,0 +1,144 @@
+/*
+ * Random-read file I/O benchmark
+ *
+ * N threads each read M random 4 KiB blocks of a local file, either with
+ * uthread_pread() or with plain pread(), which blocks the whole runtime. Every
+ * block starts with its own index, which is checked after each read. Also
+ * reports how many reads each io_uring submission carried.
+ *
+ * Usage: uring_bench.x [N] [M] [file size in MiB]
+ */
+
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <uthread.h>
+
+#define BLOCK_SIZE	4096
+#define NR_THREADS	64
+#define NR_READS	256
+#define FILE_MB		16
+
+static int fd;
+static size_t nr_threads = NR_THREADS, nr_reads = NR_READS, nr_blocks;
+static int use_uring;
+static size_t errors;
+
+static void reader(void *arg)
+{
+	unsigned int seed = (uintptr_t)arg;
+	char *buf = malloc(BLOCK_SIZE); /* not on the stack, see uthread_pread() */
+	size_t i;
+
+	for (i = 0; i < nr_reads; i++) {
+		uint32_t block = rand_r(&seed) % nr_blocks, found;
+		off_t off = (off_t)block * BLOCK_SIZE;
+		ssize_t ret;
+
+		if (use_uring)
+			ret = uthread_pread(fd, buf, BLOCK_SIZE, off);
+		else
+			ret = pread(fd, buf, BLOCK_SIZE, off);
+
+		memcpy(&found, buf, sizeof(found));
+		if (ret != BLOCK_SIZE || found != block)
+			errors++;
+	}
+
+	free(buf);
+}
+
+static void spawner(void *arg)
+{
+	size_t i;
+
+	(void)arg;
+
+	for (i = 0; i < nr_threads; i++)
+		uthread_create(reader, (void *)(uintptr_t)(i + 1));
+}
+
+static void writer(void *arg)
+{
+	char *buf = calloc(1, BLOCK_SIZE);
+	uint32_t block;
+
+	(void)arg;
+
+	for (block = 0; block < nr_blocks; block++) {
+		memcpy(buf, &block, sizeof(block));
+		if (uthread_pwrite(fd, buf, BLOCK_SIZE,
+				   (off_t)block * BLOCK_SIZE) != BLOCK_SIZE)
+			errors++;
+	}
+	if (uthread_fsync(fd) < 0)
+		errors++;
+
+	free(buf);
+}
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static double run(int uring)
+{
+	double start = now();
+
+	use_uring = uring;
+	uthread_run(false, spawner, NULL);
+	return now() - start;
+}
+
+int main(int argc, char **argv)
+{
+	char path[] = "/tmp/uring_bench.XXXXXX";
+	struct uthread_stats before, after;
+	double t_sync, t_uring;
+	size_t file_mb = FILE_MB;
+
+	if (argc > 1)
+		nr_threads = strtoul(argv[1], NULL, 0);
+	if (argc > 2)
+		nr_reads = strtoul(argv[2], NULL, 0);
+	if (argc > 3)
+		file_mb = strtoul(argv[3], NULL, 0);
+	nr_blocks = file_mb * 1024 * 1024 / BLOCK_SIZE;
+
+	fd = mkstemp(path);
+	if (fd < 0) {
+		perror("mkstemp");
+		return 1;
+	}
+	unlink(path);
+
+	uthread_run(false, writer, NULL);
+
+	t_sync = run(0);
+	uthread_get_stats(&before);
+	t_uring = run(1);
+	uthread_get_stats(&after);
+
+	printf("%zu threads x %zu random reads in %zu MiB: pread %.0f reads/s, "
+	       "uthread_pread %.0f reads/s\n", nr_threads, nr_reads, file_mb,
+	       nr_threads * nr_reads / t_sync, nr_threads * nr_reads / t_uring);
+	if (after.file_io_submits > before.file_io_submits)
+		printf("%.1f reads per io_uring submission\n",
+		       (double)(after.file_io_ops - before.file_io_ops) /
+		       (after.file_io_submits - before.file_io_submits));
+	else
+		printf("io_uring not available, reads were offloaded\n");
+
+	close(fd);
+
+	return errors ? 1 : 0;
+}
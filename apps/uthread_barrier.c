@@ -0,0 +1,238 @@
+/*
+ * Barrier and latch test
+ *
+ * Checks that barriers and latches hold threads back until they open, then
+ * measures the round-trip time of a barrier shared by N threads, against a
+ * barrier built out of semaphores, which wakes the threads up one by one.
+ *
+ * Usage: uthread_barrier.x [N...]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <barrier.h>
+#include <sem.h>
+#include <uthread.h>
+
+#define TEST_ASSERT(assert)				\
+do {									\
+	printf("ASSERT: " #assert " ... ");	\
+	if (assert) {						\
+		printf("PASS\n");				\
+	} else	{							\
+		printf("FAIL\n");				\
+		exit(1);						\
+	}									\
+} while(0)
+
+#define NR_THREADS	3
+#define NR_ROUNDS	2
+
+/* Total number of barrier crossings per benchmark run */
+#define BENCH_CROSSINGS	1000000
+
+static char trace[64];
+static size_t trace_len;
+static size_t nr_serial;
+
+static uthread_barrier_t barrier;
+static uthread_latch_t latch;
+
+static void crosser(void *arg)
+{
+	size_t i;
+
+	for (i = 0; i < NR_ROUNDS; i++) {
+		trace[trace_len++] = (char)(size_t)arg;
+		if (uthread_barrier_wait(barrier) == 1)
+			nr_serial++;
+		trace[trace_len++] = '|';
+	}
+}
+
+static void spawn_crossers(void *arg)
+{
+	(void)arg;
+
+	uthread_create(crosser, (void *)'A');
+	uthread_create(crosser, (void *)'B');
+	uthread_create(crosser, (void *)'C');
+}
+
+static void run_crossers(uthread_sched_t policy)
+{
+	trace_len = 0;
+	nr_serial = 0;
+	memset(trace, 0, sizeof(trace));
+	uthread_set_sched(policy);
+	uthread_run(false, spawn_crossers, NULL);
+}
+
+void test_barrier(void)
+{
+	fprintf(stderr, "*** TEST barrier ***\n");
+
+	TEST_ASSERT(uthread_barrier_create(0) == NULL);
+	TEST_ASSERT(uthread_barrier_wait(NULL) == -1);
+
+	barrier = uthread_barrier_create(NR_THREADS);
+
+	/* Nobody leaves a round before everyone reached it */
+	run_crossers(UTHREAD_SCHED_FIFO);
+	TEST_ASSERT(!strcmp(trace, "ABC|C|A|B|||"));
+	TEST_ASSERT(nr_serial == NR_ROUNDS);
+
+	/* The last thread keeps running, woken up threads go before older ones */
+	run_crossers(UTHREAD_SCHED_LIFO);
+	TEST_ASSERT(!strcmp(trace, "CBA|A|C|B|||"));
+	TEST_ASSERT(nr_serial == NR_ROUNDS);
+
+	TEST_ASSERT(uthread_barrier_destroy(barrier) == 0);
+}
+
+static void latch_waiter(void *arg)
+{
+	uthread_latch_wait(latch);
+	trace[trace_len++] = (char)(size_t)arg;
+}
+
+static void latch_opener(void *arg)
+{
+	(void)arg;
+
+	uthread_create(latch_waiter, (void *)'A');
+	uthread_create(latch_waiter, (void *)'B');
+	uthread_yield();
+
+	uthread_latch_count_down(latch);
+	uthread_yield();
+	TEST_ASSERT(trace_len == 0);
+
+	uthread_latch_count_down(latch);
+	uthread_yield();
+	TEST_ASSERT(!strcmp(trace, "AB"));
+
+	/* Open for good */
+	TEST_ASSERT(uthread_latch_count_down(latch) == -1);
+	TEST_ASSERT(uthread_latch_wait(latch) == 0);
+}
+
+void test_latch(void)
+{
+	fprintf(stderr, "*** TEST latch ***\n");
+
+	trace_len = 0;
+	memset(trace, 0, sizeof(trace));
+	latch = uthread_latch_create(2);
+
+	uthread_set_sched(UTHREAD_SCHED_FIFO);
+	uthread_run(false, latch_opener, NULL);
+
+	TEST_ASSERT(uthread_latch_destroy(latch) == 0);
+	TEST_ASSERT(uthread_latch_count_down(NULL) == -1);
+}
+
+/*
+ * Round-trip time
+ */
+static size_t nr_participants, nr_rounds;
+
+/* Barrier out of semaphores, with a gate per round parity */
+static sem_t gates[2];
+static size_t arrived;
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void sem_barrier_wait(size_t round)
+{
+	sem_t gate = gates[round % 2];
+	size_t i;
+
+	if (++arrived == nr_participants) {
+		arrived = 0;
+		for (i = 0; i < nr_participants - 1; i++)
+			sem_up(gate);
+	} else {
+		sem_down(gate);
+	}
+}
+
+static void participant(void *arg)
+{
+	size_t i;
+
+	for (i = 0; i < nr_rounds; i++) {
+		if (arg)
+			sem_barrier_wait(i);
+		else
+			uthread_barrier_wait(barrier);
+	}
+}
+
+static void spawn_participants(void *arg)
+{
+	size_t i;
+
+	for (i = 0; i < nr_participants; i++)
+		uthread_create(participant, arg);
+}
+
+static double bench_round_trip(size_t n, bool semaphores)
+{
+	double start;
+
+	nr_participants = n;
+	nr_rounds = BENCH_CROSSINGS / n ? BENCH_CROSSINGS / n : 1;
+
+	barrier = uthread_barrier_create(n);
+	gates[0] = sem_create(0);
+	gates[1] = sem_create(0);
+
+	start = now();
+	uthread_run(false, spawn_participants, semaphores ? (void *)1 : NULL);
+	start = (now() - start) / nr_rounds;
+
+	uthread_barrier_destroy(barrier);
+	sem_destroy(gates[0]);
+	sem_destroy(gates[1]);
+
+	return start;
+}
+
+void bench_barrier(size_t n)
+{
+	double splice = bench_round_trip(n, false);
+	double sems = bench_round_trip(n, true);
+
+	printf("%zu threads: barrier %.1f us, semaphores %.1f us per round\n",
+	       n, splice * 1e6, sems * 1e6);
+}
+
+int main(int argc, char **argv)
+{
+	int i;
+
+	test_barrier();
+	test_latch();
+
+	fprintf(stderr, "*** BENCH barrier round-trip ***\n");
+	uthread_set_sched(UTHREAD_SCHED_FIFO);
+	if (argc > 1) {
+		for (i = 1; i < argc; i++)
+			bench_barrier(strtoul(argv[i], NULL, 0));
+	} else {
+		bench_barrier(10);
+		bench_barrier(1000);
+	}
+
+	return 0;
+}
@@ -0,0 +1,106 @@
+/*
+ * Batch thread creation test
+ *
+ * Tests the creation of several threads with a single call, and the fact that
+ * they are scheduled in the order they were given. The first thread creates a
+ * batch of three threads and yields, so the program should output:
+ *
+ * thread2
+ * thread3
+ * thread4
+ * thread1
+ *
+ * An optional argument gives a number of threads to create both one by one and
+ * as one batch, and reports how long each took.
+ */
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include <uthread.h>
+
+static size_t count;
+static size_t nr_threads;
+
+static void print_thread(void *arg)
+{
+	printf("thread%d\n", *(int *)arg);
+}
+
+static void thread1(void *arg)
+{
+	static int ids[] = { 2, 3, 4 };
+	uthread_func_t funcs[] = { print_thread, print_thread, print_thread };
+	void *args[] = { &ids[0], &ids[1], &ids[2] };
+
+	(void)arg;
+
+	uthread_create_batch(funcs, args, 3);
+	uthread_yield();
+	printf("thread1\n");
+}
+
+static void worker(void *arg)
+{
+	(void)arg;
+
+	count++;
+}
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void create_single(void *arg)
+{
+	double *elapsed = arg;
+	double start = now();
+	size_t i;
+
+	for (i = 0; i < nr_threads; i++)
+		uthread_create(worker, NULL);
+	*elapsed = now() - start;
+}
+
+static void create_batch(void *arg)
+{
+	double *elapsed = arg;
+	uthread_func_t *funcs = malloc(nr_threads * sizeof(*funcs));
+	double start;
+	size_t i;
+
+	for (i = 0; i < nr_threads; i++)
+		funcs[i] = worker;
+
+	start = now();
+	uthread_create_batch(funcs, NULL, nr_threads);
+	*elapsed = now() - start;
+
+	free(funcs);
+}
+
+int main(int argc, char **argv)
+{
+	double single, batch;
+
+	if (argc < 2) {
+		uthread_run(false, thread1, NULL);
+		return 0;
+	}
+
+	nr_threads = strtoul(argv[1], NULL, 0);
+
+	uthread_run(false, create_single, &single);
+	uthread_run(false, create_batch, &batch);
+
+	printf("%zu threads: uthread_create %.3f ms, uthread_create_batch %.3f ms\n",
+	       nr_threads, single * 1e3, batch * 1e3);
+
+	return count == 2 * nr_threads ? 0 : 1;
+}
@@ -0,0 +1,215 @@
+/*
+ * Future test
+ *
+ * Checks that futures deliver the results of their threads, that awaiting a
+ * set future doesn't switch threads, and that continuations and combinators
+ * follow the futures they depend on, and that results outlive their threads
+ * and the runtime without holding on to thread stacks. Then measures the cost of a round-trip
+ * through uthread_async() and future_await().
+ *
+ * Usage: uthread_future.x [N]
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include <future.h>
+#include <sem.h>
+#include <uthread.h>
+
+#define TEST_ASSERT(assert)				\
+do {									\
+	printf("ASSERT: " #assert " ... ");	\
+	if (assert) {						\
+		printf("PASS\n");				\
+	} else	{							\
+		printf("FAIL\n");				\
+		exit(1);						\
+	}									\
+} while(0)
+
+#define NR_FUTURES	10	/* More than fit in a wait on the stack */
+
+static sem_t gate;
+
+static void *square(void *arg)
+{
+	uintptr_t x = (uintptr_t)arg;
+
+	return (void *)(x * x);
+}
+
+static void *increment(void *arg)
+{
+	return (void *)((uintptr_t)arg + 1);
+}
+
+/* Block until the gate opens, then return arg */
+static void *gated(void *arg)
+{
+	sem_down(gate);
+	return arg;
+}
+
+static size_t nr_switches(void)
+{
+	struct uthread_stats stats;
+
+	uthread_get_stats(&stats);
+	return stats.context_switches;
+}
+
+static void test_await(void *arg)
+{
+	future_t f, g;
+	void *result;
+	size_t switches;
+
+	(void)arg;
+
+	TEST_ASSERT(uthread_async(NULL, NULL) == NULL);
+	TEST_ASSERT(future_await(NULL, &result) == -1);
+
+	f = uthread_async(square, (void *)7);
+	TEST_ASSERT(future_await(f, &result) == 0);
+	TEST_ASSERT((uintptr_t)result == 49);
+
+	/* Already set: no switch */
+	switches = nr_switches();
+	TEST_ASSERT(future_await(f, &result) == 0);
+	TEST_ASSERT((uintptr_t)result == 49 && nr_switches() == switches);
+
+	g = future_then(f, increment);
+	TEST_ASSERT(future_await(g, &result) == 0);
+	TEST_ASSERT((uintptr_t)result == 50);
+
+	/* The result outlives the thread, until destroyed */
+	uthread_yield();
+	TEST_ASSERT(future_await(f, &result) == 0 && (uintptr_t)result == 49);
+
+	future_destroy(g);
+	future_destroy(f);
+	TEST_ASSERT(future_destroy(NULL) == -1);
+}
+
+static void test_combine(void *arg)
+{
+	future_t fs[NR_FUTURES], all, any, then;
+	void *result;
+	size_t i, switches;
+
+	(void)arg;
+
+	gate = sem_create(0);
+	for (i = 0; i < NR_FUTURES; i++)
+		fs[i] = uthread_async(gated, (void *)i);
+
+	TEST_ASSERT(future_when_all(fs, 0) == NULL);
+	all = future_when_all(fs, NR_FUTURES);
+	any = future_when_any(fs, NR_FUTURES);
+	then = future_then(fs[3], increment);
+
+	/* Let everybody block, then open the gate for one */
+	uthread_yield();
+	sem_up(gate);
+	TEST_ASSERT(future_await(any, &result) == 0);
+	TEST_ASSERT((uintptr_t)result == 0);
+
+	for (i = 1; i < NR_FUTURES; i++)
+		sem_up(gate);
+	TEST_ASSERT(future_await(all, &result) == 0 && result == NULL);
+
+	/* All set now */
+	TEST_ASSERT(future_await(then, &result) == 0);
+	TEST_ASSERT((uintptr_t)result == 4);
+	for (i = 0; i < NR_FUTURES; i++) {
+		switches = nr_switches();
+		future_await(fs[i], &result);
+		if ((uintptr_t)result != i || nr_switches() != switches)
+			break;
+	}
+	TEST_ASSERT(i == NR_FUTURES);
+
+	future_destroy(then);
+	future_destroy(any);
+	future_destroy(all);
+	for (i = 0; i < NR_FUTURES; i++)
+		future_destroy(fs[i]);
+	sem_destroy(gate);
+}
+
+static future_t kept;
+
+static void test_outlive(void *arg)
+{
+	(void)arg;
+
+	kept = uthread_async(square, (void *)3);
+	/* Destroyed before its thread even ran */
+	TEST_ASSERT(future_destroy(uthread_async(square, (void *)4)) == 0);
+}
+
+/*
+ * Round-trip
+ */
+static size_t nr_rounds = 100000;
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void bench_round_trip(void *arg)
+{
+	double start = now();
+	void *result;
+	size_t i;
+
+	(void)arg;
+
+	for (i = 0; i < nr_rounds; i++) {
+		future_t f = uthread_async(square, (void *)i);
+
+		future_await(f, &result);
+		future_destroy(f);
+	}
+
+	printf("async + await: %.0f ns per round-trip\n",
+	       (now() - start) / nr_rounds * 1e9);
+}
+
+int main(int argc, char **argv)
+{
+	struct uthread_mem_stats mem;
+	void *result;
+
+	if (argc > 1)
+		nr_rounds = strtoul(argv[1], NULL, 0);
+
+	fprintf(stderr, "*** TEST future ***\n");
+	uthread_run(false, test_await, NULL);
+	uthread_run(false, test_combine, NULL);
+
+	/* Waiters of threads on the shared stack can't live on their stack */
+	uthread_set_stack_mode(UTHREAD_STACK_SHARED);
+	uthread_run(false, test_await, NULL);
+	uthread_run(false, test_combine, NULL);
+	uthread_set_stack_mode(UTHREAD_STACK_PRIVATE);
+
+	/* The threads are gone, stacks included, but not the result */
+	uthread_run(false, test_outlive, NULL);
+	uthread_mem_stats(&mem);
+	TEST_ASSERT(mem.stacks.live == 0 && mem.tcbs.live == 0);
+	TEST_ASSERT(future_await(kept, &result) == 0 && (uintptr_t)result == 9);
+	TEST_ASSERT(future_destroy(kept) == 0);
+
+	fprintf(stderr, "*** BENCH future ***\n");
+	uthread_run(false, bench_round_trip, NULL);
+
+	return 0;
+}
@@ -0,0 +1,192 @@
+/*
+ * Memory accounting test
+ *
+ * Checks that the memory held by the library is accounted while threads are
+ * blocked and given back once they are gone, in every stack mode, and that a
+ * memory budget makes thread creation fail. Then reports the memory held per
+ * blocked thread in each mode.
+ *
+ * Usage: uthread_mem.x [N]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include <sem.h>
+#include <uthread.h>
+
+#define TEST_ASSERT(assert)				\
+do {									\
+	printf("ASSERT: " #assert " ... ");	\
+	if (assert) {						\
+		printf("PASS\n");				\
+	} else	{							\
+		printf("FAIL\n");				\
+		exit(1);						\
+	}									\
+} while(0)
+
+#define NR_BUDGETED	10
+
+static size_t nr_threads = 1000;
+static sem_t gate;
+static struct uthread_mem_stats blocked;
+
+static void waiter(void *arg)
+{
+	(void)arg;
+
+	sem_down(gate);
+}
+
+static void spawner(void *arg)
+{
+	uthread_func_t *funcs = arg;
+	size_t i;
+
+	gate = sem_create(0);
+	if (funcs) {
+		uthread_create_batch(funcs, NULL, nr_threads);
+	} else {
+		for (i = 0; i < nr_threads; i++)
+			uthread_create(waiter, NULL);
+	}
+
+	/* Let every thread block */
+	uthread_yield();
+	uthread_mem_stats(&blocked);
+
+	for (i = 0; i < nr_threads; i++)
+		sem_up(gate);
+	uthread_yield();
+	sem_destroy(gate);
+}
+
+static size_t live_total(void)
+{
+	struct uthread_mem_stats stats;
+
+	uthread_mem_stats(&stats);
+	return stats.total.live;
+}
+
+static void test_mode(uthread_stack_mode_t mode, const char *name, bool batch)
+{
+	uthread_func_t *funcs = NULL;
+	struct uthread_mem_stats stats;
+	size_t i;
+
+	if (batch) {
+		funcs = malloc(nr_threads * sizeof(*funcs));
+		for (i = 0; i < nr_threads; i++)
+			funcs[i] = waiter;
+	}
+
+	uthread_set_stack_mode(mode);
+	TEST_ASSERT(uthread_run(false, spawner, funcs) == 0);
+	free(funcs);
+
+	TEST_ASSERT(blocked.tcbs.live >= nr_threads * 64);
+	TEST_ASSERT(blocked.stacks.live > 0 && blocked.semaphores.live > 0);
+	TEST_ASSERT(blocked.total.live == blocked.stacks.live +
+		    blocked.tcbs.live + blocked.queue_nodes.live +
+		    blocked.semaphores.live + blocked.pooled.live);
+
+	/* Everything was given back */
+	uthread_mem_stats(&stats);
+	TEST_ASSERT(stats.total.live == 0);
+	TEST_ASSERT(stats.total.peak >= blocked.total.live);
+
+	printf("%s%s: %zu bytes per blocked thread (stacks %zu, TCBs %zu, "
+	       "queue nodes %zu, pooled %zu)\n", name, batch ? " batch" : "",
+	       blocked.total.live / nr_threads,
+	       blocked.stacks.live / nr_threads,
+	       blocked.tcbs.live / nr_threads,
+	       blocked.queue_nodes.live / nr_threads,
+	       blocked.pooled.live / nr_threads);
+}
+
+/*
+ * Budget
+ */
+static size_t nr_created;
+static double fail_ns;
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void budgeted(void *arg)
+{
+	struct uthread_mem_stats stats;
+	uthread_func_t funcs[2] = { waiter, waiter };
+	size_t per_thread, i;
+	double start;
+
+	(void)arg;
+
+	gate = sem_create(0);
+
+	/* Learn the cost of one thread, then leave room for a few more */
+	uthread_create(waiter, NULL);
+	per_thread = live_total();
+	uthread_create(waiter, NULL);
+	per_thread = live_total() - per_thread;
+	uthread_set_mem_budget(live_total() + NR_BUDGETED * per_thread);
+
+	nr_created = 2;
+	while (uthread_create(waiter, NULL) == 0)
+		nr_created++;
+
+	start = now();
+	for (i = 0; i < 1000; i++)
+		uthread_create(waiter, NULL);
+	fail_ns = (now() - start) / 1000 * 1e9;
+
+	TEST_ASSERT(uthread_create_batch(funcs, NULL, 2) == -1);
+	uthread_mem_stats(&stats);
+	TEST_ASSERT(stats.total.live <= stats.budget);
+
+	uthread_set_mem_budget(0);
+	for (i = 0; i < nr_created; i++)
+		sem_up(gate);
+	uthread_yield();
+	sem_destroy(gate);
+}
+
+static void test_budget(void)
+{
+	uthread_set_stack_mode(UTHREAD_STACK_PRIVATE);
+	TEST_ASSERT(uthread_run(false, budgeted, NULL) == 0);
+	TEST_ASSERT(nr_created == 2 + NR_BUDGETED);
+	TEST_ASSERT(live_total() == 0);
+
+	printf("over budget: uthread_create() fails in %.0f ns\n", fail_ns);
+}
+
+int main(int argc, char **argv)
+{
+	if (argc > 1)
+		nr_threads = strtoul(argv[1], NULL, 0);
+
+	fprintf(stderr, "*** TEST mem ***\n");
+	TEST_ASSERT(uthread_mem_stats(NULL) == -1);
+	TEST_ASSERT(live_total() == 0);
+
+	test_mode(UTHREAD_STACK_PRIVATE, "private", false);
+	test_mode(UTHREAD_STACK_PRIVATE, "private", true);
+	test_mode(UTHREAD_STACK_SHARED, "shared", false);
+	test_mode(UTHREAD_STACK_SHARED, "shared", true);
+	test_mode(UTHREAD_STACK_GROWABLE, "growable", false);
+	test_mode(UTHREAD_STACK_ARENA, "arena", false);
+
+	fprintf(stderr, "*** TEST mem budget ***\n");
+	test_budget();
+
+	return 0;
+}
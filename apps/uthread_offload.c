@@ -0,0 +1,152 @@
+/*
+ * Blocking-call offload test
+ *
+ * N threads each make a blocking call (sleeping for 20 ms) through
+ * uthread_offload(), while another thread keeps counting its iterations. The
+ * counter must keep progressing while the calls block, and the calls must
+ * overlap on the offload pool instead of running one after the other.
+ *
+ * Then, with preemption on, 8 threads make 20000 calls each in a tight loop.
+ * Being preempted in the middle of a submission must not deadlock the others,
+ * and the pool threads must keep the preemption signal blocked.
+ *
+ * Usage: uthread_offload.x [N] [pool size]
+ */
+
+#include <signal.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <pthread.h>
+#include <uthread.h>
+
+#define NR_CALLS	8
+#define CALL_US		20000
+#define NR_STRESS	8
+#define STRESS_CALLS	20000
+
+static size_t nr_calls = NR_CALLS;
+static size_t nr_done;
+static size_t ticks;
+static atomic_size_t nr_unmasked;
+
+static void blocking_call(void *arg)
+{
+	(void)arg;
+
+	usleep(CALL_US);
+}
+
+static void caller(void *arg)
+{
+	(void)arg;
+
+	uthread_offload(blocking_call, NULL);
+	nr_done++;
+}
+
+static void ticker(void *arg)
+{
+	(void)arg;
+
+	while (nr_done < nr_calls) {
+		ticks++;
+		uthread_yield();
+	}
+}
+
+static void spawner(void *arg)
+{
+	size_t i;
+
+	(void)arg;
+
+	for (i = 0; i < nr_calls; i++)
+		uthread_create(caller, NULL);
+	uthread_create(ticker, NULL);
+}
+
+/* Runs on a pool thread */
+static void noop_call(void *arg)
+{
+	sigset_t mask;
+
+	(void)arg;
+
+	pthread_sigmask(SIG_BLOCK, NULL, &mask);
+	if (!sigismember(&mask, SIGVTALRM))
+		atomic_fetch_add(&nr_unmasked, 1);
+}
+
+static void stress_caller(void *arg)
+{
+	size_t i;
+
+	(void)arg;
+
+	for (i = 0; i < STRESS_CALLS; i++)
+		if (uthread_offload(noop_call, NULL) < 0)
+			return;
+}
+
+static void stress_spawner(void *arg)
+{
+	size_t i;
+
+	(void)arg;
+
+	for (i = 0; i < NR_STRESS; i++)
+		uthread_create(stress_caller, NULL);
+}
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int main(int argc, char **argv)
+{
+	struct uthread_stats stats;
+	double start, elapsed;
+	size_t calls;
+
+	if (argc > 1)
+		nr_calls = strtoul(argv[1], NULL, 0);
+	if (argc > 2)
+		uthread_set_offload_threads(strtoul(argv[2], NULL, 0));
+
+	start = now();
+	uthread_run(false, spawner, NULL);
+	elapsed = now() - start;
+	uthread_get_stats(&stats);
+
+	printf("%zu/%zu calls of %d ms in %.0f ms, %zu ticks meanwhile\n",
+	       nr_done, nr_calls, CALL_US / 1000, elapsed * 1e3, ticks);
+	printf("queue peak %zu, average queueing %.2f ms, average latency %.2f ms\n",
+	       stats.offload_queue_peak,
+	       stats.offload_queue_ns / 1e6 / stats.offload_calls,
+	       stats.offload_latency_ns / 1e6 / stats.offload_calls);
+
+	if (nr_done != nr_calls || ticks == 0)
+		return 1;
+
+	start = now();
+	uthread_run(true, stress_spawner, NULL);
+	elapsed = now() - start;
+	calls = stats.offload_calls;
+	uthread_get_stats(&stats);
+	calls = stats.offload_calls - calls;
+
+	printf("preempted: %zu/%d calls in %.0f ms, %zu with the timer signal unblocked\n",
+	       calls, NR_STRESS * STRESS_CALLS, elapsed * 1e3,
+	       (size_t)atomic_load(&nr_unmasked));
+
+	return calls == NR_STRESS * STRESS_CALLS &&
+	       atomic_load(&nr_unmasked) == 0 ? 0 : 1;
+}
@@ -0,0 +1,191 @@
+/*
+ * Per-thread counter test
+ *
+ * Measures the cost of a context switch, then starts counting events per
+ * thread and checks that a thread walking a large buffer is charged more than
+ * a thread that barely works, and that counters are read once per switch. Then
+ * measures the cost of a context switch again, counters included. The report
+ * of the counters is printed at exit.
+ *
+ * Usage: uthread_perf.x [N]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <uthread.h>
+
+#define TEST_ASSERT(assert)				\
+do {									\
+	printf("ASSERT: " #assert " ... ");	\
+	if (assert) {						\
+		printf("PASS\n");				\
+	} else	{							\
+		printf("FAIL\n");				\
+		exit(1);						\
+	}									\
+} while(0)
+
+#define BUFFER_SIZE	(64 * 1024 * 1024)
+#define NR_STEPS	8
+#define NR_LIGHT	4
+
+static char *buffer;
+static struct uthread_perf heavy_perf, light_perf;
+
+/* Touch one byte per cache line of the whole buffer, for each step */
+static void heavy(void *arg)
+{
+	size_t i, step;
+
+	(void)arg;
+
+	uthread_set_name("heavy");
+	for (step = 0; step < NR_STEPS; step++) {
+		for (i = 0; i < BUFFER_SIZE; i += 64)
+			buffer[i]++;
+		uthread_yield();
+	}
+	uthread_get_perf(NULL, &heavy_perf);
+}
+
+static void light(void *arg)
+{
+	size_t step;
+
+	(void)arg;
+
+	uthread_set_name("light");
+	for (step = 0; step < NR_STEPS; step++)
+		uthread_yield();
+	uthread_get_perf(NULL, &light_perf);
+}
+
+static void spawn(void *arg)
+{
+	struct uthread_perf perf;
+	uthread_handle_t h;
+	size_t i;
+
+	(void)arg;
+
+	uthread_set_name("spawn");
+	uthread_create_handle(heavy, NULL, &h);
+	for (i = 0; i < NR_LIGHT; i++)
+		uthread_create(light, NULL);
+
+	/* Nothing counted for a thread that didn't run yet */
+	TEST_ASSERT(uthread_get_perf(h, &perf) == 0);
+	TEST_ASSERT(perf.switches == 0 && perf.cycles == 0 &&
+		    perf.task_clock_ns == 0);
+	TEST_ASSERT(uthread_get_perf(NULL, NULL) == -1);
+}
+
+static size_t nr_readings(struct uthread_stats *stats)
+{
+	return stats->perf_reads + stats->perf_rdpmc_reads;
+}
+
+static void test_counts(void)
+{
+	struct uthread_stats before, after;
+	size_t switches, readings;
+
+	fprintf(stderr, "*** TEST counts ***\n");
+
+	buffer = calloc(1, BUFFER_SIZE);
+	uthread_get_stats(&before);
+	uthread_run(false, spawn, NULL);
+	uthread_get_stats(&after);
+	free(buffer);
+
+	TEST_ASSERT(heavy_perf.switches == NR_STEPS);
+	TEST_ASSERT(light_perf.switches == NR_STEPS);
+	TEST_ASSERT(heavy_perf.cycles + heavy_perf.task_clock_ns >
+		    10 * (light_perf.cycles + light_perf.task_clock_ns));
+	TEST_ASSERT(heavy_perf.cache_misses >= light_perf.cache_misses);
+
+	/* One reading per switch, plus the start and the end of the run, and
+	 * one per call for a running thread */
+	switches = after.context_switches - before.context_switches;
+	readings = nr_readings(&after) - nr_readings(&before);
+	TEST_ASSERT(readings == switches + 2 + 1 + NR_LIGHT);
+
+	printf("heavy: %llu instructions, %llu cycles, %llu cache misses, "
+	       "%.3f ms\n", heavy_perf.instructions, heavy_perf.cycles,
+	       heavy_perf.cache_misses, heavy_perf.task_clock_ns / 1e6);
+	printf("counters read with %s\n",
+	       after.perf_rdpmc_reads ? "rdpmc" : "read()");
+}
+
+/*
+ * Switch cost
+ */
+static size_t nr_yields = 1000000;
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void yielder(void *arg)
+{
+	size_t i;
+
+	(void)arg;
+
+	for (i = 0; i < nr_yields / 2; i++)
+		uthread_yield();
+}
+
+static void spawn_yielders(void *arg)
+{
+	(void)arg;
+
+	uthread_create(yielder, NULL);
+	uthread_create(yielder, NULL);
+}
+
+static double bench_switch(void)
+{
+	struct uthread_stats before, after;
+	double start;
+
+	uthread_get_stats(&before);
+	start = now();
+	uthread_run(false, spawn_yielders, NULL);
+	start = now() - start;
+	uthread_get_stats(&after);
+
+	return start / (after.context_switches - before.context_switches) * 1e9;
+}
+
+int main(int argc, char **argv)
+{
+	struct uthread_perf perf;
+	double off;
+
+	if (argc > 1)
+		nr_yields = strtoul(argv[1], NULL, 0);
+
+	TEST_ASSERT(uthread_get_perf(NULL, &perf) == -1);
+	off = bench_switch();
+
+	if (uthread_perf_start(10) < 0) {
+		printf("no perf event can be counted here, skipping\n");
+		return 0;
+	}
+
+	test_counts();
+
+	fprintf(stderr, "*** BENCH switch ***\n");
+	printf("switch: %.0f ns without counters, %.0f ns with counters\n",
+	       off, bench_switch());
+
+	return 0;
+}
@@ -0,0 +1,190 @@
+/*
+ * Worker pool test
+ *
+ * Checks that pools run every submitted task, including when submitters have
+ * to wait for room and when tasks submit tasks, then compares the task
+ * throughput of a pool with creating one thread per task.
+ *
+ * Usage: uthread_pool.x [TASKS] [WORKERS]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include <pool.h>
+#include <uthread.h>
+
+#define TEST_ASSERT(assert)				\
+do {									\
+	printf("ASSERT: " #assert " ... ");	\
+	if (assert) {						\
+		printf("PASS\n");				\
+	} else	{							\
+		printf("FAIL\n");				\
+		exit(1);						\
+	}									\
+} while(0)
+
+#define NR_TASKS	100
+#define BATCH		64
+
+static uthread_pool_t pool;
+static size_t done;
+
+static void task(void *arg)
+{
+	(void)arg;
+
+	done++;
+}
+
+/* Task yielding in the middle, so that other workers get to run */
+static void slow_task(void *arg)
+{
+	(void)arg;
+
+	uthread_yield();
+	done++;
+}
+
+static void parent_task(void *arg)
+{
+	(void)arg;
+
+	uthread_pool_submit(pool, task, NULL);
+	done++;
+}
+
+static void test_submit(void *arg)
+{
+	uthread_func_t funcs[NR_TASKS];
+	size_t i;
+
+	(void)arg;
+
+	TEST_ASSERT(uthread_pool_create(0, 1) == NULL);
+	TEST_ASSERT(uthread_pool_create(1, 0) == NULL);
+
+	pool = uthread_pool_create(4, 16);
+	TEST_ASSERT(pool != NULL);
+
+	TEST_ASSERT(uthread_pool_submit(pool, NULL, NULL) == -1);
+	TEST_ASSERT(uthread_pool_wait_all(pool) == 0); /* nothing to wait for */
+
+	done = 0;
+	for (i = 0; i < NR_TASKS; i++)
+		uthread_pool_submit(pool, slow_task, NULL);
+	TEST_ASSERT(uthread_pool_wait_all(pool) == 0);
+	TEST_ASSERT(done == NR_TASKS);
+
+	/* Much more tasks than room in the queue */
+	done = 0;
+	for (i = 0; i < NR_TASKS; i++)
+		funcs[i] = i % 2 ? task : slow_task;
+	TEST_ASSERT(uthread_pool_submit_batch(pool, funcs, NULL, NR_TASKS) == 0);
+	TEST_ASSERT(uthread_pool_wait_all(pool) == 0);
+	TEST_ASSERT(done == NR_TASKS);
+
+	/* Tasks submitted by tasks are waited for too */
+	done = 0;
+	for (i = 0; i < NR_TASKS / 2; i++)
+		uthread_pool_submit(pool, parent_task, NULL);
+	TEST_ASSERT(uthread_pool_wait_all(pool) == 0);
+	TEST_ASSERT(done == NR_TASKS);
+
+	funcs[0] = NULL;
+	TEST_ASSERT(uthread_pool_submit_batch(pool, funcs, NULL, 1) == -1);
+
+	TEST_ASSERT(uthread_pool_destroy(pool) == 0);
+}
+
+void test_pool(void)
+{
+	int ret;
+
+	fprintf(stderr, "*** TEST pool ***\n");
+
+	/* Returns once the workers are gone */
+	ret = uthread_run(false, test_submit, NULL);
+	TEST_ASSERT(ret == 0);
+}
+
+/*
+ * Throughput
+ */
+static size_t nr_tasks = 1000000;
+static size_t nr_workers = 4;
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void bench_pooled(void *arg)
+{
+	uthread_func_t funcs[BATCH];
+	size_t i;
+
+	(void)arg;
+
+	for (i = 0; i < BATCH; i++)
+		funcs[i] = task;
+
+	pool = uthread_pool_create(nr_workers, BATCH * 4);
+	for (i = 0; i < nr_tasks; i += BATCH)
+		uthread_pool_submit_batch(pool, funcs, NULL,
+					  nr_tasks - i < BATCH ? nr_tasks - i : BATCH);
+	uthread_pool_destroy(pool);
+}
+
+static void bench_threads(void *arg)
+{
+	size_t i;
+
+	(void)arg;
+
+	for (i = 0; i < nr_tasks; i++) {
+		uthread_create(task, NULL);
+		/* Let threads run and be reaped, like the pool's workers do */
+		if (i % BATCH == BATCH - 1)
+			uthread_yield();
+	}
+}
+
+void bench_pool(void)
+{
+	double start, pooled, threads;
+
+	fprintf(stderr, "*** BENCH pool ***\n");
+
+	done = 0;
+	start = now();
+	uthread_run(false, bench_pooled, NULL);
+	pooled = now() - start;
+
+	done = 0;
+	start = now();
+	uthread_run(false, bench_threads, NULL);
+	threads = now() - start;
+
+	printf("pool of %zu workers: %.2f M tasks/s\n", nr_workers,
+	       nr_tasks / pooled / 1e6);
+	printf("thread per task: %.2f M tasks/s\n", nr_tasks / threads / 1e6);
+}
+
+int main(int argc, char **argv)
+{
+	if (argc > 1)
+		nr_tasks = strtoul(argv[1], NULL, 0);
+	if (argc > 2)
+		nr_workers = strtoul(argv[2], NULL, 0);
+
+	test_pool();
+	bench_pool();
+
+	return 0;
+}
@@ -0,0 +1,274 @@
+/*
+ * Static probe test
+ *
+ * Reads the probe notes of its own binary, as a tracer would, and checks that
+ * every probe of the library is there, under the "uthread" provider, with the
+ * expected number of arguments, and that a detached probe is a single nop. Then
+ * runs threads through every probed path, to check that the probes don't
+ * change anything when no tracer is attached.
+ *
+ * Usage: uthread_probes.x
+ */
+
+#include <elf.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <barrier.h>
+#include <sem.h>
+#include <uthread.h>
+
+#define TEST_ASSERT(assert)				\
+do {									\
+	printf("ASSERT: " #assert " ... ");	\
+	if (assert) {						\
+		printf("PASS\n");				\
+	} else	{							\
+		printf("FAIL\n");				\
+		exit(1);						\
+	}									\
+} while(0)
+
+static const struct {
+	const char *name;
+	size_t nr_args;
+} probes[] = {
+	{ "create", 3 },
+	{ "exit", 2 },
+	{ "switch", 4 },
+	{ "block", 2 },
+	{ "unblock", 2 },
+	{ "unpark", 2 },
+	{ "sem_down_block", 2 },
+	{ "sem_down_any_block", 3 },
+	{ "sem_up_wake", 3 },
+	{ "preempt_tick", 2 },
+};
+
+#define NR_PROBES	(sizeof(probes) / sizeof(probes[0]))
+
+static size_t found[NR_PROBES];
+static size_t nr_notes, nr_nops;
+
+static char *read_file(const char *path, size_t *size)
+{
+	FILE *f = fopen(path, "rb");
+	char *data = NULL;
+	long len;
+
+	if (!f)
+		return NULL;
+	if (fseek(f, 0, SEEK_END) == 0 && (len = ftell(f)) > 0) {
+		data = malloc(len);
+		rewind(f);
+		if (data && fread(data, 1, len, f) != (size_t)len) {
+			free(data);
+			data = NULL;
+		}
+		*size = len;
+	}
+	fclose(f);
+
+	return data;
+}
+
+/* Whether the instruction at @addr, as linked, is a nop */
+static bool is_nop(const char *elf, const Elf64_Shdr *sections, size_t n,
+		   uint64_t addr)
+{
+	size_t i;
+
+	for (i = 0; i < n; i++) {
+		const Elf64_Shdr *s = &sections[i];
+		const unsigned char *insn;
+
+		if (s->sh_type != SHT_PROGBITS || !(s->sh_flags & SHF_EXECINSTR) ||
+		    addr < s->sh_addr || addr >= s->sh_addr + s->sh_size)
+			continue;
+
+		insn = (const unsigned char *)elf + s->sh_offset +
+		       (addr - s->sh_addr);
+#if defined(__x86_64__)
+		return insn[0] == 0x90;
+#elif defined(__aarch64__)
+		return insn[0] == 0x1f && insn[1] == 0x20 && insn[2] == 0x03 &&
+		       insn[3] == 0xd5;
+#else
+		return false;
+#endif
+	}
+
+	return false;
+}
+
+static size_t count_args(const char *args)
+{
+	size_t n = 0;
+
+	for (; *args; args++)
+		if (*args == '@')
+			n++;
+
+	return n;
+}
+
+/* Check the note of one probe, whose descriptor is @desc */
+static void read_probe(const char *elf, const Elf64_Shdr *sections, size_t n,
+		       const char *desc)
+{
+	const char *provider = desc + 3 * sizeof(uint64_t);
+	const char *name = provider + strlen(provider) + 1;
+	const char *args = name + strlen(name) + 1;
+	uint64_t pc;
+	size_t i;
+
+	memcpy(&pc, desc, sizeof(pc));
+	nr_notes++;
+	if (strcmp(provider, "uthread"))
+		return;
+
+	if (is_nop(elf, sections, n, pc))
+		nr_nops++;
+
+	for (i = 0; i < NR_PROBES; i++)
+		if (!strcmp(name, probes[i].name) &&
+		    count_args(args) == probes[i].nr_args)
+			found[i]++;
+}
+
+static void read_notes(const char *elf, size_t size)
+{
+	const Elf64_Ehdr *ehdr = (const Elf64_Ehdr *)elf;
+	const Elf64_Shdr *sections;
+	const char *names;
+	size_t i;
+
+	if (size < sizeof(*ehdr) || memcmp(ehdr->e_ident, ELFMAG, SELFMAG) ||
+	    ehdr->e_ident[EI_CLASS] != ELFCLASS64)
+		return;
+
+	sections = (const Elf64_Shdr *)(elf + ehdr->e_shoff);
+	names = elf + sections[ehdr->e_shstrndx].sh_offset;
+
+	for (i = 0; i < ehdr->e_shnum; i++) {
+		const char *note = elf + sections[i].sh_offset;
+		const char *end = note + sections[i].sh_size;
+
+		if (sections[i].sh_type != SHT_NOTE ||
+		    strcmp(names + sections[i].sh_name, ".note.stapsdt"))
+			continue;
+
+		while (note + sizeof(Elf64_Nhdr) <= end) {
+			const Elf64_Nhdr *nhdr = (const Elf64_Nhdr *)note;
+			const char *desc = note + sizeof(*nhdr) +
+					   ((nhdr->n_namesz + 3) & ~3u);
+
+			if (nhdr->n_type == 3 &&
+			    !strcmp(note + sizeof(*nhdr), "stapsdt"))
+				read_probe(elf, sections, ehdr->e_shnum, desc);
+			note = desc + ((nhdr->n_descsz + 3) & ~3u);
+		}
+	}
+}
+
+static void test_notes(void)
+{
+	size_t i, size = 0;
+	char *elf;
+
+	fprintf(stderr, "*** TEST notes ***\n");
+
+	elf = read_file("/proc/self/exe", &size);
+	TEST_ASSERT(elf != NULL);
+	read_notes(elf, size);
+	free(elf);
+
+#if defined(__x86_64__) || defined(__aarch64__)
+	for (i = 0; i < NR_PROBES; i++) {
+		printf("%s: ", probes[i].name);
+		TEST_ASSERT(found[i] > 0);
+	}
+	TEST_ASSERT(nr_nops == nr_notes);
+	printf("%zu probe sites\n", nr_notes);
+#else
+	(void)i;
+	printf("no probes on this architecture, skipping\n");
+#endif
+}
+
+/*
+ * Probed paths
+ */
+static sem_t sems[2];
+static uthread_barrier_t barrier;
+static volatile size_t nr_done;
+
+static void downer(void *arg)
+{
+	(void)arg;
+
+	sem_down(sems[0]);
+	TEST_ASSERT(sem_down_any(sems, 2) >= 0);
+	uthread_barrier_wait(barrier);
+	nr_done++;
+}
+
+static void upper(void *arg)
+{
+	size_t i;
+
+	(void)arg;
+
+	for (i = 0; i < 2; i++) {
+		uthread_yield();
+		sem_up(sems[i]);
+	}
+	uthread_barrier_wait(barrier);
+	nr_done++;
+}
+
+/* Only lets the others run when preempted */
+static void spinner(void *arg)
+{
+	(void)arg;
+
+	while (nr_done < 2)
+		;
+}
+
+static void spawn(void *arg)
+{
+	uthread_func_t funcs[] = { downer, upper };
+
+	(void)arg;
+
+	uthread_create_batch(funcs, NULL, 2);
+	uthread_create(spinner, NULL);
+}
+
+static void test_paths(void)
+{
+	fprintf(stderr, "*** TEST paths ***\n");
+
+	sems[0] = sem_create(0);
+	sems[1] = sem_create(0);
+	barrier = uthread_barrier_create(2);
+
+	uthread_run(true, spawn, NULL);
+	TEST_ASSERT(nr_done == 2);
+
+	uthread_barrier_destroy(barrier);
+	sem_destroy(sems[0]);
+	sem_destroy(sems[1]);
+}
+
+int main(void)
+{
+	test_notes();
+	test_paths();
+
+	return 0;
+}
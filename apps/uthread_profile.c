@@ -0,0 +1,139 @@
+/*
+ * Sampling profiler test
+ *
+ * Two CPU-bound threads run under preemption, one doing three times as much
+ * work as the other. The profile must attribute the samples to each thread in
+ * proportion, under the thread's name and with its own call stack. The folded
+ * stacks are written to the file given as argument, if any, for flame graph
+ * generators.
+ *
+ * Usage: uthread_profile.x [FILE]
+ */
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <uthread.h>
+
+#define TEST_ASSERT(assert)				\
+do {									\
+	printf("ASSERT: " #assert " ... ");	\
+	if (assert) {						\
+		printf("PASS\n");				\
+	} else	{							\
+		printf("FAIL\n");				\
+		exit(1);						\
+	}									\
+} while(0)
+
+#define WORK_UNIT	50000000
+
+static volatile unsigned long sink;
+
+/* Not static, so that the profile can name them */
+__attribute__((noinline)) unsigned long mix(unsigned long x)
+{
+	x ^= x >> 33;
+	x *= 0xff51afd7ed558ccdUL;
+	return x ^ (x >> 33);
+}
+
+__attribute__((noinline)) void hash_block(size_t units)
+{
+	unsigned long x = 1;
+	size_t i;
+
+	for (i = 0; i < units * WORK_UNIT; i++)
+		x = mix(x + i);
+	sink = x;
+}
+
+void hasher(void *arg)
+{
+	(void)arg;
+
+	uthread_set_name("hasher");
+	hash_block(3);
+	sink++; /* no tail call, keep this frame in the stacks */
+}
+
+void sorter(void *arg)
+{
+	(void)arg;
+
+	uthread_set_name("sorter");
+	hash_block(1);
+	sink++;
+}
+
+static void start(void *arg)
+{
+	(void)arg;
+
+	uthread_create(hasher, NULL);
+	uthread_create(sorter, NULL);
+}
+
+/* Samples of the stacks rooted at @root in folded stacks @buf */
+static size_t samples_of(char *buf, const char *root, const char *frame)
+{
+	size_t total = 0, len = strlen(root);
+	char *line;
+
+	for (line = strtok(buf, "\n"); line; line = strtok(NULL, "\n")) {
+		if (strncmp(line, root, len) || line[len] != ';')
+			continue;
+		if (frame && !strstr(line, frame))
+			continue;
+		total += strtoul(strrchr(line, ' ') + 1, NULL, 10);
+	}
+
+	return total;
+}
+
+int main(int argc, char **argv)
+{
+	char path[] = "/tmp/uthread_profile.XXXXXX";
+	size_t hashers, sorters, in_hasher;
+	char *buf;
+	ssize_t len;
+	int fd;
+
+	fd = argc > 1 ? open(argv[1], O_RDWR | O_CREAT | O_TRUNC, 0644)
+		      : mkstemp(path);
+	if (fd < 0) {
+		perror("open");
+		return 1;
+	}
+	if (argc == 1)
+		unlink(path);
+
+	TEST_ASSERT(uthread_profile_start(0) == 0);
+	TEST_ASSERT(uthread_profile_start(0) == -1);
+	uthread_run(true, start, NULL);
+	uthread_profile_stop();
+
+	TEST_ASSERT(uthread_profile_write(fd, true) > 0);
+
+	/* Read the folded stacks back */
+	len = lseek(fd, 0, SEEK_END);
+	buf = malloc(len + 1);
+	if (!buf || pread(fd, buf, len, 0) != len)
+		return 1;
+	buf[len] = '\0';
+
+	hashers = samples_of(strdup(buf), "hasher", NULL);
+	sorters = samples_of(strdup(buf), "sorter", NULL);
+	in_hasher = samples_of(strdup(buf), "hasher", ";hasher;");
+	printf("samples: hasher %zu, sorter %zu, hasher unwound to hasher() %zu\n",
+	       hashers, sorters, in_hasher);
+
+	TEST_ASSERT(sorters > 0);
+	TEST_ASSERT(hashers > 2 * sorters && hashers < 4 * sorters);
+	TEST_ASSERT(in_hasher > hashers / 2);
+
+	return 0;
+}
@@ -0,0 +1,313 @@
+/*
+ * Seeded scheduling test
+ *
+ * Checks that runs under the seeded random policy make the same decisions for
+ * the same seed, and different ones for different seeds, that a yield may go on
+ * with the same thread, and that a recorded run of a producer/consumer pipeline
+ * replays exactly. Then measures the cost of a yield under each policy, and the
+ * size of the decision log.
+ *
+ * Usage: uthread_replay.x [N]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <sem.h>
+#include <uthread.h>
+
+#define TEST_ASSERT(assert)				\
+do {									\
+	printf("ASSERT: " #assert " ... ");	\
+	if (assert) {						\
+		printf("PASS\n");				\
+	} else	{							\
+		printf("FAIL\n");				\
+		exit(1);						\
+	}									\
+} while(0)
+
+#define NR_YIELDERS	4
+#define NR_TURNS	16
+#define NR_STAGES	4
+#define NR_ITEMS	1000
+#define BUFFER_SIZE	4
+
+static char trace[NR_STAGES * NR_ITEMS * 2];
+static size_t trace_len;
+
+static void record(char c)
+{
+	if (trace_len < sizeof(trace) - 1)
+		trace[trace_len++] = c;
+}
+
+static void yielder(void *arg)
+{
+	size_t i;
+
+	for (i = 0; i < NR_TURNS; i++) {
+		record((char)(size_t)arg);
+		uthread_yield();
+	}
+}
+
+static void spawn_yielders(void *arg)
+{
+	size_t i;
+
+	(void)arg;
+
+	for (i = 0; i < NR_YIELDERS; i++)
+		uthread_create(yielder, (void *)('A' + i));
+}
+
+/*
+ * Pipeline: each stage takes items from the buffer of the previous one, and
+ * hands them to the next one through a bounded buffer
+ */
+struct buffer {
+	sem_t full, empty;
+	size_t items[BUFFER_SIZE];
+	size_t head, tail;
+};
+
+static struct buffer buffers[NR_STAGES];
+static size_t nr_stages;
+
+static void buffer_put(struct buffer *b, size_t item)
+{
+	sem_down(b->empty);
+	b->items[b->head++ % BUFFER_SIZE] = item;
+	sem_up(b->full);
+}
+
+static size_t buffer_get(struct buffer *b)
+{
+	size_t item;
+
+	sem_down(b->full);
+	item = b->items[b->tail++ % BUFFER_SIZE];
+	sem_up(b->empty);
+
+	return item;
+}
+
+static void stage(void *arg)
+{
+	size_t i, n = (size_t)arg;
+
+	for (i = 0; i < NR_ITEMS; i++) {
+		size_t item = n ? buffer_get(&buffers[n - 1]) : i;
+
+		record('0' + n);
+		if (n < nr_stages - 1)
+			buffer_put(&buffers[n], item);
+	}
+}
+
+static void spawn_pipeline(void *arg)
+{
+	size_t i;
+
+	nr_stages = (size_t)arg;
+	for (i = 0; i < NR_STAGES; i++) {
+		buffers[i].full = sem_create(0);
+		buffers[i].empty = sem_create(BUFFER_SIZE);
+		buffers[i].head = buffers[i].tail = 0;
+	}
+	for (i = nr_stages; i-- > 0;)
+		uthread_create(stage, (void *)i);
+}
+
+static void destroy_pipeline(void)
+{
+	size_t i;
+
+	for (i = 0; i < NR_STAGES; i++) {
+		sem_destroy(buffers[i].full);
+		sem_destroy(buffers[i].empty);
+	}
+}
+
+static const char *run_trace(uthread_func_t func, void *arg, char *copy)
+{
+	trace_len = 0;
+	memset(trace, 0, sizeof(trace));
+	uthread_run(false, func, arg);
+	if (func == spawn_pipeline)
+		destroy_pipeline();
+
+	strcpy(copy, trace);
+	return copy;
+}
+
+static size_t divergences(void)
+{
+	struct uthread_stats stats;
+
+	uthread_get_stats(&stats);
+	return stats.sched_replay_divergences;
+}
+
+static bool has_repeat(const char *s)
+{
+	for (; s[0] && s[1]; s++)
+		if (s[0] == s[1])
+			return true;
+
+	return false;
+}
+
+static char first[sizeof(trace)], second[sizeof(trace)];
+
+static void test_seed(void)
+{
+	fprintf(stderr, "*** TEST seed ***\n");
+
+	TEST_ASSERT(uthread_sched_log_write(STDOUT_FILENO) == -1);
+	TEST_ASSERT(uthread_set_sched(UTHREAD_SCHED_RANDOM) == 0);
+	TEST_ASSERT(uthread_set_sched(UTHREAD_SCHED_RANDOM + 1) == -1);
+
+	uthread_set_sched_seed(1);
+	run_trace(spawn_yielders, NULL, first);
+	run_trace(spawn_yielders, NULL, second);
+	TEST_ASSERT(strlen(first) == NR_YIELDERS * NR_TURNS);
+	TEST_ASSERT(!strcmp(first, second));
+
+	/* Yields don't always switch */
+	TEST_ASSERT(has_repeat(first));
+
+	uthread_set_sched_seed(2);
+	run_trace(spawn_yielders, NULL, second);
+	TEST_ASSERT(strcmp(first, second));
+
+	/* Preemption ticks don't change anything */
+	uthread_set_sched_seed(1);
+	trace_len = 0;
+	memset(trace, 0, sizeof(trace));
+	uthread_run(true, spawn_yielders, NULL);
+	TEST_ASSERT(!strcmp(first, trace));
+}
+
+static void test_replay(void)
+{
+	FILE *log = tmpfile();
+	struct uthread_stats stats;
+	size_t diverged = divergences();
+	long size;
+
+	fprintf(stderr, "*** TEST replay ***\n");
+
+	uthread_set_sched_seed(7);
+	run_trace(spawn_pipeline, (void *)NR_STAGES, first);
+	TEST_ASSERT(uthread_sched_log_write(fileno(log)) == 0);
+	size = ftell(log);
+
+	/* Another seed takes other decisions, unless replaying */
+	uthread_set_sched_seed(8);
+	run_trace(spawn_pipeline, (void *)NR_STAGES, second);
+	TEST_ASSERT(strcmp(first, second));
+
+	rewind(log);
+	TEST_ASSERT(uthread_sched_replay(fileno(log)) == 0);
+	run_trace(spawn_pipeline, (void *)NR_STAGES, second);
+	TEST_ASSERT(!strcmp(first, second));
+	TEST_ASSERT(divergences() == diverged);
+
+	/* The log is kept for the following runs */
+	run_trace(spawn_pipeline, (void *)NR_STAGES, second);
+	TEST_ASSERT(!strcmp(first, second));
+
+	/* A shorter pipeline doesn't follow the log */
+	run_trace(spawn_pipeline, (void *)(NR_STAGES - 1), second);
+	TEST_ASSERT(divergences() == diverged + 1);
+
+	TEST_ASSERT(uthread_sched_replay(-1) == 0);
+	uthread_set_sched_seed(8);
+	run_trace(spawn_pipeline, (void *)NR_STAGES, first);
+	TEST_ASSERT(strcmp(first, second));
+
+	/* Not a log */
+	rewind(log);
+	fputs("garbage, garbage, garbage, garbage", log);
+	fflush(log);
+	rewind(log);
+	TEST_ASSERT(uthread_sched_replay(fileno(log)) == -1);
+	fclose(log);
+
+	uthread_get_stats(&stats);
+	printf("pipeline: %zu decisions so far, last log %ld bytes\n",
+	       stats.sched_decisions, size);
+}
+
+/*
+ * Yield cost
+ */
+static size_t nr_yields = 1000000;
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void bench_yielder(void *arg)
+{
+	size_t i;
+
+	(void)arg;
+
+	for (i = 0; i < nr_yields / NR_YIELDERS; i++)
+		uthread_yield();
+}
+
+static void spawn_bench(void *arg)
+{
+	size_t i;
+
+	(void)arg;
+
+	for (i = 0; i < NR_YIELDERS; i++)
+		uthread_create(bench_yielder, NULL);
+}
+
+static void bench_yield(void)
+{
+	FILE *log = tmpfile();
+	double start;
+
+	fprintf(stderr, "*** BENCH yield ***\n");
+
+	uthread_set_sched(UTHREAD_SCHED_FIFO);
+	start = now();
+	uthread_run(false, spawn_bench, NULL);
+	printf("fifo: %.0f ns per yield\n", (now() - start) / nr_yields * 1e9);
+
+	uthread_set_sched(UTHREAD_SCHED_RANDOM);
+	start = now();
+	uthread_run(false, spawn_bench, NULL);
+	printf("random: %.0f ns per yield\n", (now() - start) / nr_yields * 1e9);
+
+	uthread_sched_log_write(fileno(log));
+	printf("random: %.2f log bytes per yield\n",
+	       (double)ftell(log) / nr_yields);
+	fclose(log);
+}
+
+int main(int argc, char **argv)
+{
+	if (argc > 1)
+		nr_yields = strtoul(argv[1], NULL, 0);
+
+	test_seed();
+	test_replay();
+	bench_yield();
+
+	return 0;
+}
@@ -0,0 +1,217 @@
+/*
+ * Scheduling policy test
+ *
+ * Checks the order in which each policy runs threads, then measures the
+ * wake-up latency of a thread woken up by a semaphore while N other threads
+ * keep yielding, for each policy.
+ *
+ * Usage: uthread_sched.x [N]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <sem.h>
+#include <uthread.h>
+
+#define TEST_ASSERT(assert)				\
+do {									\
+	printf("ASSERT: " #assert " ... ");	\
+	if (assert) {						\
+		printf("PASS\n");				\
+	} else	{							\
+		printf("FAIL\n");				\
+		exit(1);						\
+	}									\
+} while(0)
+
+#define NR_YIELDERS	100
+#define NR_WAKEUPS	1000
+#define NR_ROUNDS	4
+
+static char trace[64];
+static size_t trace_len;
+
+static void record(void *arg)
+{
+	trace[trace_len++] = (char)(size_t)arg;
+}
+
+static void spawn_abc(void *arg)
+{
+	(void)arg;
+
+	uthread_create(record, (void *)'A');
+	uthread_create(record, (void *)'B');
+	uthread_create(record, (void *)'C');
+}
+
+/* Thread of weight arg - '0', yielding after recording each turn */
+static void weighted(void *arg)
+{
+	size_t i, weight = (char)(size_t)arg - '0';
+
+	uthread_set_weight(weight);
+	uthread_yield(); /* the new weight applies from the next round */
+
+	for (i = 0; i < NR_ROUNDS * weight; i++) {
+		record(arg);
+		uthread_yield();
+	}
+}
+
+/* Run C right away, ahead of the threads created before it */
+static void spawn_abc_yield_to(void *arg)
+{
+	uthread_handle_t c;
+
+	(void)arg;
+
+	uthread_create(record, (void *)'A');
+	uthread_create(record, (void *)'B');
+	uthread_create_handle(record, (void *)'C', &c);
+
+	uthread_yield_to(c);
+	record((void *)'D');
+}
+
+static void spawn_weighted(void *arg)
+{
+	(void)arg;
+
+	uthread_create(weighted, (void *)'1');
+	uthread_create(weighted, (void *)'2');
+	uthread_create(weighted, (void *)'3');
+}
+
+static const char *run_trace(uthread_sched_t policy, uthread_func_t func)
+{
+	trace_len = 0;
+	memset(trace, 0, sizeof(trace));
+	uthread_set_sched(policy);
+	uthread_run(false, func, NULL);
+
+	return trace;
+}
+
+void test_order(void)
+{
+	fprintf(stderr, "*** TEST order ***\n");
+
+	TEST_ASSERT(!strcmp(run_trace(UTHREAD_SCHED_FIFO, spawn_abc), "ABC"));
+	TEST_ASSERT(!strcmp(run_trace(UTHREAD_SCHED_LIFO, spawn_abc), "CBA"));
+	TEST_ASSERT(!strcmp(run_trace(UTHREAD_SCHED_WRR, spawn_abc), "ABC"));
+
+	/* Each round: 1 turn for weight 1, 2 for weight 2, 3 for weight 3 */
+	TEST_ASSERT(!strncmp(run_trace(UTHREAD_SCHED_WRR, spawn_weighted),
+			     "122333122333", 12));
+	/* Round-robin without weights */
+	TEST_ASSERT(!strncmp(run_trace(UTHREAD_SCHED_FIFO, spawn_weighted),
+			     "123123", 6));
+
+	/* The caller goes back to the policy */
+	TEST_ASSERT(!strcmp(run_trace(UTHREAD_SCHED_FIFO, spawn_abc_yield_to),
+			    "CABD"));
+	TEST_ASSERT(!strcmp(run_trace(UTHREAD_SCHED_LIFO, spawn_abc_yield_to),
+			    "CBAD"));
+
+	TEST_ASSERT(uthread_set_sched(UTHREAD_SCHED_RANDOM + 1) == -1);
+	TEST_ASSERT(uthread_set_weight(1) == -1);
+}
+
+/*
+ * Wake-up latency
+ */
+static size_t nr_yielders = NR_YIELDERS;
+static sem_t wakeup;
+static bool done;
+static double posted, total_latency;
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void yielder(void *arg)
+{
+	(void)arg;
+
+	while (!done)
+		uthread_yield();
+}
+
+static void sleeper(void *arg)
+{
+	size_t i;
+
+	(void)arg;
+
+	for (i = 0; i < NR_WAKEUPS; i++) {
+		sem_down(wakeup);
+		total_latency += now() - posted;
+	}
+	done = true;
+}
+
+static void waker(void *arg)
+{
+	size_t i;
+
+	(void)arg;
+
+	for (i = 0; i < NR_WAKEUPS; i++) {
+		posted = now();
+		sem_up(wakeup);
+		uthread_yield();
+	}
+}
+
+static void spawn_latency(void *arg)
+{
+	size_t i;
+
+	(void)arg;
+
+	uthread_create(sleeper, NULL);
+	for (i = 0; i < nr_yielders; i++)
+		uthread_create(yielder, NULL);
+	uthread_create(waker, NULL);
+}
+
+static void bench_latency(void)
+{
+	static const char *names[] = { "fifo", "lifo", "wrr" };
+	uthread_sched_t policy;
+
+	fprintf(stderr, "*** BENCH wake-up latency ***\n");
+
+	for (policy = UTHREAD_SCHED_FIFO; policy <= UTHREAD_SCHED_WRR; policy++) {
+		wakeup = sem_create(0);
+		done = false;
+		total_latency = 0;
+
+		uthread_set_sched(policy);
+		uthread_run(false, spawn_latency, NULL);
+		sem_destroy(wakeup);
+
+		printf("%s: %zu yielding threads, %.1f us wake-up latency\n",
+		       names[policy], nr_yielders,
+		       total_latency / NR_WAKEUPS * 1e6);
+	}
+}
+
+int main(int argc, char **argv)
+{
+	if (argc > 1)
+		nr_yielders = strtoul(argv[1], NULL, 0);
+
+	test_order();
+	bench_latency();
+
+	return 0;
+}
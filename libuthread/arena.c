@@ -0,0 +1,184 @@
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+
+#include "private.h"
+
+/*
+Huge-page arenas
+
+Memory is mapped in 2 MiB-aligned chunks, backed by explicit huge pages when
+the system has some reserved, by transparent huge pages otherwise, and by
+regular pages as a last resort. An arena carves fixed-size slots out of such
+chunks and recycles freed slots through a free list, so that thousands of
+stacks or TCBs fit in a handful of TLB entries.
+*/
+
+#define HUGE_PAGE_SIZE (2 * 1024 * 1024)
+
+struct chunk {
+	struct chunk *next;
+	size_t size;
+};
+
+struct free_slot {
+	struct free_slot *next;
+};
+
+struct arena {
+	size_t slot_size;
+	struct chunk *chunks;		//chunks the slots are carved from
+	char *next_slot;		//next never-used slot of the last chunk
+	char *chunk_end;
+	struct free_slot *free_slots;	//recycled slots
+	size_t pooled;			//bytes of the chunks not handed out
+};
+
+static size_t huge_chunks;
+static size_t hinted_chunks;	//madvise() only asks for transparent huge pages
+static size_t regular_chunks;
+
+static size_t round_huge(size_t size)
+{
+	return (size + HUGE_PAGE_SIZE - 1) & ~(size_t)(HUGE_PAGE_SIZE - 1);
+}
+
+void *huge_alloc(size_t size)
+{
+	char *p, *aligned;
+	size_t reserve;
+
+	size = round_huge(size);
+
+	//explicit huge pages, only there if the administrator reserved some
+	p = mmap(NULL, size, PROT_READ | PROT_WRITE,
+		 MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+	if(p != MAP_FAILED){
+		huge_chunks++;
+		return p;
+	}
+
+	//transparent huge pages need a 2 MiB-aligned range: over-reserve and trim
+	reserve = size + HUGE_PAGE_SIZE;
+	p = mmap(NULL, reserve, PROT_READ | PROT_WRITE,
+		 MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if(p == MAP_FAILED){
+		return NULL;
+	}
+
+	aligned = (char *)round_huge((uintptr_t)p);
+	if(aligned > p){
+		munmap(p, aligned - p);
+	}
+	if(aligned + size < p + reserve){
+		munmap(aligned + size, p + reserve - (aligned + size));
+	}
+
+	if(madvise(aligned, size, MADV_HUGEPAGE) == 0){
+		hinted_chunks++;
+	}
+	else{
+		regular_chunks++; //fall back to regular pages
+	}
+
+	return aligned;
+}
+
+void huge_free(void *p, size_t size)
+{
+	if(p != NULL){
+		munmap(p, round_huge(size));
+	}
+}
+
+struct arena *arena_create(size_t slot_size)
+{
+	struct arena *arena = malloc(sizeof(*arena));
+	if(arena == NULL){
+		return NULL;
+	}
+
+	//keep slots 16-byte aligned, as stacks and contexts require
+	arena->slot_size = (slot_size + 15) & ~(size_t)15;
+	arena->chunks = NULL;
+	arena->next_slot = NULL;
+	arena->chunk_end = NULL;
+	arena->free_slots = NULL;
+	arena->pooled = 0;
+
+	return arena;
+}
+
+void arena_destroy(struct arena *arena)
+{
+	if(arena == NULL){
+		return;
+	}
+
+	while(arena->chunks != NULL){
+		struct chunk *chunk = arena->chunks;
+		arena->chunks = chunk->next;
+		huge_free(chunk, chunk->size);
+	}
+	mem_sub(MEM_POOLED, arena->pooled);
+	free(arena);
+}
+
+void *arena_alloc(struct arena *arena)
+{
+	if(arena->free_slots != NULL){
+		struct free_slot *slot = arena->free_slots;
+		arena->free_slots = slot->next;
+		arena->pooled -= arena->slot_size;
+		mem_sub(MEM_POOLED, arena->slot_size);
+		return slot;
+	}
+
+	if(arena->next_slot == NULL ||
+	   arena->next_slot + arena->slot_size > arena->chunk_end){
+		//the chunk header takes the first slot
+		size_t size = round_huge(2 * arena->slot_size);
+		struct chunk *chunk = huge_alloc(size);
+		if(chunk == NULL){
+			return NULL;
+		}
+
+		chunk->size = size;
+		chunk->next = arena->chunks;
+		arena->chunks = chunk;
+		arena->next_slot = (char *)chunk + arena->slot_size;
+		arena->chunk_end = (char *)chunk + size;
+		arena->pooled += size;
+		mem_add(MEM_POOLED, size);
+	}
+
+	void *slot = arena->next_slot;
+	arena->next_slot += arena->slot_size;
+	arena->pooled -= arena->slot_size;
+	mem_sub(MEM_POOLED, arena->slot_size);
+
+	return slot;
+}
+
+void arena_free(struct arena *arena, void *p)
+{
+	struct free_slot *slot = p;
+
+	if(p == NULL){
+		return;
+	}
+
+	slot->next = arena->free_slots;
+	arena->free_slots = slot;
+	arena->pooled += arena->slot_size;
+	mem_add(MEM_POOLED, arena->slot_size);
+}
+
+void arena_get_stats(struct uthread_stats *stats)
+{
+	stats->arena_huge_chunks = huge_chunks;
+	stats->arena_hinted_chunks = hinted_chunks;
+	stats->arena_regular_chunks = regular_chunks;
+}
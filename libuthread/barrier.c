@@ -0,0 +1,162 @@
+#include <stddef.h>
+#include <stdlib.h>
+
+#include "barrier.h"
+#include "private.h"
+#include "queue.h"
+
+/*
+ * Barriers and latches
+ *
+ * Both keep their blocked threads in a wait list, filled by uthread_park(). A
+ * release hands the whole list to the scheduling policy with
+ * uthread_unpark_all(), which splices it into the ready threads, instead of
+ * waking the threads one by one like N sem_up() calls would.
+ */
+struct uthread_barrier {
+	size_t count;		/* Threads per round */
+	size_t arrived;		/* Threads that reached the current round */
+	queue_t waiters;
+};
+
+struct uthread_latch {
+	size_t count;		/* Count downs left */
+	queue_t waiters;
+};
+
+uthread_barrier_t uthread_barrier_create(size_t count)
+{
+	struct uthread_barrier *barrier;
+
+	if (!count)
+		return NULL;
+
+	preempt_disable(); /* the allocator isn't reentrant */
+	barrier = malloc(sizeof(*barrier));
+	if (!barrier) {
+		preempt_enable();
+		return NULL;
+	}
+
+	barrier->waiters = queue_create();
+	if (!barrier->waiters) {
+		free(barrier);
+		preempt_enable();
+		return NULL;
+	}
+	preempt_enable();
+	barrier->count = count;
+	barrier->arrived = 0;
+
+	return barrier;
+}
+
+int uthread_barrier_destroy(uthread_barrier_t barrier)
+{
+	if (!barrier)
+		return -1;
+
+	preempt_disable(); /* the allocator isn't reentrant */
+	if (queue_destroy(barrier->waiters) < 0) {
+		preempt_enable();
+		return -1;
+	}
+	free(barrier);
+	preempt_enable();
+
+	return 0;
+}
+
+int uthread_barrier_wait(uthread_barrier_t barrier)
+{
+	int ret = 0;
+
+	if (!barrier)
+		return -1;
+
+	preempt_disable();
+	if (++barrier->arrived == barrier->count) {
+		/* The next round starts right away */
+		barrier->arrived = 0;
+		uthread_unpark_all(barrier->waiters);
+		ret = 1;
+	} else if (uthread_park(barrier->waiters) < 0) {
+		preempt_disable(); /* uthread_park() enabled it */
+		barrier->arrived--;
+		ret = -1;
+	}
+	preempt_enable();
+
+	return ret;
+}
+
+uthread_latch_t uthread_latch_create(size_t count)
+{
+	struct uthread_latch *latch;
+
+	preempt_disable(); /* the allocator isn't reentrant */
+	latch = malloc(sizeof(*latch));
+	if (!latch) {
+		preempt_enable();
+		return NULL;
+	}
+
+	latch->waiters = queue_create();
+	if (!latch->waiters) {
+		free(latch);
+		preempt_enable();
+		return NULL;
+	}
+	preempt_enable();
+	latch->count = count;
+
+	return latch;
+}
+
+int uthread_latch_destroy(uthread_latch_t latch)
+{
+	if (!latch)
+		return -1;
+
+	preempt_disable(); /* the allocator isn't reentrant */
+	if (queue_destroy(latch->waiters) < 0) {
+		preempt_enable();
+		return -1;
+	}
+	free(latch);
+	preempt_enable();
+
+	return 0;
+}
+
+int uthread_latch_count_down(uthread_latch_t latch)
+{
+	int ret = 0;
+
+	if (!latch)
+		return -1;
+
+	preempt_disable();
+	if (!latch->count)
+		ret = -1;
+	else if (--latch->count == 0)
+		uthread_unpark_all(latch->waiters);
+	preempt_enable();
+
+	return ret;
+}
+
+int uthread_latch_wait(uthread_latch_t latch)
+{
+	int ret = 0;
+
+	if (!latch)
+		return -1;
+
+	preempt_disable();
+	if (latch->count)
+		ret = uthread_park(latch->waiters);
+	preempt_enable();
+
+	return ret;
+}
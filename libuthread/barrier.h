@@ -0,0 +1,99 @@
+#ifndef _BARRIER_H
+#define _BARRIER_H
+
+#include <stddef.h>
+
+/*
+ * uthread_barrier_t - Barrier type
+ *
+ * A barrier makes a fixed number of threads wait for each other: every thread
+ * reaching the barrier is blocked until the last one reaches it, at which
+ * point all of them are made ready at once. The barrier is then ready for the
+ * next round.
+ */
+typedef struct uthread_barrier *uthread_barrier_t;
+
+/*
+ * uthread_latch_t - Countdown latch type
+ *
+ * A latch blocks the threads waiting on it until its count, decremented by
+ * other threads, reaches zero. All the waiting threads are then made ready at
+ * once, and later waits return right away. Unlike a barrier, a latch is used
+ * only once.
+ */
+typedef struct uthread_latch *uthread_latch_t;
+
+/*
+ * uthread_barrier_create - Create barrier
+ * @count: Number of threads taking part in each round
+ *
+ * Return: Pointer to initialized barrier. NULL if @count is 0, or in case of
+ * failure when allocating the new barrier.
+ */
+uthread_barrier_t uthread_barrier_create(size_t count);
+
+/*
+ * uthread_barrier_destroy - Deallocate a barrier
+ * @barrier: Barrier to deallocate
+ *
+ * Return: -1 if @barrier is NULL or if threads are still waiting on @barrier.
+ * 0 if @barrier was successfully destroyed.
+ */
+int uthread_barrier_destroy(uthread_barrier_t barrier);
+
+/*
+ * uthread_barrier_wait - Wait for the other threads at a barrier
+ * @barrier: Barrier to wait at
+ *
+ * Block the calling thread until @count threads, the caller included, reached
+ * @barrier in the current round. The last thread to reach it doesn't block,
+ * and makes all the others ready in a single operation, whatever their number.
+ *
+ * Return: -1 if @barrier is NULL, or in case of memory allocation error. 1 in
+ * the last thread of the round, 0 in the others.
+ */
+int uthread_barrier_wait(uthread_barrier_t barrier);
+
+/*
+ * uthread_latch_create - Create countdown latch
+ * @count: Number of count downs to wait for
+ *
+ * Return: Pointer to initialized latch. NULL in case of failure when allocating
+ * the new latch.
+ */
+uthread_latch_t uthread_latch_create(size_t count);
+
+/*
+ * uthread_latch_destroy - Deallocate a latch
+ * @latch: Latch to deallocate
+ *
+ * Return: -1 if @latch is NULL or if threads are still waiting on @latch. 0 if
+ * @latch was successfully destroyed.
+ */
+int uthread_latch_destroy(uthread_latch_t latch);
+
+/*
+ * uthread_latch_count_down - Decrement the count of a latch
+ * @latch: Latch to count down
+ *
+ * Decrement the count of @latch without blocking. When the count reaches zero,
+ * all the threads waiting on @latch are made ready in a single operation.
+ *
+ * Return: -1 if @latch is NULL or if its count already reached zero. 0
+ * otherwise.
+ */
+int uthread_latch_count_down(uthread_latch_t latch);
+
+/*
+ * uthread_latch_wait - Wait for a latch to open
+ * @latch: Latch to wait on
+ *
+ * Block the calling thread until the count of @latch reaches zero, or return
+ * right away if it already did.
+ *
+ * Return: -1 if @latch is NULL, or in case of memory allocation error. 0 once
+ * @latch is open.
+ */
+int uthread_latch_wait(uthread_latch_t latch);
+
+#endif /* _BARRIER_H */
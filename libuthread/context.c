@@ -1,5 +1,12 @@
+#define _GNU_SOURCE		/* REG_RSP */
+
+#include <signal.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
 
 #include "private.h"
 #include "uthread.h"
@@ -7,6 +14,28 @@
 /* Size of the stack for a thread (in bytes) */
 #define UTHREAD_STACK_SIZE 32768
 
+/* Size of the stack shared by all threads in shared-stack mode (in bytes) */
+#define UTHREAD_SHARED_STACK_SIZE (8 * 1024 * 1024)
+
+/* Initially committed part of a growable stack (in bytes) */
+#define UTHREAD_GROWABLE_STACK_INITIAL (16 * 1024)
+
+/* Default size reserved for each growable stack, guard page included */
+#define UTHREAD_GROWABLE_STACK_MAX (1024 * 1024)
+
+/* Size of the alternate signal stack used to handle stack faults */
+#define UTHREAD_ALTSTACK_SIZE (64 * 1024)
+
+/*
+ * Bytes below the stack pointer that a function may use without moving it (red
+ * zone of the ABI)
+ */
+#if defined(__x86_64__)
+#define UTHREAD_RED_ZONE 128
+#else
+#define UTHREAD_RED_ZONE 0
+#endif
+
 void uthread_ctx_switch(uthread_ctx_t *prev, uthread_ctx_t *next)
 {
 	/*
@@ -19,14 +48,311 @@ void uthread_ctx_switch(uthread_ctx_t *prev, uthread_ctx_t *next)
 	}
 }
 
+/*
+ * Growable stacks
+ *
+ * Each stack is a reserved, inaccessible range of growable_max bytes. Only the
+ * top UTHREAD_GROWABLE_STACK_INITIAL bytes are made accessible at first, and
+ * the rest is made accessible on demand by the SIGSEGV handler, which runs on
+ * an alternate signal stack. The lowest page is never made accessible and
+ * acts as a guard page. The top of the range holds the stack's metadata.
+ */
+struct growable_meta {
+	char *low;		/* Lowest accessible address */
+} __attribute__((aligned(16)));
+
+static bool growable;
+static size_t growable_max = UTHREAD_GROWABLE_STACK_MAX;
+static size_t page_size;
+static void *altstack;
+static stack_t old_altstack;
+static struct sigaction old_segv;
+
+static size_t grow_events;
+static size_t grow_bytes;
+
+/* Stacks carved out of huge pages, in arena mode */
+static struct arena *stack_arena;
+
+/* Usable size of a stack segment */
+static size_t stack_size(void)
+{
+	if (growable)
+		return growable_max - sizeof(struct growable_meta);
+	return UTHREAD_STACK_SIZE;
+}
+
+/* Distance between two contiguous stack segments */
+static size_t stack_stride(void)
+{
+	return growable ? growable_max : UTHREAD_STACK_SIZE;
+}
+
+static struct growable_meta *growable_meta_of(char *base)
+{
+	return (struct growable_meta *)(base + stack_size());
+}
+
+static int growable_commit(char *base)
+{
+	char *low = base + growable_max - UTHREAD_GROWABLE_STACK_INITIAL;
+
+	if (mprotect(low, UTHREAD_GROWABLE_STACK_INITIAL,
+		     PROT_READ | PROT_WRITE))
+		return -1;
+	growable_meta_of(base)->low = low;
+	mem_add(MEM_STACKS, UTHREAD_GROWABLE_STACK_INITIAL);
+
+	return 0;
+}
+
+static void *growable_reserve(size_t n)
+{
+	void *stacks = mmap(NULL, n * growable_max, PROT_NONE,
+			    MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+	size_t i;
+
+	if (stacks == MAP_FAILED)
+		return NULL;
+
+	for (i = 0; i < n; i++) {
+		if (growable_commit((char *)stacks + i * growable_max)) {
+			mem_sub(MEM_STACKS, i * UTHREAD_GROWABLE_STACK_INITIAL);
+			munmap(stacks, n * growable_max);
+			return NULL;
+		}
+	}
+
+	return stacks;
+}
+
+/* Unmap @n growable stacks, accounting what was made accessible */
+static void growable_release(char *stacks, size_t n)
+{
+	size_t i;
+
+	for (i = 0; i < n; i++) {
+		char *base = stacks + i * growable_max;
+
+		mem_sub(MEM_STACKS, base + growable_max -
+			growable_meta_of(base)->low);
+	}
+	munmap(stacks, n * growable_max);
+}
+
+/*
+ * Try to extend stack @base so that @addr becomes accessible. The accessible
+ * part is at least doubled, to keep the number of faults logarithmic.
+ */
+static bool growable_extend(char *base, char *addr)
+{
+	struct growable_meta *meta;
+	char *want, *low;
+
+	if (!base || addr < base + page_size || addr >= base + growable_max)
+		return false;
+
+	meta = growable_meta_of(base);
+	if (addr >= meta->low)
+		return false;
+
+	want = (char *)((uintptr_t)addr & ~(uintptr_t)(page_size - 1));
+	low = meta->low - (base + growable_max - meta->low);
+	if (low > want)
+		low = want;
+	if (low < base + page_size)
+		low = base + page_size;
+
+	if (mprotect(low, meta->low - low, PROT_READ | PROT_WRITE))
+		return false;
+
+	grow_events++;
+	grow_bytes += meta->low - low;
+	mem_add(MEM_STACKS, meta->low - low);
+	meta->low = low;
+
+	return true;
+}
+
+static void growable_fault(int signum, siginfo_t *info, void *ucontext)
+{
+	void *stacks[2];
+	int i, n;
+
+	(void)signum;
+	(void)ucontext;
+
+	n = uthread_active_stacks(stacks);
+	for (i = 0; i < n; i++)
+		if (growable_extend(stacks[i], info->si_addr))
+			return;
+
+	/*
+	 * Genuine fault, or stack overflowing its cap: restore the default
+	 * action so that the faulting access kills the process when retried
+	 */
+	signal(SIGSEGV, SIG_DFL);
+}
+
+int uthread_ctx_growable_start(size_t max)
+{
+	struct sigaction sa;
+	stack_t ss;
+
+	page_size = sysconf(_SC_PAGESIZE);
+	if (max) {
+		max = (max + page_size - 1) & ~(page_size - 1);
+		if (max < UTHREAD_GROWABLE_STACK_INITIAL + page_size)
+			return -1;
+		growable_max = max;
+	}
+
+	altstack = malloc(UTHREAD_ALTSTACK_SIZE);
+	if (!altstack)
+		return -1;
+	mem_add(MEM_STACKS, UTHREAD_ALTSTACK_SIZE);
+
+	ss.ss_sp = altstack;
+	ss.ss_size = UTHREAD_ALTSTACK_SIZE;
+	ss.ss_flags = 0;
+	if (sigaltstack(&ss, &old_altstack)) {
+		mem_sub(MEM_STACKS, UTHREAD_ALTSTACK_SIZE);
+		free(altstack);
+		return -1;
+	}
+
+	sa.sa_sigaction = growable_fault;
+	sigemptyset(&sa.sa_mask);
+	sigaddset(&sa.sa_mask, SIGVTALRM); // no preemption on the alternate stack
+	sa.sa_flags = SA_SIGINFO | SA_ONSTACK;
+	if (sigaction(SIGSEGV, &sa, &old_segv)) {
+		sigaltstack(&old_altstack, NULL);
+		mem_sub(MEM_STACKS, UTHREAD_ALTSTACK_SIZE);
+		free(altstack);
+		return -1;
+	}
+
+	growable = true;
+
+	return 0;
+}
+
+void uthread_ctx_growable_stop(void)
+{
+	sigaction(SIGSEGV, &old_segv, NULL);
+	sigaltstack(&old_altstack, NULL);
+	mem_sub(MEM_STACKS, UTHREAD_ALTSTACK_SIZE);
+	free(altstack);
+	altstack = NULL;
+	growable = false;
+}
+
+void uthread_ctx_get_stats(struct uthread_stats *stats)
+{
+	stats->stack_grow_events = grow_events;
+	stats->stack_grow_bytes = grow_bytes;
+}
+
+int uthread_ctx_arena_start(void)
+{
+	stack_arena = arena_create(UTHREAD_STACK_SIZE);
+
+	return stack_arena ? 0 : -1;
+}
+
+void uthread_ctx_arena_stop(void)
+{
+	arena_destroy(stack_arena);
+	stack_arena = NULL;
+}
+
 void *uthread_ctx_alloc_stack(void)
 {
-	return malloc(UTHREAD_STACK_SIZE);
+	void *stack;
+
+	if (growable)
+		return growable_reserve(1);
+
+	if (stack_arena)
+		stack = arena_alloc(stack_arena);
+	else
+		stack = malloc(UTHREAD_STACK_SIZE);
+	if (stack)
+		mem_add(MEM_STACKS, UTHREAD_STACK_SIZE);
+
+	return stack;
+}
+
+void *uthread_ctx_alloc_stack_size(size_t size)
+{
+	void *stack = malloc(size);
+
+	if (stack)
+		mem_add(MEM_STACKS, size);
+
+	return stack;
 }
 
-void uthread_ctx_destroy_stack(void *top_of_stack)
+void uthread_ctx_destroy_stack(void *top_of_stack, size_t size)
 {
-	free(top_of_stack);
+	if (!top_of_stack)
+		return;
+
+	if (growable) {
+		growable_release(top_of_stack, 1);
+		return;
+	}
+
+	mem_sub(MEM_STACKS, size ? size : UTHREAD_STACK_SIZE);
+	if (stack_arena)
+		arena_free(stack_arena, top_of_stack);
+	else
+		free(top_of_stack);
+}
+
+void *uthread_ctx_alloc_stacks(size_t n)
+{
+	void *stacks;
+
+	if (n == 0 || n > SIZE_MAX / stack_stride())
+		return NULL;
+
+	if (growable)
+		return growable_reserve(n);
+
+	/*
+	 * Page-align the block so that the top of each stack, which is touched
+	 * by makecontext(), doesn't straddle two pages
+	 */
+	if (stack_arena)
+		stacks = huge_alloc(n * UTHREAD_STACK_SIZE);
+	else if (posix_memalign(&stacks, sysconf(_SC_PAGESIZE),
+				n * UTHREAD_STACK_SIZE))
+		stacks = NULL;
+	if (!stacks)
+		return NULL;
+	mem_add(MEM_STACKS, n * UTHREAD_STACK_SIZE);
+
+	return stacks;
+}
+
+void *uthread_ctx_stack_at(void *stacks, size_t i)
+{
+	return (char *)stacks + i * stack_stride();
+}
+
+void uthread_ctx_destroy_stacks(void *stacks, size_t n)
+{
+	if (growable) {
+		growable_release(stacks, n);
+		return;
+	}
+
+	mem_sub(MEM_STACKS, n * UTHREAD_STACK_SIZE);
+	if (stack_arena)
+		huge_free(stacks, n * UTHREAD_STACK_SIZE);
+	else
+		free(stacks);
 }
 
 /*
@@ -46,8 +372,18 @@ static void uthread_ctx_bootstrap(uthread_func_t func, void *arg)
 	uthread_exit();
 }
 
-int uthread_ctx_init(uthread_ctx_t *uctx, void *top_of_stack,
-		     uthread_func_t func, void *arg)
+size_t uthread_ctx_stack_size(void)
+{
+	return stack_size();
+}
+
+size_t uthread_ctx_stack_charge(void)
+{
+	return growable ? UTHREAD_GROWABLE_STACK_INITIAL : UTHREAD_STACK_SIZE;
+}
+
+int uthread_ctx_init_size(uthread_ctx_t *uctx, void *top_of_stack,
+			  size_t size, uthread_func_t func, void *arg)
 {
 	/*
 	 * Initialize the passed context @uctx to the currently active context
@@ -59,7 +395,7 @@ int uthread_ctx_init(uthread_ctx_t *uctx, void *top_of_stack,
 	 * Change context @uctx's stack to the specified stack
 	 */
 	uctx->uc_stack.ss_sp = top_of_stack;
-	uctx->uc_stack.ss_size = UTHREAD_STACK_SIZE;
+	uctx->uc_stack.ss_size = size;
 
 	/*
 	 * Finish setting up context @uctx:
@@ -74,3 +410,240 @@ int uthread_ctx_init(uthread_ctx_t *uctx, void *top_of_stack,
 	return 0;
 }
 
+int uthread_ctx_init(uthread_ctx_t *uctx, void *top_of_stack,
+		     uthread_func_t func, void *arg)
+{
+	return uthread_ctx_init_size(uctx, top_of_stack, stack_size(),
+				     func, arg);
+}
+
+void *uthread_ctx_sp(const uthread_ctx_t *uctx)
+{
+#if defined(__x86_64__) && defined(__GLIBC__)
+	return (void *)uctx->uc_mcontext.gregs[REG_RSP];
+#elif defined(__aarch64__) && defined(__GLIBC__)
+	return (void *)uctx->uc_mcontext.sp;
+#else
+	(void)uctx;
+	return NULL;
+#endif
+}
+
+/*
+ * uthread_ctx_copy - Copy a saved context
+ * @dst: Context to initialize
+ * @src: Context to copy from
+ *
+ * On x86-64 glibc, a context holds a pointer to its own floating point save
+ * area, so a plain copy would keep pointing into @src.
+ */
+static void uthread_ctx_copy(uthread_ctx_t *dst, const uthread_ctx_t *src)
+{
+	memcpy(dst, src, sizeof(*dst));
+#if defined(__x86_64__) && defined(__GLIBC__)
+	dst->uc_mcontext.fpregs = &dst->__fpregs_mem;
+#endif
+}
+
+int uthread_ctx_init_batch(uthread_ctx_t *const *uctxs, void *stacks,
+			   size_t size, uthread_func_t *funcs, void **args,
+			   size_t n)
+{
+	size_t i;
+
+	if (n == 0)
+		return 0;
+
+	/*
+	 * Only capture the active context once, every other context is a copy
+	 * of it with its own stack
+	 */
+	if (getcontext(uctxs[0]))
+		return -1;
+
+	for (i = 0; i < n; i++) {
+		if (i > 0)
+			uthread_ctx_copy(uctxs[i], uctxs[0]);
+
+		uctxs[i]->uc_stack.ss_sp = uthread_ctx_stack_at(stacks, i);
+		uctxs[i]->uc_stack.ss_size = size;
+		uctxs[i]->uc_link = NULL;
+
+		makecontext(uctxs[i], (void (*)(void)) uthread_ctx_bootstrap,
+			    2, funcs[i], args ? args[i] : NULL);
+	}
+
+	return 0;
+}
+
+
+/*
+ * Shared-stack mode
+ *
+ * All the threads run on the same stack. The thread currently occupying the
+ * shared stack keeps its frames there; they are only copied out to its save
+ * buffer when another thread needs the stack, and copied back in before it
+ * resumes. The copies are performed by a switcher context running on its own
+ * private stack, since a thread cannot overwrite the stack it runs on.
+ */
+static char *shared_stack;
+static uthread_ctx_t switcher_uctx;
+static void *switcher_stack;
+
+/* Thread whose frames are currently on the shared stack */
+static struct uthread_ctx_save *occupant;
+
+/* Context and save area the switcher must resume */
+static uthread_ctx_t *pending_uctx;
+static struct uthread_ctx_save *pending_save;
+
+static char *shared_stack_top(void)
+{
+	return shared_stack + UTHREAD_SHARED_STACK_SIZE;
+}
+
+/*
+ * Lowest address in use by a switched-out thread: the stack pointer saved in
+ * its context, less the red zone. The whole stack when it can't be told.
+ */
+static char *shared_stack_low(const struct uthread_ctx_save *save)
+{
+	char *sp = uthread_ctx_sp(save->uctx);
+
+	if (!sp || sp > shared_stack_top() ||
+	    sp < shared_stack + UTHREAD_RED_ZONE)
+		return shared_stack;
+
+	return sp - UTHREAD_RED_ZONE;
+}
+
+static void shared_stack_save(struct uthread_ctx_save *save)
+{
+	size_t size;
+
+	save->sp = shared_stack_low(save);
+	size = shared_stack_top() - save->sp;
+
+	/* Keep the buffer right-sized, shrinking it when it is mostly unused */
+	if (save->cap < size || save->cap / 2 > size) {
+		void *buf = realloc(save->buf, size);
+		if (!buf) {
+			perror("realloc");
+			exit(1);
+		}
+		mem_sub(MEM_STACKS, save->cap);
+		mem_add(MEM_STACKS, size);
+		save->buf = buf;
+		save->cap = size;
+	}
+
+	memcpy(save->buf, save->sp, size);
+	save->size = size;
+}
+
+static void shared_stack_switcher(void)
+{
+	while (1) {
+		struct uthread_ctx_save *save = pending_save;
+
+		/* Evict the previous occupant, which is not running anymore */
+		if (occupant)
+			shared_stack_save(occupant);
+		occupant = save;
+
+		if (!save->bound) {
+			/* First run: bind the thread to the shared stack */
+			if (uthread_ctx_init_size(pending_uctx, shared_stack,
+						  UTHREAD_SHARED_STACK_SIZE,
+						  save->func, save->arg)) {
+				perror("getcontext");
+				exit(1);
+			}
+			save->bound = true;
+		} else {
+			memcpy(save->sp, save->buf, save->size);
+		}
+
+		uthread_ctx_switch(&switcher_uctx, pending_uctx);
+	}
+}
+
+int uthread_ctx_shared_start(void)
+{
+	shared_stack = mmap(NULL, UTHREAD_SHARED_STACK_SIZE,
+			    PROT_READ | PROT_WRITE,
+			    MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+	if (shared_stack == MAP_FAILED) {
+		shared_stack = NULL;
+		return -1;
+	}
+	mem_add(MEM_STACKS, UTHREAD_SHARED_STACK_SIZE);
+
+	switcher_stack = uthread_ctx_alloc_stack();
+	if (!switcher_stack ||
+	    getcontext(&switcher_uctx)) {
+		uthread_ctx_shared_stop();
+		return -1;
+	}
+
+	/* The switcher must never be preempted while moving stacks around */
+	sigaddset(&switcher_uctx.uc_sigmask, SIGVTALRM);
+	switcher_uctx.uc_stack.ss_sp = switcher_stack;
+	switcher_uctx.uc_stack.ss_size = UTHREAD_STACK_SIZE;
+	switcher_uctx.uc_link = NULL;
+	makecontext(&switcher_uctx, shared_stack_switcher, 0);
+
+	occupant = NULL;
+
+	return 0;
+}
+
+void uthread_ctx_shared_stop(void)
+{
+	if (shared_stack) {
+		mem_sub(MEM_STACKS, UTHREAD_SHARED_STACK_SIZE);
+		munmap(shared_stack, UTHREAD_SHARED_STACK_SIZE);
+	}
+	uthread_ctx_destroy_stack(switcher_stack, 0);
+	shared_stack = NULL;
+	switcher_stack = NULL;
+	occupant = NULL;
+}
+
+void uthread_ctx_shared_init(struct uthread_ctx_save *save,
+			     uthread_func_t func, void *arg)
+{
+	memset(save, 0, sizeof(*save));
+	save->func = func;
+	save->arg = arg;
+}
+
+void uthread_ctx_shared_switch(uthread_ctx_t *prev,
+			       struct uthread_ctx_save *prev_save,
+			       uthread_ctx_t *next,
+			       struct uthread_ctx_save *next_save)
+{
+	/* Where to find the stack pointer of @prev once it is evicted */
+	if (prev_save)
+		prev_save->uctx = prev;
+
+	/* Private stack, or frames already in place: plain switch */
+	if (!next_save || next_save == occupant) {
+		uthread_ctx_switch(prev, next);
+		return;
+	}
+
+	pending_uctx = next;
+	pending_save = next_save;
+	uthread_ctx_switch(prev, &switcher_uctx);
+}
+
+void uthread_ctx_shared_release(struct uthread_ctx_save *save)
+{
+	if (occupant == save)
+		occupant = NULL;
+	mem_sub(MEM_STACKS, save->cap);
+	free(save->buf);
+	save->buf = NULL;
+	save->size = save->cap = 0;
+}
@@ -0,0 +1,300 @@
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+
+#include "future.h"
+#include "private.h"
+#include "uthread.h"
+
+/*
+ * Futures
+ *
+ * A future is a record of its own rather than part of the thread computing it,
+ * so that the thread's stack is reclaimed as soon as the thread exits. The
+ * record goes away with the last of future_destroy() and the thread setting
+ * it. Threads waiting for futures register a waiter, on their own
+ * stack, in the list of each future they wait for. The first future set wakes
+ * the thread up and unlinks its other waiters, so that a waiter never outlives
+ * the wait it belongs to. Threads on the shared stack, whose frames are copied
+ * away while they are blocked, keep their waiters on the heap instead.
+ */
+enum {
+	FUTURE_ASYNC,		/* @func(@arg) */
+	FUTURE_THEN,		/* @func(result of future @arg) */
+	FUTURE_ALL,		/* NULL once all @sources are set */
+	FUTURE_ANY,		/* Index of the first of @sources set */
+};
+
+struct uthread_future {
+	bool done;		/* @result is set */
+	bool released;		/* Nobody will read @result anymore */
+	int kind;		/* What the thread computes */
+	void *result;
+	struct future_waiter *waiters;	/* Threads waiting for @result */
+
+	future_func_t func;
+	void *arg;
+	struct uthread_future **sources;	/* Futures combined by the thread */
+	size_t nr_sources;
+};
+
+/* Waiters of a future_wait_any() call that live on the stack */
+#define FUTURE_WAITERS	8
+
+/* A blocked future_wait_any() call */
+struct future_wait {
+	struct uthread_tcb *tcb;
+	struct future_waiter *waiters;	/* One per future waited for */
+	size_t n;
+	size_t woken;			/* Index of the future set first */
+	void *result;			/* Its result */
+	struct future_wait *next;	/* In the list of waits to wake up */
+};
+
+struct future_waiter {
+	struct future_waiter *prev, *next;
+	struct uthread_future *future;
+	struct future_wait *wait;
+};
+
+static void waiter_unlink(struct future_waiter *w)
+{
+	if (w->prev)
+		w->prev->next = w->next;
+	else
+		w->future->waiters = w->next;
+	if (w->next)
+		w->next->prev = w->prev;
+}
+
+/* Set @future to @result and wake up its waiters */
+static void future_set(struct uthread_future *future, void *result)
+{
+	struct future_wait *woken = NULL;
+	size_t i;
+
+	preempt_disable();
+	if (future->released) {
+		/* Destroyed while computed, the result is dropped */
+		free(future);
+		preempt_enable();
+		return;
+	}
+	future->result = result;
+	future->done = true;
+
+	while (future->waiters) {
+		struct future_waiter *w = future->waiters;
+		struct future_wait *wait = w->wait;
+
+		wait->woken = w - wait->waiters;
+		wait->result = result;
+		for (i = 0; i < wait->n; i++)
+			waiter_unlink(&wait->waiters[i]);
+
+		wait->next = woken;
+		woken = wait;
+	}
+	preempt_enable();
+
+	/* The waits stay valid until their threads run again */
+	while (woken) {
+		struct future_wait *wait = woken;
+
+		woken = wait->next;
+		uthread_unblock(wait->tcb);
+	}
+}
+
+/* Wait for the first of @futures to be set, and return its index */
+static ssize_t future_wait_any(struct uthread_future **futures, size_t n,
+			       void **result)
+{
+	struct future_waiter stack_waiters[FUTURE_WAITERS];
+	struct future_wait on_stack = { .waiters = stack_waiters, .n = n };
+	struct future_wait *wait = &on_stack;
+	size_t i, woken;
+
+	preempt_disable();
+	for (i = 0; i < n; i++) {
+		if (futures[i]->done) {
+			preempt_enable();
+			*result = futures[i]->result;
+			return i;
+		}
+	}
+
+	if (uthread_tcb_shared(uthread_current())) {
+		/* Frames on the shared stack are copied away while blocked */
+		wait = malloc(sizeof(*wait) + n * sizeof(*wait->waiters));
+		if (!wait) {
+			preempt_enable();
+			return -1;
+		}
+		wait->waiters = (struct future_waiter *)(wait + 1);
+		wait->n = n;
+	} else if (n > FUTURE_WAITERS) {
+		wait->waiters = malloc(n * sizeof(*wait->waiters));
+		if (!wait->waiters) {
+			preempt_enable();
+			return -1;
+		}
+	}
+
+	wait->tcb = uthread_current();
+	for (i = 0; i < n; i++) {
+		struct future_waiter *w = &wait->waiters[i];
+
+		w->future = futures[i];
+		w->wait = wait;
+		w->prev = NULL;
+		w->next = futures[i]->waiters;
+		if (w->next)
+			w->next->prev = w;
+		futures[i]->waiters = w;
+	}
+
+	uthread_block(); /* until future_set() */
+	preempt_disable(); /* uthread_block() enabled it */
+
+	*result = wait->result;
+	woken = wait->woken;
+	if (wait != &on_stack)
+		free(wait);
+	else if (wait->waiters != stack_waiters)
+		free(wait->waiters);
+	preempt_enable();
+
+	return woken;
+}
+
+static void future_run(void *arg)
+{
+	struct uthread_future *future = arg;
+	void *result = NULL;
+	size_t i;
+
+	switch (future->kind) {
+	case FUTURE_ASYNC:
+		result = future->func(future->arg);
+		break;
+	case FUTURE_THEN:
+		future_await(future->arg, &result);
+		result = future->func(result);
+		break;
+	case FUTURE_ALL:
+		for (i = 0; i < future->nr_sources; i++)
+			future_await(future->sources[i], NULL);
+		break;
+	case FUTURE_ANY:
+		i = future_wait_any(future->sources, future->nr_sources,
+				    &result);
+		result = (void *)(uintptr_t)i;
+		break;
+	}
+
+	future_set(future, result);
+}
+
+static future_t future_create(int kind, future_func_t func, void *arg,
+			      future_t *sources, size_t nr_sources)
+{
+	struct uthread_future *future;
+
+	preempt_disable(); /* the allocator isn't reentrant */
+	future = malloc(sizeof(*future) + nr_sources * sizeof(*sources));
+	preempt_enable();
+	if (!future)
+		return NULL;
+
+	*future = (struct uthread_future) {
+		.kind = kind,
+		.func = func,
+		.arg = arg,
+		.sources = (future_t *)(future + 1),
+		.nr_sources = nr_sources,
+	};
+	/* The caller's array may be gone by the time the thread runs */
+	if (nr_sources)
+		memcpy(future->sources, sources, nr_sources * sizeof(*sources));
+
+	if (uthread_create(future_run, future) < 0) {
+		preempt_disable();
+		free(future);
+		preempt_enable();
+		return NULL;
+	}
+
+	return future;
+}
+
+future_t uthread_async(future_func_t func, void *arg)
+{
+	if (!func)
+		return NULL;
+
+	return future_create(FUTURE_ASYNC, func, arg, NULL, 0);
+}
+
+int future_await(future_t future, void **result)
+{
+	void *value;
+
+	if (!future)
+		return -1;
+
+	/* Set futures don't change anymore */
+	if (future->done) {
+		value = future->result;
+	} else if (future_wait_any(&future, 1, &value) < 0) {
+		return -1;
+	}
+
+	if (result)
+		*result = value;
+
+	return 0;
+}
+
+future_t future_then(future_t future, future_func_t func)
+{
+	if (!future || !func)
+		return NULL;
+
+	return future_create(FUTURE_THEN, func, future, NULL, 0);
+}
+
+future_t future_when_all(future_t *futures, size_t n)
+{
+	if (!futures || !n)
+		return NULL;
+
+	return future_create(FUTURE_ALL, NULL, NULL, futures, n);
+}
+
+future_t future_when_any(future_t *futures, size_t n)
+{
+	if (!futures || !n)
+		return NULL;
+
+	return future_create(FUTURE_ANY, NULL, NULL, futures, n);
+}
+
+int future_destroy(future_t future)
+{
+	if (!future)
+		return -1;
+
+	preempt_disable(); /* the allocator isn't reentrant */
+	/* A thread still computing the future frees it once done */
+	if (future->done)
+		free(future);
+	else
+		future->released = true;
+	preempt_enable();
+
+	return 0;
+}
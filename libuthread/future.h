@@ -0,0 +1,99 @@
+#ifndef _FUTURE_H
+#define _FUTURE_H
+
+#include <stddef.h>
+
+/*
+ * future_t - Future type
+ *
+ * A future is the result of a function run by a thread of its own, which
+ * other threads can wait for. The thread goes away, stack included, as soon as
+ * it exits, while its result is kept until the future is destroyed.
+ */
+typedef struct uthread_future *future_t;
+
+/*
+ * future_func_t - Function computing a future
+ * @arg: Argument passed to the function
+ *
+ * Return: Result of the future
+ */
+typedef void *(*future_func_t)(void *arg);
+
+/*
+ * uthread_async - Compute a future in a new thread
+ * @func: Function to be executed by the thread
+ * @arg: Argument to be passed to @func
+ *
+ * Create a thread that runs @func and sets the future to its return value.
+ * Like uthread_create(), this function is to be called from a running thread.
+ *
+ * Return: Future, or NULL if @func is NULL or in case of failure when creating
+ * the thread.
+ */
+future_t uthread_async(future_func_t func, void *arg);
+
+/*
+ * future_await - Wait for the result of a future
+ * @future: Future to wait for
+ * @result: Address receiving the result, or NULL
+ *
+ * Block the calling thread until @future is set, and get its result. Awaiting a
+ * future that is already set returns right away, without switching threads.
+ *
+ * Return: -1 if @future is NULL, or in case of memory allocation error. 0 if
+ * @result was set.
+ */
+int future_await(future_t future, void **result);
+
+/*
+ * future_then - Chain a continuation to a future
+ * @future: Future whose result is needed
+ * @func: Continuation, receiving the result of @future as argument
+ *
+ * Return: Future set to the return value of @func, which runs once @future is
+ * set. NULL if @future or @func are NULL, or in case of failure when creating
+ * the thread running @func.
+ */
+future_t future_then(future_t future, future_func_t func);
+
+/*
+ * future_when_all - Combine futures into one set once they are all set
+ * @futures: Array of @n futures
+ * @n: Number of futures
+ *
+ * The result of the returned future is NULL; the results of @futures can then
+ * be awaited without blocking.
+ *
+ * Return: Future, or NULL if @futures is NULL, @n is 0, or in case of failure
+ * when allocating the future.
+ */
+future_t future_when_all(future_t *futures, size_t n);
+
+/*
+ * future_when_any - Combine futures into one set once any of them is set
+ * @futures: Array of @n futures
+ * @n: Number of futures
+ *
+ * The result of the returned future is the index in @futures of the first
+ * future that was set, cast to a pointer.
+ *
+ * Return: Future, or NULL if @futures is NULL, @n is 0, or in case of failure
+ * when allocating the future.
+ */
+future_t future_when_any(future_t *futures, size_t n);
+
+/*
+ * future_destroy - Deallocate a future
+ * @future: Future to deallocate
+ *
+ * Release @future, which must not be in use by future_then(), future_when_all()
+ * or future_when_any() anymore. If its thread is still running, it is left to
+ * finish and its result is dropped. Futures may also be destroyed after
+ * uthread_run() returned.
+ *
+ * Return: -1 if @future is NULL. 0 if @future was successfully released.
+ */
+int future_destroy(future_t future);
+
+#endif /* _FUTURE_H */
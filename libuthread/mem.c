@@ -0,0 +1,86 @@
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "private.h"
+#include "uthread.h"
+
+/*
+ * Memory accounting
+ *
+ * Every allocation the library makes for stacks, TCBs, queue nodes and
+ * semaphores, and the memory it keeps around for reuse, is counted here by
+ * kind. Counts are updated with relaxed atomic operations, since queues may be
+ * used from outside of critical sections and from the preemption handler. Peaks
+ * are updated without, and may miss an update racing with a signal.
+ */
+struct mem_count {
+	size_t live;
+	size_t peak;
+};
+
+static struct mem_count counts[MEM_KINDS];
+static struct mem_count total;
+static size_t budget;
+
+static void count_add(struct mem_count *count, size_t bytes)
+{
+	size_t live = __atomic_add_fetch(&count->live, bytes, __ATOMIC_RELAXED);
+
+	if (live > count->peak)
+		count->peak = live;
+}
+
+void mem_add(enum mem_kind kind, size_t bytes)
+{
+	count_add(&counts[kind], bytes);
+	count_add(&total, bytes);
+}
+
+void mem_sub(enum mem_kind kind, size_t bytes)
+{
+	__atomic_sub_fetch(&counts[kind].live, bytes, __ATOMIC_RELAXED);
+	__atomic_sub_fetch(&total.live, bytes, __ATOMIC_RELAXED);
+}
+
+void mem_move(enum mem_kind from, enum mem_kind to, size_t bytes)
+{
+	__atomic_sub_fetch(&counts[from].live, bytes, __ATOMIC_RELAXED);
+	count_add(&counts[to], bytes);
+}
+
+bool mem_fits(size_t bytes)
+{
+	size_t live = __atomic_load_n(&total.live, __ATOMIC_RELAXED);
+
+	return !budget || (bytes <= budget && live <= budget - bytes);
+}
+
+int uthread_set_mem_budget(size_t bytes)
+{
+	budget = bytes;
+
+	return 0;
+}
+
+static void usage_of(struct uthread_mem_usage *usage,
+		     const struct mem_count *count)
+{
+	usage->live = __atomic_load_n(&count->live, __ATOMIC_RELAXED);
+	usage->peak = count->peak;
+}
+
+int uthread_mem_stats(struct uthread_mem_stats *stats)
+{
+	if (!stats)
+		return -1;
+
+	usage_of(&stats->stacks, &counts[MEM_STACKS]);
+	usage_of(&stats->tcbs, &counts[MEM_TCBS]);
+	usage_of(&stats->queue_nodes, &counts[MEM_QUEUE_NODES]);
+	usage_of(&stats->semaphores, &counts[MEM_SEMAPHORES]);
+	usage_of(&stats->pooled, &counts[MEM_POOLED]);
+	usage_of(&stats->total, &total);
+	stats->budget = budget;
+
+	return 0;
+}
@@ -0,0 +1,163 @@
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "mpmc_queue.h"
+
+/*
+Bounded MPMC queue from Dmitry Vyukov.
+
+Each cell of the ring holds a sequence number telling whose turn it is:
+- seq == pos: the cell is free for the producer claiming position pos
+- seq == pos + 1: the cell holds the item for the consumer claiming position pos
+After consuming, the cell is handed to the producer of the next lap
+(seq = pos + capacity). Producers and consumers only contend on their own
+position counter, with a single compare-and-swap per operation.
+*/
+
+#define CACHE_LINE 64
+
+struct cell {
+	atomic_size_t seq;
+	void *data;
+};
+
+struct mpmc_queue {
+	struct cell *cells;
+	size_t mask;	//capacity - 1, capacity being a power of two
+
+	//each position counter on its own cache line, to avoid false sharing
+	_Alignas(CACHE_LINE) atomic_size_t enqueue_pos;
+	_Alignas(CACHE_LINE) atomic_size_t dequeue_pos;
+};
+
+mpmc_queue_t mpmc_queue_create(size_t capacity)
+{
+	size_t size = 1, i;
+
+	if(capacity == 0 || capacity > SIZE_MAX / 2 / sizeof(struct cell)){
+		return NULL;
+	}
+	while(size < capacity){
+		size <<= 1;
+	}
+
+	mpmc_queue_t queue = aligned_alloc(CACHE_LINE, sizeof(struct mpmc_queue));
+	if(queue == NULL){
+		return NULL;
+	}
+
+	queue->cells = malloc(size * sizeof(struct cell));
+	if(queue->cells == NULL){
+		free(queue);
+		return NULL;
+	}
+
+	for(i = 0; i < size; i++){
+		atomic_init(&queue->cells[i].seq, i);
+	}
+	queue->mask = size - 1;
+	atomic_init(&queue->enqueue_pos, 0);
+	atomic_init(&queue->dequeue_pos, 0);
+
+	return queue;
+}
+
+int mpmc_queue_destroy(mpmc_queue_t queue)
+{
+	if(queue == NULL || mpmc_queue_length(queue) != 0){
+		return -1;
+	}
+
+	free(queue->cells);
+	free(queue);
+	return 0;
+}
+
+int mpmc_queue_enqueue(mpmc_queue_t queue, void *data)
+{
+	if(queue == NULL || data == NULL){
+		return -1;
+	}
+
+	size_t pos = atomic_load_explicit(&queue->enqueue_pos, memory_order_relaxed);
+	struct cell *cell;
+
+	while(1){
+		cell = &queue->cells[pos & queue->mask];
+		size_t seq = atomic_load_explicit(&cell->seq, memory_order_acquire);
+		intptr_t diff = (intptr_t)seq - (intptr_t)pos;
+
+		if(diff == 0){ //cell is free, try to claim position pos
+			if(atomic_compare_exchange_weak_explicit(&queue->enqueue_pos, &pos, pos + 1,
+					memory_order_relaxed, memory_order_relaxed)){
+				break;
+			}
+			//pos was reloaded by the failed CAS
+		}
+		else if(diff < 0){ //cell still holds an item from the previous lap
+			return -1; //full
+		}
+		else{ //another producer got ahead
+			pos = atomic_load_explicit(&queue->enqueue_pos, memory_order_relaxed);
+		}
+	}
+
+	cell->data = data;
+	atomic_store_explicit(&cell->seq, pos + 1, memory_order_release); //publish the item
+
+	return 0;
+}
+
+int mpmc_queue_dequeue(mpmc_queue_t queue, void **data)
+{
+	if(queue == NULL || data == NULL){
+		return -1;
+	}
+
+	size_t pos = atomic_load_explicit(&queue->dequeue_pos, memory_order_relaxed);
+	struct cell *cell;
+
+	while(1){
+		cell = &queue->cells[pos & queue->mask];
+		size_t seq = atomic_load_explicit(&cell->seq, memory_order_acquire);
+		intptr_t diff = (intptr_t)seq - (intptr_t)(pos + 1);
+
+		if(diff == 0){ //cell holds an item, try to claim position pos
+			if(atomic_compare_exchange_weak_explicit(&queue->dequeue_pos, &pos, pos + 1,
+					memory_order_relaxed, memory_order_relaxed)){
+				break;
+			}
+		}
+		else if(diff < 0){ //item not published yet
+			return -1; //empty
+		}
+		else{ //another consumer got ahead
+			pos = atomic_load_explicit(&queue->dequeue_pos, memory_order_relaxed);
+		}
+	}
+
+	*data = cell->data;
+	//hand the cell over to the producer of the next lap
+	atomic_store_explicit(&cell->seq, pos + queue->mask + 1, memory_order_release);
+
+	return 0;
+}
+
+int mpmc_queue_length(mpmc_queue_t queue)
+{
+	if(queue == NULL){
+		return -1;
+	}
+
+	size_t head = atomic_load_explicit(&queue->dequeue_pos, memory_order_relaxed);
+	size_t tail = atomic_load_explicit(&queue->enqueue_pos, memory_order_relaxed);
+
+	return tail > head ? (int)(tail - head) : 0;
+}
+
+/*Sources:
+https://www.1024cores.net/home/lock-free-algorithms/queues/bounded-mpmc-queue
+https://en.cppreference.com/w/c/atomic
+*/
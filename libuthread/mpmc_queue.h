@@ -0,0 +1,77 @@
+#ifndef _MPMC_QUEUE_H
+#define _MPMC_QUEUE_H
+
+#include <stddef.h>
+
+/*
+ * mpmc_queue_t - Bounded multi-producer/multi-consumer queue type
+ *
+ * An MPMC queue is a FIFO data structure of fixed capacity which, unlike
+ * queue_t, can be used concurrently by any number of kernel threads (e.g.,
+ * pthreads) without external locking. It is lock-free: enqueue and dequeue
+ * operations never block, and fail instead when the queue is respectively full
+ * or empty.
+ *
+ * All operations are O(1).
+ */
+typedef struct mpmc_queue* mpmc_queue_t;
+
+/*
+ * mpmc_queue_create - Allocate an empty MPMC queue
+ * @capacity: Maximum number of items in the queue, rounded up to the next
+ *	power of two
+ *
+ * Return: Pointer to new empty queue. NULL in case of failure when allocating
+ * the new queue, or if @capacity is 0.
+ */
+mpmc_queue_t mpmc_queue_create(size_t capacity);
+
+/*
+ * mpmc_queue_destroy - Deallocate an MPMC queue
+ * @queue: Queue to deallocate
+ *
+ * No other thread may be using @queue anymore.
+ *
+ * Return: -1 if @queue is NULL or if @queue is not empty. 0 if @queue was
+ * successfully destroyed.
+ */
+int mpmc_queue_destroy(mpmc_queue_t queue);
+
+/*
+ * mpmc_queue_enqueue - Enqueue data item
+ * @queue: Queue in which to enqueue item
+ * @data: Address of data item to enqueue
+ *
+ * Enqueue the address contained in @data in the queue @queue. This function
+ * may be called concurrently from any thread.
+ *
+ * Return: -1 if @queue or @data are NULL, or if @queue is full. 0 if @data was
+ * successfully enqueued in @queue.
+ */
+int mpmc_queue_enqueue(mpmc_queue_t queue, void *data);
+
+/*
+ * mpmc_queue_dequeue - Dequeue data item
+ * @queue: Queue in which to dequeue item
+ * @data: Address of data pointer where item is received
+ *
+ * Remove the oldest item of queue @queue and assign this item to @data. This
+ * function may be called concurrently from any thread.
+ *
+ * Return: -1 if @queue or @data are NULL, or if the queue is empty. 0 if @data
+ * was set with the oldest item available in @queue.
+ */
+int mpmc_queue_dequeue(mpmc_queue_t queue, void **data);
+
+/*
+ * mpmc_queue_length - Queue length
+ * @queue: Queue to get the length of
+ *
+ * The length is only a snapshot when other threads are using @queue
+ * concurrently.
+ *
+ * Return: -1 if @queue is NULL. Length of @queue otherwise.
+ */
+int mpmc_queue_length(mpmc_queue_t queue);
+
+#endif /* _MPMC_QUEUE_H */
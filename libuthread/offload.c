@@ -0,0 +1,252 @@
+#include <pthread.h>
+#include <signal.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "private.h"
+#include "queue.h"
+#include "sem.h"
+#include "uthread.h"
+
+/*
+Blocking-call offload pool
+
+A call offloaded with uthread_offload() is run by one of a few kernel threads
+while the calling uthread is blocked, so that other uthreads keep running.
+Pool threads hand completed calls back through a lock-free list, which the
+runtime empties at scheduling points to unblock the callers. In-flight calls
+hold the runtime (see sem_remote_hold()) so that it sleeps, rather than
+returning, while only offloaded calls are left.
+*/
+
+/* Default number of kernel threads in the pool */
+#define UTHREAD_OFFLOAD_THREADS 4
+
+struct offload_job {
+	uthread_func_t func;
+	void *arg;
+	struct uthread_tcb *caller;
+	bool done;			//set by the runtime when draining
+	uint64_t submitted;		//timestamps, in nanoseconds
+	uint64_t started;
+	struct offload_job *next;	//link in the completion list
+};
+
+static size_t nr_threads = UTHREAD_OFFLOAD_THREADS;
+static pthread_t *workers;
+static size_t nr_workers;
+
+//pending calls, shared with the pool threads
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t cond = PTHREAD_COND_INITIALIZER;
+static queue_t pending;
+static bool stopping;
+
+static _Atomic(struct offload_job *) completed;
+
+//statistics, pool side updated under lock
+static size_t calls;
+static size_t queue_peak;
+static uint64_t queue_ns;
+static uint64_t latency_ns;
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void *offload_worker(void *arg)
+{
+	struct offload_job *job;
+
+	(void)arg;
+
+	while(1){
+		pthread_mutex_lock(&lock);
+		while(!stopping && queue_length(pending) == 0){
+			pthread_cond_wait(&cond, &lock);
+		}
+		if(queue_dequeue(pending, (void **)&job) < 0){ //stopping and nothing left
+			pthread_mutex_unlock(&lock);
+			return NULL;
+		}
+		job->started = now_ns();
+		queue_ns += job->started - job->submitted;
+		pthread_mutex_unlock(&lock);
+
+		job->func(job->arg);
+
+		struct offload_job *head = atomic_load(&completed);
+		do{
+			job->next = head;
+		}while(!atomic_compare_exchange_weak(&completed, &head, job));
+
+		sem_remote_release(); //wakes up the runtime if it is sleeping
+	}
+}
+
+//called with lock held and preemption disabled
+static int offload_start(void)
+{
+	sigset_t all, old;
+
+	pending = queue_create();
+	workers = malloc(nr_threads * sizeof(*workers));
+
+	//pool threads inherit the signal mask: keep the preemption timer and the
+	//profiler from interrupting them instead of the runtime
+	sigfillset(&all);
+	pthread_sigmask(SIG_SETMASK, &all, &old);
+
+	stopping = false;
+	nr_workers = 0;
+	while(pending != NULL && workers != NULL && nr_workers < nr_threads){
+		if(pthread_create(&workers[nr_workers], NULL, offload_worker, NULL)){
+			break; //fewer threads than asked for, but still usable
+		}
+		nr_workers++;
+	}
+
+	pthread_sigmask(SIG_SETMASK, &old, NULL);
+
+	if(nr_workers == 0){
+		queue_destroy(pending);
+		free(workers);
+		pending = NULL;
+		workers = NULL;
+		return -1;
+	}
+
+	return 0;
+}
+
+void offload_stop(void)
+{
+	size_t i;
+
+	if(workers == NULL){
+		return;
+	}
+
+	pthread_mutex_lock(&lock);
+	stopping = true;
+	pthread_cond_broadcast(&cond);
+	pthread_mutex_unlock(&lock);
+
+	for(i = 0; i < nr_workers; i++){
+		pthread_join(workers[i], NULL);
+	}
+
+	free(workers);
+	queue_destroy(pending);
+	workers = NULL;
+	pending = NULL;
+	nr_workers = 0;
+}
+
+void offload_drain(void)
+{
+	if(atomic_load_explicit(&completed, memory_order_relaxed) == NULL){
+		return; //fast path, nothing completed
+	}
+
+	struct offload_job *job = atomic_exchange(&completed, NULL);
+
+	while(job != NULL){
+		struct offload_job *next = job->next; //the caller frees job once resumed
+
+		preempt_disable();
+		job->done = true;
+		preempt_enable();
+		uthread_unblock(job->caller);
+		job = next;
+	}
+}
+
+void offload_get_stats(struct uthread_stats *stats)
+{
+	preempt_disable(); //see uthread_offload()
+	pthread_mutex_lock(&lock);
+	stats->offload_calls = calls;
+	stats->offload_queue_depth = pending ? queue_length(pending) : 0;
+	stats->offload_queue_peak = queue_peak;
+	stats->offload_queue_ns = queue_ns;
+	pthread_mutex_unlock(&lock);
+	preempt_enable();
+	stats->offload_latency_ns = latency_ns;
+}
+
+int uthread_set_offload_threads(size_t n)
+{
+	if(n == 0 || workers != NULL){
+		return -1;
+	}
+
+	nr_threads = n;
+	return 0;
+}
+
+int uthread_offload(uthread_func_t func, void *arg)
+{
+	if(func == NULL || uthread_current() == NULL){
+		return -1;
+	}
+
+	//a thread preempted while holding lock would deadlock the next one taking
+	//it, and the allocator isn't reentrant
+	preempt_disable();
+
+	//the job must not live on the caller's stack, which may be swapped out
+	struct offload_job *job = malloc(sizeof(*job));
+	if(job == NULL){
+		preempt_enable();
+		return -1;
+	}
+
+	job->func = func;
+	job->arg = arg;
+	job->caller = uthread_current();
+	job->done = false;
+
+	pthread_mutex_lock(&lock);
+	if(workers == NULL && offload_start() < 0){
+		pthread_mutex_unlock(&lock);
+		free(job);
+		preempt_enable();
+		return -1;
+	}
+
+	job->submitted = now_ns();
+	if(queue_enqueue(pending, job) < 0){
+		pthread_mutex_unlock(&lock);
+		free(job);
+		preempt_enable();
+		return -1;
+	}
+	calls++;
+	if((size_t)queue_length(pending) > queue_peak){
+		queue_peak = queue_length(pending);
+	}
+	sem_remote_hold(); //released by the pool thread on completion
+	pthread_cond_signal(&cond);
+	pthread_mutex_unlock(&lock);
+
+	//block until the runtime sees the completion, like sem_down()
+	while(!job->done){
+		uthread_block();
+		preempt_disable(); //uthread_block() enabled it
+	}
+
+	latency_ns += now_ns() - job->submitted;
+	free(job);
+	preempt_enable();
+
+	return 0;
+}
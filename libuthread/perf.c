@@ -0,0 +1,419 @@
+#define _GNU_SOURCE		/* dladdr() */
+#include <dlfcn.h>
+#include <linux/perf_event.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "private.h"
+#include "uthread.h"
+
+/*
+ * Per-thread hardware counters
+ *
+ * One group of perf events counts what the runtime's kernel thread executes in
+ * user space. The group is read at every context switch, and the counts since
+ * the previous reading go to the thread switched out. Counters are read with
+ * rdpmc when the kernel lets user space do so, and with a single read() of the
+ * whole group otherwise. Without any hardware counter, as in most virtual
+ * machines, only the task clock is counted.
+ *
+ * The counts of exited threads are summed up per name, or per entry function
+ * for unnamed threads, for the report.
+ */
+enum {
+	PERF_INSTRUCTIONS,
+	PERF_CYCLES,
+	PERF_CACHE_MISSES,
+	PERF_BRANCH_MISSES,
+	PERF_TASK_CLOCK,	/* Only without hardware counters */
+	PERF_EVENTS,
+};
+
+static const struct {
+	uint32_t type;
+	uint64_t config;
+} events[PERF_EVENTS] = {
+	[PERF_INSTRUCTIONS] = { PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS },
+	[PERF_CYCLES] = { PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES },
+	[PERF_CACHE_MISSES] = { PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES },
+	[PERF_BRANCH_MISSES] = { PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES },
+	[PERF_TASK_CLOCK] = { PERF_TYPE_SOFTWARE, PERF_COUNT_SW_TASK_CLOCK },
+};
+
+/* Sums of the threads of one name or entry function */
+struct perf_record {
+	char name[16];		/* Empty for unnamed threads */
+	uthread_func_t func;	/* Entry function of unnamed threads */
+	size_t threads;
+	struct uthread_perf counts;
+	struct perf_record *next;
+};
+
+static bool enabled;
+static size_t report_top;
+
+/* Open events, in the order of the group's readings */
+static int fds[PERF_EVENTS];
+static int order[PERF_EVENTS];
+static size_t nr_open;
+static bool counted[PERF_EVENTS];	/* Over all the runs */
+
+static struct perf_event_mmap_page *pages[PERF_EVENTS];
+static bool use_rdpmc;
+
+static unsigned long long last[PERF_EVENTS];
+
+static struct perf_record *records;
+static size_t nr_records;
+
+static size_t nr_reads, nr_rdpmc;
+
+static int perf_open(int event, int group)
+{
+	struct perf_event_attr attr;
+
+	memset(&attr, 0, sizeof(attr));
+	attr.size = sizeof(attr);
+	attr.type = events[event].type;
+	attr.config = events[event].config;
+	attr.exclude_kernel = 1;
+	attr.exclude_hv = 1;
+	attr.read_format = PERF_FORMAT_GROUP;
+
+	return syscall(SYS_perf_event_open, &attr, 0, -1, group,
+		       PERF_FLAG_FD_CLOEXEC);
+}
+
+static void perf_unmap(void)
+{
+	size_t i;
+
+	for (i = 0; i < nr_open; i++) {
+		if (pages[i])
+			munmap(pages[i], sysconf(_SC_PAGESIZE));
+		pages[i] = NULL;
+	}
+}
+
+#if defined(__x86_64__)
+/* Let user space read the counters if every one of them allows it */
+static bool perf_map(void)
+{
+	size_t i;
+
+	for (i = 0; i < nr_open; i++) {
+		pages[i] = mmap(NULL, sysconf(_SC_PAGESIZE), PROT_READ,
+				MAP_SHARED, fds[i], 0);
+		if (pages[i] == MAP_FAILED) {
+			pages[i] = NULL;
+			break;
+		}
+		if (!pages[i]->cap_user_rdpmc)
+			break;
+	}
+	if (i == nr_open)
+		return true;
+
+	perf_unmap();
+	return false;
+}
+
+static unsigned long long rdpmc(uint32_t counter)
+{
+	uint32_t low, high;
+
+	__asm__ volatile("rdpmc" : "=a"(low), "=d"(high) : "c"(counter));
+	return (unsigned long long)high << 32 | low;
+}
+
+/* See the description of struct perf_event_mmap_page */
+static bool perf_rdpmc(unsigned long long *values)
+{
+	size_t i;
+
+	for (i = 0; i < nr_open; i++) {
+		volatile struct perf_event_mmap_page *pc = pages[i];
+		uint32_t seq, index;
+		int64_t count, pmc;
+
+		do {
+			seq = pc->lock;
+			__asm__ volatile("" ::: "memory");
+			index = pc->index;
+			count = pc->offset;
+			/* Not on the PMU right now */
+			if (!index)
+				return false;
+			pmc = rdpmc(index - 1);
+			pmc <<= 64 - pc->pmc_width;
+			pmc >>= 64 - pc->pmc_width;
+			count += pmc;
+			__asm__ volatile("" ::: "memory");
+		} while (pc->lock != seq);
+
+		values[order[i]] = count;
+	}
+
+	return true;
+}
+#else
+static bool perf_map(void)
+{
+	return false;
+}
+
+static bool perf_rdpmc(unsigned long long *values)
+{
+	(void)values;
+
+	return false;
+}
+#endif
+
+/* Update @values with the counters, left as they are if they can't be read */
+static void perf_read(unsigned long long *values)
+{
+	struct {
+		uint64_t nr;
+		uint64_t values[PERF_EVENTS];
+	} group;
+	ssize_t len;
+	size_t i;
+
+	if (use_rdpmc && perf_rdpmc(values)) {
+		nr_rdpmc++;
+		return;
+	}
+
+	nr_reads++;
+	len = read(fds[0], &group, sizeof(group));
+	if (len < (ssize_t)sizeof(group.nr))
+		return;
+	for (i = 0; i < group.nr && i < nr_open; i++)
+		values[order[i]] = group.values[i];
+}
+
+static void perf_add(struct uthread_perf *perf, const unsigned long long *now)
+{
+	perf->instructions += now[PERF_INSTRUCTIONS] - last[PERF_INSTRUCTIONS];
+	perf->cycles += now[PERF_CYCLES] - last[PERF_CYCLES];
+	perf->cache_misses += now[PERF_CACHE_MISSES] - last[PERF_CACHE_MISSES];
+	perf->branch_misses += now[PERF_BRANCH_MISSES] -
+			       last[PERF_BRANCH_MISSES];
+	perf->task_clock_ns += now[PERF_TASK_CLOCK] - last[PERF_TASK_CLOCK];
+}
+
+static void perf_close(void)
+{
+	size_t i;
+
+	perf_unmap();
+	for (i = 0; i < nr_open; i++)
+		close(fds[i]);
+	nr_open = 0;
+}
+
+bool perf_start(void)
+{
+	int event, fd;
+
+	if (!enabled)
+		return false;
+
+	for (event = 0; event < PERF_EVENTS; event++) {
+		/* The task clock stands in for missing hardware counters */
+		if (event == PERF_TASK_CLOCK && nr_open)
+			break;
+
+		fd = perf_open(event, nr_open ? fds[0] : -1);
+		if (fd < 0)
+			continue;
+		fds[nr_open] = fd;
+		order[nr_open++] = event;
+		counted[event] = true;
+	}
+	if (!nr_open)
+		return false;
+
+	use_rdpmc = perf_map();
+	memset(last, 0, sizeof(last));
+	perf_read(last);
+
+	return true;
+}
+
+void perf_stop(void)
+{
+	perf_close();
+}
+
+void perf_switch(struct uthread_perf *perf)
+{
+	unsigned long long now[PERF_EVENTS];
+
+	memcpy(now, last, sizeof(now));
+	perf_read(now);
+	perf_add(perf, now);
+	memcpy(last, now, sizeof(last));
+	perf->switches++;
+}
+
+void perf_running(struct uthread_perf *perf)
+{
+	unsigned long long now[PERF_EVENTS];
+
+	memcpy(now, last, sizeof(now));
+	perf_read(now);
+	perf_add(perf, now);
+}
+
+void perf_exit(const char *name, uthread_func_t func,
+	       const struct uthread_perf *perf)
+{
+	struct perf_record *record;
+
+	for (record = records; record; record = record->next) {
+		if (name[0] ? !strcmp(record->name, name) :
+			      !record->name[0] && record->func == func)
+			break;
+	}
+
+	if (!record) {
+		record = calloc(1, sizeof(*record));
+		if (!record)
+			return;
+		snprintf(record->name, sizeof(record->name), "%s", name);
+		record->func = func;
+		record->next = records;
+		records = record;
+		nr_records++;
+	}
+
+	record->threads++;
+	record->counts.instructions += perf->instructions;
+	record->counts.cycles += perf->cycles;
+	record->counts.cache_misses += perf->cache_misses;
+	record->counts.branch_misses += perf->branch_misses;
+	record->counts.task_clock_ns += perf->task_clock_ns;
+	record->counts.switches += perf->switches;
+}
+
+void perf_get_stats(struct uthread_stats *stats)
+{
+	stats->perf_reads = nr_reads;
+	stats->perf_rdpmc_reads = nr_rdpmc;
+}
+
+static void perf_report_at_exit(void)
+{
+	uthread_perf_report(report_top);
+}
+
+int uthread_perf_start(size_t top_n)
+{
+	static bool registered;
+	int event, fd = -1;
+
+	/* Check that something can be counted */
+	for (event = 0; event < PERF_EVENTS && fd < 0; event++)
+		fd = perf_open(event, -1);
+	if (fd < 0)
+		return -1;
+	close(fd);
+
+	if (!registered && top_n > 0) {
+		if (atexit(perf_report_at_exit) != 0)
+			return -1;
+		registered = true;
+	}
+
+	report_top = top_n;
+	enabled = true;
+
+	return 0;
+}
+
+/* Most cycles first, or most CPU time without hardware counters */
+static int perf_compare(const void *a, const void *b)
+{
+	const struct uthread_perf *x = &(*(struct perf_record *const *)a)->counts;
+	const struct uthread_perf *y = &(*(struct perf_record *const *)b)->counts;
+
+	if (x->cycles != y->cycles)
+		return x->cycles < y->cycles ? 1 : -1;
+	if (x->task_clock_ns != y->task_clock_ns)
+		return x->task_clock_ns < y->task_clock_ns ? 1 : -1;
+	return 0;
+}
+
+static void perf_print(const char *format, bool valid, double value)
+{
+	if (valid)
+		fprintf(stderr, format, value);
+	else
+		fprintf(stderr, " %12s", "-");
+}
+
+void uthread_perf_report(size_t top_n)
+{
+	struct perf_record **sorted, *record;
+	size_t i = 0;
+
+	if (nr_records == 0 || top_n == 0)
+		return;
+
+	sorted = malloc(nr_records * sizeof(*sorted));
+	if (!sorted)
+		return;
+	for (record = records; record; record = record->next)
+		sorted[i++] = record;
+	qsort(sorted, nr_records, sizeof(*sorted), perf_compare);
+	if (top_n > nr_records)
+		top_n = nr_records;
+
+	fprintf(stderr, "thread counters, top %zu of %zu:\n", top_n,
+		nr_records);
+	fprintf(stderr, "%-24s %8s %10s %12s %12s %12s %12s %12s %12s\n",
+		"thread", "threads", "switches", "instructions", "cycles",
+		"IPC", "cache misses", "branch miss", "cpu ms");
+
+	for (i = 0; i < top_n; i++) {
+		const struct uthread_perf *c = &sorted[i]->counts;
+		char name[32];
+		Dl_info info;
+
+		if (sorted[i]->name[0])
+			snprintf(name, sizeof(name), "%s", sorted[i]->name);
+		else if (dladdr((void *)sorted[i]->func, &info) &&
+			 info.dli_sname)
+			snprintf(name, sizeof(name), "%s", info.dli_sname);
+		else
+			snprintf(name, sizeof(name), "%p",
+				 (void *)sorted[i]->func);
+
+		fprintf(stderr, "%-24s %8zu %10zu", name, sorted[i]->threads,
+			c->switches);
+		perf_print(" %12.0f", counted[PERF_INSTRUCTIONS],
+			   c->instructions);
+		perf_print(" %12.0f", counted[PERF_CYCLES], c->cycles);
+		perf_print(" %12.2f", counted[PERF_INSTRUCTIONS] &&
+			   counted[PERF_CYCLES] && c->cycles,
+			   (double)c->instructions / (c->cycles ? c->cycles : 1));
+		perf_print(" %12.0f", counted[PERF_CACHE_MISSES],
+			   c->cache_misses);
+		perf_print(" %12.0f", counted[PERF_BRANCH_MISSES],
+			   c->branch_misses);
+		perf_print(" %12.3f", counted[PERF_TASK_CLOCK],
+			   c->task_clock_ns / 1e6);
+		fprintf(stderr, "\n");
+	}
+
+	free(sorted);
+}
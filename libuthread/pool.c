@@ -0,0 +1,245 @@
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdlib.h>
+
+#include "pool.h"
+#include "private.h"
+#include "queue.h"
+#include "sem.h"
+#include "uthread.h"
+
+/*
+ * Worker pool
+ *
+ * Tasks are kept in a ring buffer allocated with the pool. Workers take tasks
+ * as long as there are some, and only block on the wakeup semaphore once the
+ * ring is empty, counting themselves as idle; submitting only posts the
+ * semaphore for as many idle workers as there are new tasks. Submitters facing
+ * a full ring, and threads waiting for all tasks to complete, park on wait
+ * lists that are released in one go.
+ */
+struct pool_task {
+	uthread_func_t func;		/* NULL asks the worker to exit */
+	void *arg;
+};
+
+struct uthread_pool {
+	struct pool_task *tasks;	/* Ring buffer of @capacity tasks */
+	size_t capacity;
+	size_t head;			/* Oldest task */
+	size_t len;
+
+	size_t nr_workers;
+	size_t idle;			/* Workers blocked, or about to, on @wakeup */
+	sem_t wakeup;
+	sem_t exited;			/* Posted by each exiting worker */
+
+	size_t pending;			/* Submitted tasks not completed yet */
+	queue_t submitters;		/* Threads waiting for room in the ring */
+	queue_t waiters;		/* Threads waiting for @pending to be 0 */
+};
+
+/* Queue @n tasks, preemption being disabled, and return how many fit */
+static size_t pool_put(struct uthread_pool *pool, uthread_func_t *funcs,
+		       void **args, size_t n)
+{
+	size_t i;
+
+	if (n > pool->capacity - pool->len)
+		n = pool->capacity - pool->len;
+
+	for (i = 0; i < n; i++) {
+		struct pool_task *task =
+			&pool->tasks[(pool->head + pool->len++) % pool->capacity];
+
+		task->func = funcs ? funcs[i] : NULL;
+		task->arg = args ? args[i] : NULL;
+	}
+
+	return n;
+}
+
+/* Queue all @n tasks, blocking while the ring is full */
+static int pool_submit(struct uthread_pool *pool, uthread_func_t *funcs,
+		       void **args, size_t n, bool count)
+{
+	preempt_disable();
+	if (count)
+		pool->pending += n;
+
+	while (1) {
+		size_t put = pool_put(pool, funcs, args, n);
+		size_t wake = put < pool->idle ? put : pool->idle;
+
+		n -= put;
+		if (funcs)
+			funcs += put;
+		if (args)
+			args += put;
+
+		/* Workers woken up take any queued task */
+		pool->idle -= wake;
+		preempt_enable();
+		while (wake-- > 0)
+			sem_up(pool->wakeup);
+
+		if (n == 0)
+			return 0;
+
+		preempt_disable();
+		if (pool->len == pool->capacity &&
+		    uthread_park(pool->submitters) < 0) {
+			preempt_disable();
+			if (count)
+				pool->pending -= n;
+			preempt_enable();
+			return -1;
+		}
+		preempt_disable(); /* uthread_park() enabled it */
+	}
+}
+
+static void pool_worker(void *arg)
+{
+	struct uthread_pool *pool = arg;
+	struct pool_task task;
+
+	preempt_disable();
+	while (1) {
+		if (pool->len == 0) {
+			pool->idle++;
+			preempt_enable();
+			sem_down(pool->wakeup);
+			preempt_disable();
+			continue;
+		}
+
+		task = pool->tasks[pool->head];
+		pool->head = (pool->head + 1) % pool->capacity;
+		pool->len--;
+		uthread_unpark_all(pool->submitters); /* there is room now */
+
+		if (!task.func)
+			break;
+
+		preempt_enable();
+		task.func(task.arg);
+		preempt_disable();
+
+		if (--pool->pending == 0)
+			uthread_unpark_all(pool->waiters);
+	}
+	preempt_enable();
+
+	sem_up(pool->exited);
+}
+
+static void pool_free(struct uthread_pool *pool)
+{
+	sem_destroy(pool->exited);
+	sem_destroy(pool->wakeup);
+
+	preempt_disable(); /* the allocator isn't reentrant */
+	queue_destroy(pool->waiters);
+	queue_destroy(pool->submitters);
+	free(pool->tasks);
+	free(pool);
+	preempt_enable();
+}
+
+uthread_pool_t uthread_pool_create(size_t nr_workers, size_t capacity)
+{
+	struct uthread_pool *pool;
+
+	if (!nr_workers || !capacity)
+		return NULL;
+
+	/* The allocator isn't reentrant, sem_create() takes care of itself */
+	preempt_disable();
+	pool = calloc(1, sizeof(*pool));
+	if (pool) {
+		pool->tasks = malloc(capacity * sizeof(*pool->tasks));
+		pool->submitters = queue_create();
+		pool->waiters = queue_create();
+	}
+	preempt_enable();
+	if (!pool)
+		return NULL;
+
+	pool->capacity = capacity;
+	pool->wakeup = sem_create(0);
+	pool->exited = sem_create(0);
+	if (!pool->tasks || !pool->wakeup || !pool->exited ||
+	    !pool->submitters || !pool->waiters) {
+		pool_free(pool);
+		return NULL;
+	}
+
+	for (; pool->nr_workers < nr_workers; pool->nr_workers++) {
+		if (uthread_create(pool_worker, pool) < 0) {
+			uthread_pool_destroy(pool);
+			return NULL;
+		}
+	}
+
+	return pool;
+}
+
+int uthread_pool_destroy(uthread_pool_t pool)
+{
+	size_t i;
+
+	if (!pool)
+		return -1;
+
+	uthread_pool_wait_all(pool);
+
+	/* One exit request per worker, each worker taking only one */
+	for (i = 0; i < pool->nr_workers; i++)
+		pool_submit(pool, NULL, NULL, 1, false);
+	for (i = 0; i < pool->nr_workers; i++)
+		sem_down(pool->exited);
+
+	pool_free(pool);
+
+	return 0;
+}
+
+int uthread_pool_submit(uthread_pool_t pool, uthread_func_t func, void *arg)
+{
+	if (!pool || !func)
+		return -1;
+
+	return pool_submit(pool, &func, &arg, 1, true);
+}
+
+int uthread_pool_submit_batch(uthread_pool_t pool, uthread_func_t *funcs,
+			      void **args, size_t n)
+{
+	size_t i;
+
+	if (!pool || !funcs)
+		return -1;
+	for (i = 0; i < n; i++)
+		if (!funcs[i])
+			return -1;
+
+	return pool_submit(pool, funcs, args, n, true);
+}
+
+int uthread_pool_wait_all(uthread_pool_t pool)
+{
+	int ret = 0;
+
+	if (!pool)
+		return -1;
+
+	preempt_disable();
+	while (pool->pending > 0 && ret == 0) {
+		ret = uthread_park(pool->waiters);
+		preempt_disable(); /* uthread_park() enabled it */
+	}
+	preempt_enable();
+
+	return ret;
+}
@@ -0,0 +1,87 @@
+#ifndef _POOL_H
+#define _POOL_H
+
+#include <stddef.h>
+
+#include "uthread.h"
+
+/*
+ * uthread_pool_t - Worker pool type
+ *
+ * A pool runs tasks, i.e. a function and its argument, on a fixed set of
+ * long-lived threads, its workers. Submitting a task only stores it in the
+ * pool's queue, whose capacity is set at creation, so that running a task
+ * costs neither a thread creation nor a memory allocation. Idle workers are
+ * blocked until a task is submitted.
+ */
+typedef struct uthread_pool *uthread_pool_t;
+
+/*
+ * uthread_pool_create - Create worker pool
+ * @nr_workers: Number of worker threads
+ * @capacity: Number of tasks that can be queued before submitting blocks
+ *
+ * Create the pool and its workers. This function is to be called from a
+ * running thread, and the pool must be destroyed before uthread_run() can
+ * return, as idle workers don't finish by themselves.
+ *
+ * Return: Pointer to initialized pool. NULL if @nr_workers or @capacity is 0,
+ * or in case of failure when allocating the pool or creating its workers.
+ */
+uthread_pool_t uthread_pool_create(size_t nr_workers, size_t capacity);
+
+/*
+ * uthread_pool_destroy - Deallocate a worker pool
+ * @pool: Pool to deallocate
+ *
+ * Wait for all the submitted tasks to complete, then for the workers to exit,
+ * and deallocate @pool. This function is to be called from a running thread
+ * other than the workers of @pool.
+ *
+ * Return: -1 if @pool is NULL. 0 if @pool was successfully destroyed.
+ */
+int uthread_pool_destroy(uthread_pool_t pool);
+
+/*
+ * uthread_pool_submit - Submit a task
+ * @pool: Pool to run the task
+ * @func: Function to be executed by a worker
+ * @arg: Argument to be passed to @func
+ *
+ * Queue the task for the next idle worker. If the queue is full, the calling
+ * thread is blocked until a worker takes a task out of it.
+ *
+ * Return: -1 if @pool or @func are NULL. 0 if the task was submitted.
+ */
+int uthread_pool_submit(uthread_pool_t pool, uthread_func_t func, void *arg);
+
+/*
+ * uthread_pool_submit_batch - Submit several tasks at once
+ * @pool: Pool to run the tasks
+ * @funcs: Array of @n functions to be executed by the workers
+ * @args: Array of @n arguments, or NULL to pass NULL to all functions
+ * @n: Number of tasks
+ *
+ * Same as calling uthread_pool_submit() for each task, but the queue is only
+ * locked once per run of tasks that fits in it.
+ *
+ * Return: -1 if @pool or @funcs are NULL, or if one of the functions is NULL,
+ * in which case no task is submitted. 0 if all the tasks were submitted.
+ */
+int uthread_pool_submit_batch(uthread_pool_t pool, uthread_func_t *funcs,
+			      void **args, size_t n);
+
+/*
+ * uthread_pool_wait_all - Wait for the submitted tasks to complete
+ * @pool: Pool running the tasks
+ *
+ * Block the calling thread until every task submitted to @pool so far, and
+ * the tasks they submitted, completed. This function is not to be called from
+ * a task, which would wait for itself.
+ *
+ * Return: -1 if @pool is NULL, or in case of memory allocation error. 0 once
+ * no task is left.
+ */
+int uthread_pool_wait_all(uthread_pool_t pool);
+
+#endif /* _POOL_H */
@@ -7,6 +7,7 @@
 #include <sys/time.h>
 
 #include "private.h"
+#include "probe.h"
 #include "uthread.h"
 
 /*
@@ -41,11 +42,38 @@ struct timeval {
 
 #define HZ 100
 
+#ifdef UTHREAD_COOP
+/*Preemption compiled out: threads only switch when they yield or block*/
+void preempt_start(bool preempt)
+{
+	(void) preempt;
+}
+
+void preempt_stop(void)
+{
+}
+
+bool preempt_is_handler(uintptr_t pc)
+{
+	(void) pc;
+	return false;
+}
+#else
+/*whether the timer runs, otherwise there is nothing to mask*/
+static bool started;
+
 void handler(int signum){
 	/*signum = which signal triggered the handler*/
 	(void) signum; //we don't need signum, this line prevents a warning error of an unused variable
 
-	uthread_yield(); //force a context switch
+	UTHREAD_PROBE2(preempt_tick, uthread_self(), uthread_current());
+	uthread_tick(); //let the scheduling policy decide whether to switch
+}
+
+
+bool preempt_is_handler(uintptr_t pc)
+{
+	return pc == (uintptr_t)handler;
 }
 
 
@@ -53,6 +81,8 @@ void preempt_enable(void)
 {
 	/*This function unblocks the SIGVTALRM, allowing it to be delivered*/
 
+	if(!started){ return; } //no system call for cooperative runs
+
 	sigset_t mask;
     sigemptyset(&mask);			 //initialize no blocked signals
     sigaddset(&mask, SIGVTALRM); //add SIGVTALRM to the set
@@ -66,6 +96,8 @@ void preempt_disable(void)
 
 	/*This function blocks the SIGVTALRM from being delivered*/
 
+	if(!started){ return; } //no system call for cooperative runs
+
 	sigset_t mask;
     sigemptyset(&mask);			 //initialize no blocked signals
     sigaddset(&mask, SIGVTALRM); //add SIGVTALRM to the set
@@ -95,6 +127,8 @@ void preempt_start(bool preempt)
 		exit(1);
 	}
 
+	started = true; //masking matters from the first alarm on
+
 	struct itimerval timer;
 
 	/*When timer starts*/
@@ -118,7 +152,11 @@ void preempt_stop(void)
 		It also resets the signal handler to default.
 	*/
 
+	if(!started){ return; } //nothing was set up
+
 	struct itimerval timer;
+	timer.it_value.tv_sec = 0;
+	timer.it_interval.tv_sec = 0;
 	timer.it_value.tv_usec = 0;
 	timer.it_interval.tv_usec = 0;
 	setitimer(ITIMER_VIRTUAL, &timer, NULL);
@@ -129,8 +167,11 @@ void preempt_stop(void)
 	sa.sa_flags = 0;
 	sigaction(SIGVTALRM, &sa, NULL);
 
+	started = false;
+
 	return;
 }
+#endif
 
 /*Sources
 https://stackoverflow.com/questions/21180857/installing-signal-handler-in-c
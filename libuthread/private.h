@@ -10,8 +10,10 @@
 /**
  * Private context API
  */
+#include <stdint.h>
 #include <ucontext.h>
 
+#include "queue.h"
 #include "uthread.h"
 
 /*
@@ -42,11 +44,50 @@ void uthread_ctx_switch(uthread_ctx_t *prev, uthread_ctx_t *next);
  */
 void *uthread_ctx_alloc_stack(void);
 
+/*
+ * uthread_ctx_alloc_stack_size - Allocate stack segment of a given size
+ * @size: Size of the segment in bytes
+ *
+ * Only meant for the UTHREAD_STACK_PRIVATE mode, whose segments may differ in
+ * size. Deallocated with uthread_ctx_destroy_stack().
+ *
+ * Return: Pointer to the top of a valid stack segment, or NULL in case of
+ * failure
+ */
+void *uthread_ctx_alloc_stack_size(size_t size);
+
 /*
  * uthread_ctx_destroy_stack - Deallocate stack segment
  * @top_of_stack: Address of stack to deallocate
+ * @size: Size given to uthread_ctx_alloc_stack_size(), or 0 for a segment
+ *	allocated by uthread_ctx_alloc_stack()
  */
-void uthread_ctx_destroy_stack(void *top_of_stack);
+void uthread_ctx_destroy_stack(void *top_of_stack, size_t size);
+
+/*
+ * uthread_ctx_alloc_stacks - Allocate contiguous stack segments
+ * @n: Number of stack segments
+ *
+ * Return: Pointer to a block holding @n stack segments, or NULL in case of
+ * failure. Individual segments are obtained with uthread_ctx_stack_at().
+ */
+void *uthread_ctx_alloc_stacks(size_t n);
+
+/*
+ * uthread_ctx_stack_at - Get a stack segment from a contiguous block
+ * @stacks: Block allocated by uthread_ctx_alloc_stacks()
+ * @i: Index of the stack segment
+ *
+ * Return: Pointer to the top of the @i-th stack segment of @stacks
+ */
+void *uthread_ctx_stack_at(void *stacks, size_t i);
+
+/*
+ * uthread_ctx_destroy_stacks - Deallocate contiguous stack segments
+ * @stacks: Block allocated by uthread_ctx_alloc_stacks()
+ * @n: Number of stack segments in @stacks
+ */
+void uthread_ctx_destroy_stacks(void *stacks, size_t n);
 
 /*
  * uthread_ctx_init - Initialize a thread's execution context
@@ -61,6 +102,387 @@ void uthread_ctx_destroy_stack(void *top_of_stack);
 int uthread_ctx_init(uthread_ctx_t *uctx, void *top_of_stack,
 					 uthread_func_t func, void *arg);
 
+/*
+ * uthread_ctx_stack_size - Get the usable size of a stack segment
+ *
+ * Return: Size in bytes of the segments returned by uthread_ctx_alloc_stack()
+ * and uthread_ctx_stack_at()
+ */
+size_t uthread_ctx_stack_size(void);
+
+/*
+ * uthread_ctx_stack_charge - Get the memory a new stack segment takes
+ *
+ * Return: Number of bytes accounted to stacks for a segment returned by
+ * uthread_ctx_alloc_stack(), when it is allocated
+ */
+size_t uthread_ctx_stack_charge(void);
+
+/*
+ * uthread_ctx_init_size - Initialize a thread's execution context on part of a
+ *	stack segment
+ * @uctx: Pointer to thread context to initialize
+ * @top_of_stack: Pointer to the top of a valid stack segment
+ * @size: Number of bytes of the segment the thread may use, from
+ *	@top_of_stack up
+ * @func: Function to be executed by the thread
+ * @arg: Argument to pass to the thread
+ *
+ * The bytes of the segment above @size are left alone, and can hold data
+ * belonging to the thread.
+ *
+ * Return: 0 if @uctx was properly initialized, or -1 in case of failure
+ */
+int uthread_ctx_init_size(uthread_ctx_t *uctx, void *top_of_stack,
+			  size_t size, uthread_func_t func, void *arg);
+
+/*
+ * uthread_ctx_init_batch - Initialize several execution contexts at once
+ * @uctxs: Array of @n pointers to the thread contexts to initialize
+ * @stacks: Block of @n stack segments, as allocated by
+ *	uthread_ctx_alloc_stacks()
+ * @size: Number of bytes of each segment the threads may use
+ * @funcs: Array of @n functions to be executed by the threads
+ * @args: Array of @n arguments to pass to the threads, or NULL
+ * @n: Number of contexts
+ *
+ * The active context is only captured once and copied into every context of
+ * @uctxs, so no system call is made per thread.
+ *
+ * Return: 0 if @uctxs were properly initialized, or -1 in case of failure
+ */
+int uthread_ctx_init_batch(uthread_ctx_t *const *uctxs, void *stacks,
+			   size_t size, uthread_func_t *funcs, void **args,
+			   size_t n);
+
+/*
+ * uthread_ctx_sp - Get the stack pointer of a switched-out context
+ * @uctx: Context saved by uthread_ctx_switch()
+ *
+ * Return: Stack pointer of @uctx, or NULL if it can't be told on this platform
+ */
+void *uthread_ctx_sp(const uthread_ctx_t *uctx);
+
+/*
+ * uthread_ctx_growable_start - Switch to growable stacks
+ * @max: Maximum size of each stack in bytes, or 0 for the default
+ *
+ * Stack segments allocated afterwards only have a small part of their range
+ * accessible, which is extended on the fly when a thread faults below it, up
+ * to @max bytes. Faults are handled on an alternate signal stack.
+ *
+ * Return: 0 in case of success, or -1 in case of failure
+ */
+int uthread_ctx_growable_start(size_t max);
+
+/*
+ * uthread_ctx_growable_stop - Restore the fault handling in place before
+ *	uthread_ctx_growable_start()
+ */
+void uthread_ctx_growable_stop(void);
+
+/*
+ * uthread_ctx_arena_start - Switch to stacks carved out of huge pages
+ *
+ * Return: 0 in case of success, or -1 in case of failure
+ */
+int uthread_ctx_arena_start(void);
+
+/*
+ * uthread_ctx_arena_stop - Release every stack carved out of huge pages
+ */
+void uthread_ctx_arena_stop(void);
+
+/*
+ * uthread_ctx_get_stats - Fill the context-related fields of @stats
+ * @stats: Statistics to fill
+ */
+void uthread_ctx_get_stats(struct uthread_stats *stats);
+
+/*
+ * uthread_ctx_save - Saved stack of a thread in shared-stack mode
+ *
+ * Threads in shared-stack mode don't own a stack. This structure holds the
+ * used part of a thread's stack while another thread occupies the shared
+ * stack, along with what is needed to bind the thread to the shared stack the
+ * first time it runs.
+ */
+struct uthread_ctx_save {
+	void *buf;		/* Copy of the used part of the stack */
+	size_t size;		/* Number of bytes in @buf */
+	size_t cap;		/* Capacity of @buf */
+	char *sp;		/* Lowest address in use on the shared stack */
+	uthread_ctx_t *uctx;	/* Context the thread was last saved in */
+	uthread_func_t func;	/* Thread function, until bound */
+	void *arg;		/* Thread argument, until bound */
+	bool bound;		/* Whether the thread has run already */
+};
+
+/*
+ * uthread_ctx_shared_start - Set up the shared stack
+ *
+ * Return: 0 in case of success, or -1 in case of failure
+ */
+int uthread_ctx_shared_start(void);
+
+/*
+ * uthread_ctx_shared_stop - Deallocate the shared stack
+ */
+void uthread_ctx_shared_stop(void);
+
+/*
+ * uthread_ctx_shared_init - Initialize a thread for the shared stack
+ * @save: Save area of the thread
+ * @func: Function to be executed by the thread
+ * @arg: Argument to pass to the thread
+ *
+ * The thread's context is only initialized, and bound to the shared stack,
+ * when the thread is switched to for the first time.
+ */
+void uthread_ctx_shared_init(struct uthread_ctx_save *save,
+			     uthread_func_t func, void *arg);
+
+/*
+ * uthread_ctx_shared_switch - Switch between two contexts in shared-stack mode
+ * @prev: Context in which to save the currently running thread
+ * @prev_save: Save area of the currently running thread, or NULL if it runs
+ *	on a private stack
+ * @next: Context to resume
+ * @next_save: Save area of the thread to resume, or NULL if it runs on a
+ *	private stack
+ */
+void uthread_ctx_shared_switch(uthread_ctx_t *prev,
+			       struct uthread_ctx_save *prev_save,
+			       uthread_ctx_t *next,
+			       struct uthread_ctx_save *next_save);
+
+/*
+ * uthread_ctx_shared_release - Release a thread's save area
+ * @save: Save area of an exiting thread
+ */
+void uthread_ctx_shared_release(struct uthread_ctx_save *save);
+
+
+/**
+ * Private huge-page arena API
+ */
+
+/*
+ * huge_alloc - Map memory backed by huge pages if possible
+ * @size: Number of bytes, rounded up to a multiple of 2 MiB
+ *
+ * Explicit huge pages are used if any are available, then transparent huge
+ * pages, then regular pages.
+ *
+ * Return: 2 MiB-aligned pointer to the mapping, or NULL in case of failure
+ */
+void *huge_alloc(size_t size);
+
+/*
+ * huge_free - Unmap memory mapped by huge_alloc()
+ * @p: Pointer returned by huge_alloc()
+ * @size: Size given to huge_alloc()
+ */
+void huge_free(void *p, size_t size);
+
+/*
+ * arena - Allocator of fixed-size slots carved out of huge_alloc() chunks
+ */
+struct arena;
+
+/*
+ * arena_create - Create an arena
+ * @slot_size: Size of every slot in bytes, rounded up to 16
+ *
+ * Return: Pointer to the new arena, or NULL in case of failure
+ */
+struct arena *arena_create(size_t slot_size);
+
+/*
+ * arena_destroy - Destroy an arena, releasing all of its slots at once
+ * @arena: Arena to destroy
+ */
+void arena_destroy(struct arena *arena);
+
+/*
+ * arena_alloc - Allocate a slot
+ * @arena: Arena to allocate from
+ *
+ * Return: Pointer to a 16-byte aligned slot, or NULL in case of failure
+ */
+void *arena_alloc(struct arena *arena);
+
+/*
+ * arena_free - Free a slot
+ * @arena: Arena the slot was allocated from
+ * @p: Slot to free
+ */
+void arena_free(struct arena *arena, void *p);
+
+/*
+ * arena_get_stats - Fill the arena fields of @stats
+ * @stats: Statistics to fill
+ */
+void arena_get_stats(struct uthread_stats *stats);
+
+
+/**
+ * Private memory accounting API
+ */
+
+/*
+ * mem_kind - What memory is held for, see uthread_mem_stats
+ */
+enum mem_kind {
+	MEM_STACKS,
+	MEM_TCBS,
+	MEM_QUEUE_NODES,
+	MEM_SEMAPHORES,
+	MEM_POOLED,
+	MEM_KINDS,
+};
+
+/*
+ * mem_add - Account memory taken
+ * @kind: What the memory is for
+ * @bytes: Number of bytes
+ */
+void mem_add(enum mem_kind kind, size_t bytes);
+
+/*
+ * mem_sub - Account memory given back
+ * @kind: What the memory was for
+ * @bytes: Number of bytes
+ */
+void mem_sub(enum mem_kind kind, size_t bytes);
+
+/*
+ * mem_move - Account memory put to another use
+ * @from: What the memory was for
+ * @to: What the memory is for now
+ * @bytes: Number of bytes
+ */
+void mem_move(enum mem_kind from, enum mem_kind to, size_t bytes);
+
+/*
+ * mem_fits - Tell whether memory can be taken within the budget
+ * @bytes: Number of bytes about to be taken
+ *
+ * Return: true if there is no budget or if @bytes more fit in it
+ */
+bool mem_fits(size_t bytes);
+
+
+/**
+ * Private stack measurement API
+ */
+
+/*
+ * stack_paint - Paint a stack before its thread runs
+ * @low: Lowest address of the stack
+ * @high: Address right above the stack
+ */
+void stack_paint(void *low, void *high);
+
+/*
+ * stack_peak - Measure the high-water mark of a painted stack
+ * @low: Lowest address of the stack
+ * @high: Address right above the stack
+ * @clean: Address below which pages were released by stack_trim(), or NULL
+ *
+ * Return: Number of bytes from @high down to the deepest one ever written
+ */
+size_t stack_peak(void *low, void *high, void *clean);
+
+/*
+ * stack_trim - Release the unused pages of a switched-out thread's stack
+ * @low: Lowest address of the stack
+ * @sp: Stack pointer of the thread
+ *
+ * The whole pages between @low and a little below @sp are given back to the
+ * system with MADV_DONTNEED, and read back as zeroes if touched again.
+ *
+ * Return: Address right above the released pages, or NULL if none were
+ */
+void *stack_trim(void *low, void *sp);
+
+/*
+ * stack_exit - Account the peak stack usage of an exited thread
+ * @func: Entry function of the thread
+ * @peak: Peak usage measured with stack_peak()
+ * @size: Usable size of the thread's stack
+ *
+ * @peak is remembered for stack_size_for(). To be called with preemption
+ * disabled.
+ */
+void stack_exit(uthread_func_t func, size_t peak, size_t size);
+
+/*
+ * stack_size_for - Get a stack size fit for an entry function
+ * @func: Entry function of a thread to create
+ *
+ * To be called with preemption disabled.
+ *
+ * Return: Usable size in bytes a stack needs for @func, from the peak usage of
+ * the threads of @func that exited so far, or 0 if none did
+ */
+size_t stack_size_for(uthread_func_t func);
+
+/*
+ * stack_get_stats - Fill the stack measurement fields of @stats
+ * @stats: Statistics to fill
+ */
+void stack_get_stats(struct uthread_stats *stats);
+
+
+/**
+ * Private hardware counter API
+ */
+
+/*
+ * perf_start - Open the counters for a run
+ *
+ * Return: true if threads are to be counted, false if uthread_perf_start() was
+ * not called or if no counter could be opened
+ */
+bool perf_start(void);
+
+/*
+ * perf_stop - Close the counters at the end of a run
+ */
+void perf_stop(void);
+
+/*
+ * perf_switch - Account the counts since the last switch to a thread
+ * @perf: Counts of the thread being switched out
+ *
+ * To be called with preemption disabled, on every context switch.
+ */
+void perf_switch(struct uthread_perf *perf);
+
+/*
+ * perf_running - Add the counts since the last switch without taking them
+ * @perf: Copy of the counts of the running thread
+ */
+void perf_running(struct uthread_perf *perf);
+
+/*
+ * perf_exit - Add the counts of an exited thread to the report
+ * @name: Name of the thread, empty if unnamed
+ * @func: Entry function of the thread
+ * @perf: Counts of the thread
+ *
+ * To be called with preemption disabled.
+ */
+void perf_exit(const char *name, uthread_func_t func,
+	       const struct uthread_perf *perf);
+
+/*
+ * perf_get_stats - Fill the counter reading fields of @stats
+ * @stats: Statistics to fill
+ */
+void perf_get_stats(struct uthread_stats *stats);
+
 
 /**
  * Private preemption API
@@ -74,7 +496,11 @@ int uthread_ctx_init(uthread_ctx_t *uctx, void *top_of_stack,
  * setup a timer handler that forcefully yields the currently running thread.
  *
  * If @preempt is false, don't start preemption; all the other functions from
- * the preemption API should then be ineffective.
+ * the preemption API are then ineffective, and return without a system call.
+ *
+ * Built with UTHREAD_COOP defined (libuthread-coop.a), the library has no
+ * preemption support at all: @preempt is ignored, and preempt_enable() and
+ * preempt_disable() compile to nothing.
  */
 void preempt_start(bool preempt);
 
@@ -86,6 +512,15 @@ void preempt_start(bool preempt);
  */
 void preempt_stop(void);
 
+#ifdef UTHREAD_COOP
+static inline void preempt_enable(void)
+{
+}
+
+static inline void preempt_disable(void)
+{
+}
+#else
 /*
  * preempt_enable - Enable preemption
  */
@@ -95,6 +530,14 @@ void preempt_enable(void);
  * preempt_disable - Disable preemption
  */
 void preempt_disable(void);
+#endif
+
+/*
+ * preempt_is_handler - Tell whether @pc is the entry point of the handler that
+ *	preempts threads
+ * @pc: Code address
+ */
+bool preempt_is_handler(uintptr_t pc);
 
 
 /**
@@ -114,6 +557,40 @@ struct uthread_tcb;
  */
 struct uthread_tcb *uthread_current(void);
 
+/*
+ * uthread_tcb_id - Get the identifier of a thread, see uthread_self()
+ * @tcb: TCB of the thread
+ */
+size_t uthread_tcb_id(struct uthread_tcb *tcb);
+
+/*
+ * uthread_tcb_name - Get the name of a thread
+ * @tcb: TCB of the thread
+ *
+ * Return: Name of the thread, empty if it wasn't named
+ */
+const char *uthread_tcb_name(struct uthread_tcb *tcb);
+
+/*
+ * uthread_tcb_stack - Get the bounds of a thread's stack
+ * @tcb: TCB of the thread
+ * @low: Lowest address of the stack
+ * @high: Address right above the stack
+ *
+ * Return: 0 in case of success, -1 if the thread doesn't run on a stack of its
+ * own (the thread that called uthread_run(), threads on the shared stack)
+ */
+int uthread_tcb_stack(struct uthread_tcb *tcb, void **low, void **high);
+
+/*
+ * uthread_tcb_shared - Tell whether a thread runs on the shared stack
+ * @tcb: TCB of the thread
+ *
+ * The frames of such a thread are copied away while it doesn't run, so other
+ * threads must not be handed pointers into them.
+ */
+bool uthread_tcb_shared(struct uthread_tcb *tcb);
+
 /*
  * uthread_block - Block currently running thread
  */
@@ -125,4 +602,204 @@ void uthread_block(void);
  */
 void uthread_unblock(struct uthread_tcb *uthread);
 
+/*
+ * uthread_park - Block currently running thread on a wait list
+ * @waiters: Wait list, with a queue handle per thread
+ *
+ * The thread stays blocked until the whole list is made ready with
+ * uthread_unpark_all(). Returns with preemption enabled, like uthread_block().
+ *
+ * Return: -1 in case of memory allocation error, 0 once woken up
+ */
+int uthread_park(queue_t waiters);
+
+/*
+ * uthread_unpark_all - Make all the threads of a wait list ready
+ * @waiters: Wait list filled by uthread_park()
+ *
+ * The list is handed to the scheduling policy in one operation, whatever its
+ * length, and left empty. To be called with preemption disabled, so that the
+ * caller can update the state guarding the list in the same critical section.
+ *
+ * Return: Number of threads made ready
+ */
+size_t uthread_unpark_all(queue_t waiters);
+
+/*
+ * uthread_active_stacks - Get the stacks that may be executing
+ * @stacks: Array receiving the stack segments
+ *
+ * Outside of a context switch only the current thread's stack is executing,
+ * but during a switch the previous thread's stack is still in use.
+ *
+ * Return: Number of stack segments written to @stacks (at most 2)
+ */
+int uthread_active_stacks(void *stacks[2]);
+
+
+/*
+ * uthread_tick - Account a preemption tick to the running thread
+ *
+ * Called by the preemption timer handler. The running thread is preempted if
+ * the scheduling policy says so.
+ */
+void uthread_tick(void);
+
+/*
+ * uthread_yield_point - Let the scheduling policy switch threads
+ *
+ * Called by semaphore operations once done, where the running thread could as
+ * well have been preempted. The running thread yields if the scheduling policy
+ * says so.
+ */
+void uthread_yield_point(void);
+
+/*
+ * uthread_sched_entity - Per-thread data of the scheduling policies
+ */
+struct uthread_sched_entity {
+	unsigned int weight;	/* See uthread_set_weight() */
+	unsigned int budget;	/* Turns left in the current round */
+	queue_handle_t node;	/* Position in the ready queue, while ready */
+	size_t slot;		/* Index in the ready array (seeded random) */
+};
+
+/*
+ * uthread_tcb_sched - Get the scheduling data of a thread
+ * @tcb: TCB of the thread
+ */
+struct uthread_sched_entity *uthread_tcb_sched(struct uthread_tcb *tcb);
+
+
+/**
+ * Private scheduling API
+ */
+
+/*
+ * uthread_sched_ops - Scheduling policy
+ *
+ * A policy owns the threads that are ready to run, and decides which one runs
+ * next. Its operations are called with preemption disabled.
+ */
+struct uthread_sched_ops {
+	/* Set up the policy, return 0 in case of success or -1 */
+	int (*init)(void);
+	/* Tear down the policy, once no thread is ready anymore */
+	void (*destroy)(void);
+	/*
+	 * Make @tcb ready to run, return 0 in case of success or -1. @yielded
+	 * tells whether @tcb was running and gave the processor up (yield or
+	 * preemption), rather than being created or woken up.
+	 */
+	int (*enqueue)(struct uthread_tcb *tcb, bool yielded);
+	/*
+	 * Make all the threads of @threads ready at once, as if woken up, and
+	 * leave @threads empty. Their queue nodes are the ones of @threads,
+	 * which each thread's uthread_sched_entity designates.
+	 */
+	void (*enqueue_all)(queue_t threads);
+	/* Remove and return the next thread to run, or NULL if none is ready */
+	struct uthread_tcb *(*pick_next)(void);
+	/* Take ready thread @tcb out of the ready threads */
+	void (*remove)(struct uthread_tcb *tcb);
+	/* Running thread @tcb is about to block */
+	void (*on_block)(struct uthread_tcb *tcb);
+	/* Preemption tick while @tcb runs, return true to preempt it */
+	bool (*on_tick)(struct uthread_tcb *tcb);
+	/* Yield point reached by @tcb, return true to yield (can be NULL) */
+	bool (*on_yield_point)(struct uthread_tcb *tcb);
+	/* Number of threads ready to run */
+	size_t (*nr_ready)(void);
+};
+
+/*
+ * uthread_sched_get - Get the operations of a scheduling policy
+ * @policy: Policy
+ *
+ * Return: Operations of @policy, or NULL if @policy is invalid
+ */
+const struct uthread_sched_ops *uthread_sched_get(uthread_sched_t policy);
+
+/*
+ * sched_get_stats - Fill the scheduling decision fields of @stats
+ * @stats: Statistics to fill
+ */
+void sched_get_stats(struct uthread_stats *stats);
+
+/**
+ * Private semaphore API
+ */
+
+/*
+ * sem_remote_drain - Apply pending remote semaphore releases
+ *
+ * Must be called from the runtime, never from a foreign thread.
+ */
+void sem_remote_drain(void);
+
+/*
+ * sem_remote_fd - Get the eventfd signaled by remote releases
+ *
+ * Writing to this eventfd wakes up sem_remote_wait().
+ *
+ * Return: File descriptor of the eventfd, or -1 if it couldn't be created
+ */
+int sem_remote_fd(void);
+
+/*
+ * sem_remote_wait - Sleep until a remote semaphore release is posted
+ *
+ * Return: false if no remote release can arrive (no hold is registered), true
+ * once woken up
+ */
+bool sem_remote_wait(void);
+
+
+
+/**
+ * Private offload API
+ */
+
+/*
+ * offload_drain - Unblock the threads whose offloaded calls have completed
+ *
+ * Must be called from the runtime, never from a foreign thread.
+ */
+void offload_drain(void);
+
+/*
+ * offload_stop - Stop the offload pool, waiting for its threads to finish
+ */
+void offload_stop(void);
+
+/*
+ * offload_get_stats - Fill the offload-related fields of @stats
+ * @stats: Statistics to fill
+ */
+void offload_get_stats(struct uthread_stats *stats);
+
+
+
+/**
+ * Private io_uring API
+ */
+
+/*
+ * uring_poll - Submit queued file I/O requests and reap completed ones
+ *
+ * Meant to be called by the idle context once per scheduling round.
+ */
+void uring_poll(void);
+
+/*
+ * uring_stop - Tear down the io_uring instance
+ */
+void uring_stop(void);
+
+/*
+ * uring_get_stats - Fill the file I/O fields of @stats
+ * @stats: Statistics to fill
+ */
+void uring_get_stats(struct uthread_stats *stats);
+
 #endif /* _UTHREAD_PRIVATE_H */
@@ -0,0 +1,90 @@
+#ifndef _UTHREAD_PROBE_H
+#define _UTHREAD_PROBE_H
+
+/*
+ * Static tracing probes
+ *
+ * Like the probes of <sys/sdt.h>, which this header doesn't need, a probe is a
+ * single nop instruction at the probe site, plus a note in the ELF section
+ * .note.stapsdt giving the address of the nop, the provider ("uthread"), the
+ * name of the probe and where to find its arguments. Tracers such as bpftrace,
+ * perf or systemtap read the notes from the binary and turn the nop into a
+ * breakpoint when the probe is attached, e.g.:
+ *
+ *	bpftrace -e 'usdt:./app.x:uthread:switch { @[arg1] = count(); }'
+ *
+ * Nothing else happens at a detached probe: there is no semaphore to test. The
+ * arguments are only handed to the tracer as operands of the nop, so they are
+ * computed anyway, and must be cheap. Every argument is passed as an unsigned
+ * 64-bit value, either a thread id or the address of an object.
+ *
+ * Probes are defined for x86-64 and AArch64, and can be compiled out with
+ * -DUTHREAD_NO_PROBES.
+ *
+ * This header is private to the libuthread.
+ */
+#include <stdint.h>
+
+#if !defined(UTHREAD_NO_PROBES) && (defined(__x86_64__) || defined(__aarch64__))
+
+/* Base address, to correct the addresses of the notes once prelinked */
+#define UTHREAD_PROBE_BASE						\
+	".ifndef _.stapsdt.base\n"					\
+	".pushsection .stapsdt.base,\"aG\",\"progbits\",.stapsdt.base,comdat\n" \
+	".weak _.stapsdt.base\n"					\
+	".hidden _.stapsdt.base\n"					\
+	"_.stapsdt.base: .space 1\n"					\
+	".size _.stapsdt.base, 1\n"					\
+	".popsection\n"							\
+	".endif\n"
+
+/* Note of type 3, the nop at 990, the base, no semaphore, then the strings */
+#define UTHREAD_PROBE(name, args, ...)					\
+	__asm__ __volatile__(						\
+		"990: nop\n"						\
+		".pushsection .note.stapsdt,\"\",\"note\"\n"		\
+		".balign 4\n"						\
+		".4byte 992f-991f, 994f-993f, 3\n"			\
+		"991: .asciz \"stapsdt\"\n"				\
+		"992: .balign 4\n"					\
+		"993: .8byte 990b\n"					\
+		".8byte _.stapsdt.base\n"				\
+		".8byte 0\n"						\
+		".asciz \"uthread\"\n"					\
+		".asciz \"" #name "\"\n"				\
+		".asciz \"" args "\"\n"					\
+		"994: .balign 4\n"					\
+		".popsection\n"						\
+		UTHREAD_PROBE_BASE					\
+		:: __VA_ARGS__)
+
+#define UTHREAD_PROBE_ARG(arg) "nor"((uint64_t)(uintptr_t)(arg))
+
+#define UTHREAD_PROBE1(name, a1)					\
+	UTHREAD_PROBE(name, "8@%0", UTHREAD_PROBE_ARG(a1))
+#define UTHREAD_PROBE2(name, a1, a2)					\
+	UTHREAD_PROBE(name, "8@%0 8@%1", UTHREAD_PROBE_ARG(a1),	\
+		      UTHREAD_PROBE_ARG(a2))
+#define UTHREAD_PROBE3(name, a1, a2, a3)				\
+	UTHREAD_PROBE(name, "8@%0 8@%1 8@%2", UTHREAD_PROBE_ARG(a1),	\
+		      UTHREAD_PROBE_ARG(a2), UTHREAD_PROBE_ARG(a3))
+#define UTHREAD_PROBE4(name, a1, a2, a3, a4)				\
+	UTHREAD_PROBE(name, "8@%0 8@%1 8@%2 8@%3", UTHREAD_PROBE_ARG(a1),\
+		      UTHREAD_PROBE_ARG(a2), UTHREAD_PROBE_ARG(a3),	\
+		      UTHREAD_PROBE_ARG(a4))
+
+#else
+
+/* The arguments are still evaluated, to keep the same warnings */
+#define UTHREAD_PROBE1(name, a1)					\
+	do { (void)(a1); } while (0)
+#define UTHREAD_PROBE2(name, a1, a2)					\
+	do { (void)(a1); (void)(a2); } while (0)
+#define UTHREAD_PROBE3(name, a1, a2, a3)				\
+	do { (void)(a1); (void)(a2); (void)(a3); } while (0)
+#define UTHREAD_PROBE4(name, a1, a2, a3, a4)				\
+	do { (void)(a1); (void)(a2); (void)(a3); (void)(a4); } while (0)
+
+#endif
+
+#endif /* _UTHREAD_PROBE_H */
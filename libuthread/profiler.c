@@ -0,0 +1,345 @@
+#define _GNU_SOURCE		/* dladdr(), pthread_getattr_np(), REG_RIP */
+#include <dlfcn.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/time.h>
+#include <ucontext.h>
+#include <unistd.h>
+
+#include "private.h"
+#include "uthread.h"
+
+/*
+Sampling profiler
+
+A SIGPROF timer, which counts the CPU time of the process, interrupts whatever
+runs. The handler reads the running uthread from the runtime and walks the
+interrupted call stack through its frame pointers, staying within the bounds of
+the thread's stack, so that every sample is attributed to a single uthread even
+though all of them run on the same kernel thread. Samples are appended to a
+preallocated buffer with a single atomic increment, and are only symbolized and
+folded when written out.
+
+The handler masks SIGVTALRM, so that preemption never switches threads in the
+middle of a sample; preemption itself doesn't mask SIGPROF, so the time spent
+in uthreads with preemption disabled is sampled too.
+*/
+
+/* Default sampling frequency, prime so as not to beat with periodic work */
+#define PROFILE_HZ		997
+
+/* Capacity of the sample buffer, and deepest stack recorded */
+#define PROFILE_MAX_SAMPLES	(1 << 16)
+#define PROFILE_MAX_DEPTH	32
+
+/* Size of the cache of resolved symbols, a power of two */
+#define PROFILE_SYMBOLS		1024
+
+#define PROFILE_NAME_MAX	16
+
+#if defined(__x86_64__)
+#define UC_PC(uc)	((uintptr_t)(uc)->uc_mcontext.gregs[REG_RIP])
+#define UC_FP(uc)	((uintptr_t)(uc)->uc_mcontext.gregs[REG_RBP])
+#define UC_SP(uc)	((uintptr_t)(uc)->uc_mcontext.gregs[REG_RSP])
+#elif defined(__aarch64__)
+#define UC_PC(uc)	((uintptr_t)(uc)->uc_mcontext.pc)
+#define UC_FP(uc)	((uintptr_t)(uc)->uc_mcontext.regs[29])
+#define UC_SP(uc)	((uintptr_t)(uc)->uc_mcontext.sp)
+#endif
+
+struct profile_sample {
+	size_t id;			/* Thread that was running */
+	char name[PROFILE_NAME_MAX];
+	unsigned int depth;
+	uintptr_t pcs[PROFILE_MAX_DEPTH];	/* Innermost frame first */
+};
+
+static struct profile_sample *samples;
+static atomic_size_t nr_samples;	/* Samples taken, dropped ones included */
+
+static bool running;
+static pthread_t runtime_thread;
+static uintptr_t main_low, main_high;	/* Stack of the runtime's kernel thread */
+
+static struct sigaction old_action;
+static struct itimerval old_timer;
+
+struct profile_symbol {
+	uintptr_t pc;
+	char name[64];
+};
+
+#if defined(UC_PC)
+/*
+ * Walk the frame pointer chain from @fp, as long as frames stay within
+ * [@low, @high) and go up the stack
+ */
+static unsigned int profile_unwind(uintptr_t *pcs, unsigned int depth,
+				   uintptr_t fp, uintptr_t low, uintptr_t high)
+{
+	while (depth < PROFILE_MAX_DEPTH) {
+		uintptr_t *frame = (uintptr_t *)fp;
+
+		if (fp < low || fp > high - 2 * sizeof(uintptr_t) ||
+		    fp % sizeof(uintptr_t))
+			break;
+		if (!frame[1])
+			break;
+
+		pcs[depth++] = frame[1];
+		if (frame[0] <= fp)
+			break;
+		fp = frame[0];
+	}
+
+	return depth;
+}
+
+static void profile_handler(int signum, siginfo_t *info, void *ucontext)
+{
+	ucontext_t *uc = ucontext;
+	struct uthread_tcb *tcb;
+	struct profile_sample *s;
+	void *low = NULL, *high = NULL;
+	size_t i;
+
+	(void)signum;
+	(void)info;
+
+	/* Offload pool threads and the like aren't running uthreads */
+	if (!pthread_equal(pthread_self(), runtime_thread))
+		return;
+
+	i = atomic_fetch_add_explicit(&nr_samples, 1, memory_order_relaxed);
+	if (i >= PROFILE_MAX_SAMPLES)
+		return;
+	s = &samples[i];
+
+#if defined(__x86_64__)
+	/*
+	 * The timers of both signals are driven by the same CPU time ticks, so
+	 * SIGPROF often arrives together with SIGVTALRM and interrupts the
+	 * preemption handler before its first instruction. Sample the context
+	 * that handler interrupted instead, which the kernel saved in the signal
+	 * frame right above the handler's return address.
+	 */
+	if (preempt_is_handler(UC_PC(uc)))
+		uc = (ucontext_t *)(UC_SP(uc) + sizeof(uintptr_t));
+#endif
+
+	tcb = uthread_current();
+	if (tcb) {
+		s->id = uthread_tcb_id(tcb);
+		strncpy(s->name, uthread_tcb_name(tcb), PROFILE_NAME_MAX - 1);
+		s->name[PROFILE_NAME_MAX - 1] = '\0';
+	} else {
+		s->id = 0;
+		strcpy(s->name, "main");
+	}
+
+	/* Threads on the shared stack only get their innermost frame */
+	if ((!tcb || uthread_tcb_stack(tcb, &low, &high) < 0) && s->id == 0) {
+		low = (void *)main_low;
+		high = (void *)main_high;
+	}
+
+	/*
+	 * Frames only live above the interrupted stack pointer. In the middle
+	 * of a switch, the stack may not match the thread and the walk stops
+	 * right away.
+	 */
+	if ((uintptr_t)low < UC_SP(uc))
+		low = (void *)UC_SP(uc);
+
+	s->pcs[0] = UC_PC(uc);
+	s->depth = 1;
+	if (high)
+		s->depth = profile_unwind(s->pcs, 1, UC_FP(uc),
+					  (uintptr_t)low, (uintptr_t)high);
+}
+#endif
+
+int uthread_profile_start(unsigned int hz)
+{
+#if defined(UC_PC)
+	struct itimerval timer;
+	struct sigaction sa;
+	pthread_attr_t attr;
+	size_t size;
+	void *stack;
+
+	if (running)
+		return -1;
+	if (!hz)
+		hz = PROFILE_HZ;
+
+	if (!samples) {
+		samples = mmap(NULL, PROFILE_MAX_SAMPLES * sizeof(*samples),
+			       PROT_READ | PROT_WRITE,
+			       MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE,
+			       -1, 0);
+		if (samples == MAP_FAILED) {
+			samples = NULL;
+			return -1;
+		}
+	}
+	atomic_store(&nr_samples, 0);
+
+	runtime_thread = pthread_self();
+	if (pthread_getattr_np(runtime_thread, &attr))
+		return -1;
+	pthread_attr_getstack(&attr, &stack, &size);
+	pthread_attr_destroy(&attr);
+	main_low = (uintptr_t)stack;
+	main_high = main_low + size;
+
+	sa.sa_sigaction = profile_handler;
+	sigemptyset(&sa.sa_mask);
+	sigaddset(&sa.sa_mask, SIGVTALRM); // no preemption in the middle of a sample
+	sa.sa_flags = SA_SIGINFO | SA_RESTART;
+	if (sigaction(SIGPROF, &sa, &old_action))
+		return -1;
+
+	timer.it_interval.tv_sec = 0;
+	timer.it_interval.tv_usec = hz > 1000000 ? 1 : 1000000 / hz;
+	timer.it_value = timer.it_interval;
+	if (setitimer(ITIMER_PROF, &timer, &old_timer)) {
+		sigaction(SIGPROF, &old_action, NULL);
+		return -1;
+	}
+
+	running = true;
+
+	return 0;
+#else
+	(void)hz;
+	return -1;
+#endif
+}
+
+void uthread_profile_stop(void)
+{
+	if (!running)
+		return;
+
+	setitimer(ITIMER_PROF, &old_timer, NULL);
+	sigaction(SIGPROF, &old_action, NULL);
+	running = false;
+}
+
+/* Name of the function containing @pc, from the closest dynamic symbol */
+static const char *profile_symbol(struct profile_symbol *cache, uintptr_t pc)
+{
+	struct profile_symbol *sym = &cache[(pc >> 4) % PROFILE_SYMBOLS];
+	Dl_info info;
+
+	if (sym->pc == pc && sym->name[0])
+		return sym->name;
+
+	sym->pc = pc;
+	if (dladdr((void *)pc, &info) && info.dli_sname)
+		snprintf(sym->name, sizeof(sym->name), "%s", info.dli_sname);
+	else
+		snprintf(sym->name, sizeof(sym->name), "0x%lx",
+			 (unsigned long)pc);
+
+	return sym->name;
+}
+
+/* Append @str to @line at @len, replacing the separators of folded stacks */
+static size_t profile_append(char *line, size_t len, size_t cap,
+			     const char *str)
+{
+	for (; *str && len < cap - 1; str++)
+		line[len++] = (*str == ';' || *str == ' ') ? '_' : *str;
+	line[len] = '\0';
+
+	return len;
+}
+
+static int profile_compare(const void *a, const void *b)
+{
+	return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+int uthread_profile_write(int fd, bool by_name)
+{
+	const size_t cap = PROFILE_MAX_DEPTH * 72 + 64;
+	struct profile_symbol *cache;
+	size_t n = atomic_load(&nr_samples);
+	size_t i, j, count;
+	char **lines;
+	int stacks = 0;
+
+	if (n > PROFILE_MAX_SAMPLES)
+		n = PROFILE_MAX_SAMPLES;
+
+	cache = calloc(PROFILE_SYMBOLS, sizeof(*cache));
+	lines = calloc(n ? n : 1, sizeof(*lines));
+	if (!cache || !lines) {
+		free(cache);
+		free(lines);
+		return -1;
+	}
+
+	/* One line per sample, root first */
+	for (i = 0; i < n; i++) {
+		struct profile_sample *s = &samples[i];
+		char root[PROFILE_NAME_MAX + 32];
+		size_t len;
+
+		lines[i] = malloc(cap);
+		if (!lines[i]) {
+			stacks = -1;
+			break;
+		}
+
+		if (by_name)
+			snprintf(root, sizeof(root), "%s",
+				 s->name[0] ? s->name : "uthread");
+		else
+			snprintf(root, sizeof(root), "%s#%zu",
+				 s->name[0] ? s->name : "uthread", s->id);
+		len = profile_append(lines[i], 0, cap, root);
+
+		for (j = s->depth; j-- > 0;) {
+			/* Return addresses point right after the call */
+			uintptr_t pc = j ? s->pcs[j] - 1 : s->pcs[j];
+
+			if (len < cap - 1)
+				lines[i][len++] = ';';
+			len = profile_append(lines[i], len, cap,
+					     profile_symbol(cache, pc));
+		}
+	}
+
+	/* Identical stacks end up next to each other */
+	if (stacks == 0) {
+		qsort(lines, n, sizeof(*lines), profile_compare);
+		for (i = 0; i < n; i += count) {
+			for (count = 1; i + count < n; count++)
+				if (strcmp(lines[i], lines[i + count]))
+					break;
+			if (dprintf(fd, "%s %zu\n", lines[i], count) < 0) {
+				stacks = -1;
+				break;
+			}
+			stacks++;
+		}
+	}
+
+	for (i = 0; i < n; i++)
+		free(lines[i]);
+	free(lines);
+	free(cache);
+
+	return stacks;
+}
@@ -3,6 +3,7 @@
 #include <string.h>
 #include <stdlib.h>  //for malloc()
 
+#include "private.h" //for mem_add()
 #include "queue.h"
 
 /*
@@ -10,15 +11,16 @@ queue_t = "struct queue*" (avoids having to type both things every time)
 **it's a pointer to a struct queue**
 */
 
-struct node {
+struct queue_node {
     void* data;         //pointer for stored data (void because we don't know what kind of data it is)
-    struct node* next;  //pointer to the next node in the queue
+    struct queue_node* next;  //pointer to the next node in the queue
+    struct queue_node* prev;  //pointer to the previous node, so a node can be unlinked in O(1)
 };
 
 struct queue {
 	int size;		   //to keep track of the size of it
-    struct node *head; //the head of the queue
-    struct node *tail; //the tail of the queue
+    struct queue_node *head; //the head of the queue
+    struct queue_node *tail; //the tail of the queue
 };
 
 queue_t queue_create(void)
@@ -44,18 +46,25 @@ int queue_destroy(queue_t queue)
 }
 
 int queue_enqueue(queue_t queue, void *data)
+{
+	return queue_enqueue_handle(queue, data, NULL);
+}
+
+int queue_enqueue_handle(queue_t queue, void *data, queue_handle_t *handle)
 {
 	if(queue == NULL || data == NULL){
 		return -1;
 	}
 
-	struct node* new_node = (struct node*) malloc(sizeof(struct node)); //add new node to heap
+	struct queue_node* new_node = (struct queue_node*) malloc(sizeof(struct queue_node)); //add new node to heap
 	if(new_node == NULL){
 		return -1;
 	}
+	mem_add(MEM_QUEUE_NODES, sizeof(struct queue_node));
 
 	new_node->data = data;
 	new_node->next = NULL;
+	new_node->prev = queue->tail;
 
 	if(queue->size == 0){
 		queue->head = new_node;
@@ -67,6 +76,132 @@ int queue_enqueue(queue_t queue, void *data)
 
 	queue->size++;
 
+	if(handle != NULL){
+		*handle = new_node;
+	}
+
+	return 0;
+}
+
+int queue_push(queue_t queue, void *data)
+{
+	return queue_push_handle(queue, data, NULL);
+}
+
+int queue_push_handle(queue_t queue, void *data, queue_handle_t *handle)
+{
+	if(queue == NULL || data == NULL){
+		return -1;
+	}
+
+	struct queue_node* new_node = (struct queue_node*) malloc(sizeof(struct queue_node));
+	if(new_node == NULL){
+		return -1;
+	}
+	mem_add(MEM_QUEUE_NODES, sizeof(struct queue_node));
+
+	new_node->data = data;
+	new_node->prev = NULL;
+	new_node->next = queue->head;
+
+	if(queue->size == 0){
+		queue->tail = new_node;
+	}
+	else{
+		queue->head->prev = new_node;
+	}
+	queue->head = new_node;
+
+	queue->size++;
+
+	if(handle != NULL){
+		*handle = new_node;
+	}
+
+	return 0;
+}
+
+/*move all the nodes of @other between @prev and @next in @queue*/
+static void queue_splice(queue_t queue, queue_t other, struct queue_node* prev, struct queue_node* next)
+{
+	other->head->prev = prev;
+	other->tail->next = next;
+
+	if(prev != NULL){
+		prev->next = other->head;
+	}
+	else{
+		queue->head = other->head;
+	}
+	if(next != NULL){
+		next->prev = other->tail;
+	}
+	else{
+		queue->tail = other->tail;
+	}
+
+	queue->size += other->size;
+
+	other->size = 0;
+	other->head = NULL;
+	other->tail = NULL;
+}
+
+int queue_concat(queue_t queue, queue_t other)
+{
+	if(queue == NULL || other == NULL || queue == other){
+		return -1;
+	}
+
+	if(other->size > 0){
+		queue_splice(queue, other, queue->tail, NULL);
+	}
+
+	return 0;
+}
+
+int queue_concat_front(queue_t queue, queue_t other)
+{
+	if(queue == NULL || other == NULL || queue == other){
+		return -1;
+	}
+
+	if(other->size > 0){
+		queue_splice(queue, other, NULL, queue->head);
+	}
+
+	return 0;
+}
+
+/*unlink @node from @queue and free it*/
+static void queue_unlink(queue_t queue, struct queue_node* node)
+{
+	if(node->prev != NULL){
+		node->prev->next = node->next;
+	}
+	else{ //deleting the head node
+		queue->head = node->next;
+	}
+
+	if(node->next != NULL){
+		node->next->prev = node->prev;
+	}
+	else{ //deleting the tail node
+		queue->tail = node->prev;
+	}
+
+	mem_sub(MEM_QUEUE_NODES, sizeof(struct queue_node));
+	free(node);
+	queue->size--;
+}
+
+int queue_remove_handle(queue_t queue, queue_handle_t handle)
+{
+	if(queue == NULL || handle == NULL || queue->size == 0){
+		return -1;
+	}
+
+	queue_unlink(queue, handle);
 	return 0;
 }
 
@@ -78,8 +213,11 @@ int queue_dequeue(queue_t queue, void **data)
 
 	*data = queue->head->data;
 
-	struct node* temp = queue->head; //in order to free it later
+	struct queue_node* temp = queue->head; //in order to free it later
 	queue->head = queue->head->next;
+	if(queue->head != NULL){
+		queue->head->prev = NULL;
+	}
 
 	queue->size--;
 	if(queue->size == 0){
@@ -87,6 +225,7 @@ int queue_dequeue(queue_t queue, void **data)
 		queue->tail = NULL;
 	}
 
+	mem_sub(MEM_QUEUE_NODES, sizeof(struct queue_node));
 	free(temp);
 
 	return 0;
@@ -98,33 +237,15 @@ int queue_delete(queue_t queue, void *data)
 		return -1;
 	}
 
-	struct node* iterator = queue->head;
-	struct node* previous = NULL;
+	struct queue_node* iterator = queue->head;
 
 	while(iterator != NULL){ //while there are still nodes
 
 		if(iterator->data == data){
-
-			if(iterator == queue->head){ //if deleting the head node
-				queue->head = iterator->next;
-				if(queue->head == NULL){ //if queue is now empty
-					queue->tail = NULL;
-				}
-			}
-			else{ 
-				previous->next = iterator->next;
-				if(iterator == queue->tail){ //if deleting the tail
-					queue->tail = previous;
-				}
-			}
-
-			free(iterator);
-			queue->size--;
+			queue_unlink(queue, iterator);
 			return 0;
-
 		}
 
-		previous = iterator;
 		iterator = iterator->next;
 	}
 
@@ -138,10 +259,10 @@ int queue_iterate(queue_t queue, queue_func_t func)
 		return -1;
 	}
 
-	struct node* iterator = queue->head;
+	struct queue_node* iterator = queue->head;
 
 	while(iterator != NULL){ //while there are still nodes
-		struct node* next = iterator->next; //in case iterator gets deleted, we still have access to the next node
+		struct queue_node* next = iterator->next; //in case iterator gets deleted, we still have access to the next node
 		func(queue, iterator->data);
 		iterator = next;
 	}
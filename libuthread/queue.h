@@ -12,6 +12,15 @@
  */
 typedef struct queue* queue_t;
 
+/*
+ * queue_handle_t - Queue position handle
+ *
+ * A handle designates the position of an item enqueued with
+ * queue_enqueue_handle(), and allows removing this item in O(1). A handle is
+ * only valid as long as its item is in the queue.
+ */
+typedef struct queue_node* queue_handle_t;
+
 /*
  * queue_create - Allocate an empty queue
  *
@@ -45,6 +54,48 @@ int queue_destroy(queue_t queue);
  */
 int queue_enqueue(queue_t queue, void *data);
 
+/*
+ * queue_enqueue_handle - Enqueue data item and get its position
+ * @queue: Queue in which to enqueue item
+ * @data: Address of data item to enqueue
+ * @handle: Address of handle receiving the position of the item, or NULL
+ *
+ * Enqueue the address contained in @data in the queue @queue, like
+ * queue_enqueue(), and set @handle so that the item can later be removed with
+ * queue_remove_handle().
+ *
+ * Return: -1 if @queue or @data are NULL, or in case of memory allocation error
+ * when enqueing. 0 if @data was successfully enqueued in @queue.
+ */
+int queue_enqueue_handle(queue_t queue, void *data, queue_handle_t *handle);
+
+/*
+ * queue_push - Insert data item at the front
+ * @queue: Queue in which to insert item
+ * @data: Address of data item to insert
+ *
+ * Insert the address @data at the front of queue @queue, so that it is the
+ * next item to be dequeued.
+ *
+ * Return: -1 if @queue or @data are NULL, or in case of memory allocation error
+ * when inserting. 0 if @data was successfully inserted in @queue.
+ */
+int queue_push(queue_t queue, void *data);
+
+/*
+ * queue_push_handle - Insert data item at the front and get its position
+ * @queue: Queue in which to insert item
+ * @data: Address of data item to insert
+ * @handle: Position of the inserted item, can be NULL
+ *
+ * Same as queue_push(), and if @handle is not NULL, it is set to the position
+ * of the inserted item, to be passed to queue_remove_handle().
+ *
+ * Return: -1 if @queue or @data are NULL, or in case of memory allocation error
+ * when inserting. 0 if @data was successfully inserted in @queue.
+ */
+int queue_push_handle(queue_t queue, void *data, queue_handle_t *handle);
+
 /*
  * queue_dequeue - Dequeue data item
  * @queue: Queue in which to dequeue item
@@ -71,6 +122,47 @@ int queue_dequeue(queue_t queue, void **data);
  */
 int queue_delete(queue_t queue, void *data);
 
+/*
+ * queue_remove_handle - Remove data item by position
+ * @queue: Queue in which to remove item
+ * @handle: Position of the item, as set by queue_enqueue_handle()
+ *
+ * Remove the item designated by @handle from queue @queue in O(1). @handle
+ * must designate an item currently in @queue, and becomes invalid.
+ *
+ * Return: -1 if @queue or @handle are NULL, or if @queue is empty. 0 if the
+ * item was removed from @queue.
+ */
+int queue_remove_handle(queue_t queue, queue_handle_t handle);
+
+/*
+ * queue_concat - Move all the items of a queue at the back of another
+ * @queue: Queue receiving the items
+ * @other: Queue whose items are moved
+ *
+ * Move all the items of queue @other, in order, after the newest item of queue
+ * @queue, leaving @other empty. This takes O(1) regardless of the number of
+ * items, and handles of the moved items stay valid, now designating positions
+ * in @queue.
+ *
+ * Return: -1 if @queue or @other are NULL, or if they are the same queue. 0 if
+ * the items were moved.
+ */
+int queue_concat(queue_t queue, queue_t other);
+
+/*
+ * queue_concat_front - Move all the items of a queue at the front of another
+ * @queue: Queue receiving the items
+ * @other: Queue whose items are moved
+ *
+ * Same as queue_concat(), except that the items of @other are moved, in order,
+ * before the oldest item of @queue.
+ *
+ * Return: -1 if @queue or @other are NULL, or if they are the same queue. 0 if
+ * the items were moved.
+ */
+int queue_concat_front(queue_t queue, queue_t other);
+
 /*
  * queue_func_t - Queue callback function type
  * @queue: Queue to which item belongs
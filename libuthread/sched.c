@@ -0,0 +1,593 @@
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "private.h"
+#include "queue.h"
+#include "uthread.h"
+
+/*
+ * Scheduling policies
+ *
+ * Every policy but the seeded random one keeps the ready threads in a single
+ * queue, and only differs in where threads are inserted. Only one policy is in
+ * use at a time, so they share the queue.
+ */
+static queue_t ready;
+
+static int sched_init(void)
+{
+	ready = queue_create();
+
+	return ready ? 0 : -1;
+}
+
+static void sched_destroy(void)
+{
+	queue_destroy(ready);
+	ready = NULL;
+}
+
+static struct uthread_tcb *sched_pick_next(void)
+{
+	struct uthread_tcb *tcb;
+
+	if (queue_dequeue(ready, (void **)&tcb) < 0)
+		return NULL;
+
+	return tcb;
+}
+
+static void sched_remove(struct uthread_tcb *tcb)
+{
+	queue_remove_handle(ready, uthread_tcb_sched(tcb)->node);
+}
+
+/* Insert at the back, or at the front if @front, keeping the position */
+static int sched_insert(struct uthread_tcb *tcb, bool front)
+{
+	queue_handle_t *node = &uthread_tcb_sched(tcb)->node;
+
+	if (front)
+		return queue_push_handle(ready, tcb, node);
+
+	return queue_enqueue_handle(ready, tcb, node);
+}
+
+static void sched_append_all(queue_t threads)
+{
+	queue_concat(ready, threads);
+}
+
+static void sched_on_block(struct uthread_tcb *tcb)
+{
+	(void)tcb;
+}
+
+static bool sched_on_tick(struct uthread_tcb *tcb)
+{
+	(void)tcb;
+
+	return true;
+}
+
+static size_t sched_nr_ready(void)
+{
+	return queue_length(ready);
+}
+
+/*
+ * FIFO: threads run in the order in which they became ready
+ */
+static int fifo_enqueue(struct uthread_tcb *tcb, bool yielded)
+{
+	(void)yielded;
+
+	return sched_insert(tcb, false);
+}
+
+/*
+ * LIFO: threads that were just created or woken up run first, while their data
+ * is still in cache. Threads giving the processor up go to the back, so that
+ * they can't starve the others.
+ */
+static int lifo_enqueue(struct uthread_tcb *tcb, bool yielded)
+{
+	return sched_insert(tcb, !yielded);
+}
+
+static void lifo_enqueue_all(queue_t threads)
+{
+	queue_concat_front(ready, threads);
+}
+
+/*
+ * Weighted round-robin: in each round, a thread runs for as many turns in a
+ * row as its weight. A turn ends when the thread yields or is preempted.
+ */
+static int wrr_enqueue(struct uthread_tcb *tcb, bool yielded)
+{
+	struct uthread_sched_entity *se = uthread_tcb_sched(tcb);
+
+	if (yielded && se->budget > 1) {
+		se->budget--;
+		return sched_insert(tcb, true);
+	}
+
+	se->budget = se->weight;
+	return sched_insert(tcb, false);
+}
+
+static void wrr_on_block(struct uthread_tcb *tcb)
+{
+	struct uthread_sched_entity *se = uthread_tcb_sched(tcb);
+
+	/* Waking up starts a new round, even when woken up with others */
+	se->budget = se->weight;
+}
+
+/*
+ * Seeded random: the next thread is drawn among all the ready ones, a yielding
+ * thread included, so that a yield may or may not switch. Preemption ticks never
+ * switch threads, yield points do instead, when drawn to. Draws come from a
+ * pseudo-random generator restarted from the same seed on every run, so that a
+ * program scheduled only by its own threads makes the same decisions on every
+ * run, whatever the timing.
+ *
+ * Ready threads sit in an array, drawn from by index. Threads made ready all
+ * at once are spliced into a pending queue first, which can't fail, and moved
+ * to the array before the next draw.
+ *
+ * Every draw among two threads or more is a decision, recorded as the index
+ * drawn in a LEB128 byte string, one byte as long as fewer than 128 threads are
+ * ready. A recorded run can be replayed, decisions being read back instead of
+ * drawn.
+ */
+#define RANDOM_INITIAL	64
+
+#define SCHED_LOG_MAGIC	"USCHDLG1"
+
+/* Decisions of a run */
+struct sched_log {
+	uint64_t seed;		/* Generator seed of the run */
+	size_t nr;		/* Number of decisions */
+	unsigned char *bytes;	/* Indices drawn, LEB128 encoded */
+	size_t len, cap;
+	bool valid;		/* Holds a whole run */
+};
+
+/* Layout of a decision log in a file, followed by the encoded decisions */
+struct sched_log_header {
+	char magic[8];
+	uint64_t seed;
+	uint64_t nr;
+	uint64_t len;
+};
+
+static struct uthread_tcb **slots;
+static size_t nr_slots, slots_cap;
+static queue_t pending;
+static bool random_running;
+
+static unsigned long long random_seed = 1;
+static uint64_t random_state;
+
+static struct sched_log recorded, replayed;
+static size_t replay_pos;
+static bool replaying, diverged;
+
+static size_t nr_decisions, nr_divergences;
+
+/* splitmix64 */
+static uint64_t random_next(void)
+{
+	uint64_t z = (random_state += 0x9e3779b97f4a7c15ULL);
+
+	z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+	z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+	return z ^ (z >> 31);
+}
+
+static size_t random_below(size_t n)
+{
+	return (unsigned __int128)random_next() * n >> 64;
+}
+
+static void log_put(struct sched_log *log, unsigned char byte)
+{
+	if (log->len == log->cap) {
+		size_t cap = log->cap ? log->cap * 2 : 4096;
+		unsigned char *bytes = realloc(log->bytes, cap);
+
+		/* A partial log can't be replayed */
+		if (!bytes) {
+			log->valid = false;
+			return;
+		}
+		log->bytes = bytes;
+		log->cap = cap;
+	}
+
+	log->bytes[log->len++] = byte;
+}
+
+static void log_decision(struct sched_log *log, size_t index)
+{
+	if (!log->valid)
+		return;
+
+	log->nr++;
+	do {
+		unsigned char byte = index & 0x7f;
+
+		index >>= 7;
+		log_put(log, index ? byte | 0x80 : byte);
+	} while (index);
+}
+
+/* Read the next decision back, false if the run doesn't follow the log */
+static bool replay_decision(size_t n, size_t *index)
+{
+	size_t value = 0;
+	unsigned int shift = 0;
+	unsigned char byte;
+
+	do {
+		if (replay_pos == replayed.len || shift >= 64)
+			return false;
+		byte = replayed.bytes[replay_pos++];
+		value |= (size_t)(byte & 0x7f) << shift;
+		shift += 7;
+	} while (byte & 0x80);
+
+	if (value >= n)
+		return false;
+
+	*index = value;
+	return true;
+}
+
+static size_t random_decide(size_t n)
+{
+	size_t index;
+
+	if (replaying && !diverged && !replay_decision(n, &index))
+		diverged = true;
+	if (!replaying || diverged)
+		index = random_below(n);
+
+	nr_decisions++;
+	log_decision(&recorded, index);
+
+	return index;
+}
+
+static int slots_reserve(size_t n)
+{
+	size_t cap = slots_cap ? slots_cap : RANDOM_INITIAL;
+	struct uthread_tcb **array;
+
+	if (n <= slots_cap)
+		return 0;
+
+	while (cap < n)
+		cap *= 2;
+	array = realloc(slots, cap * sizeof(*slots));
+	if (!array)
+		return -1;
+
+	mem_add(MEM_QUEUE_NODES, (cap - slots_cap) * sizeof(*slots));
+	slots = array;
+	slots_cap = cap;
+
+	return 0;
+}
+
+static void slots_append(struct uthread_tcb *tcb)
+{
+	uthread_tcb_sched(tcb)->slot = nr_slots;
+	slots[nr_slots++] = tcb;
+}
+
+/* Take slot @i out, moving the last thread in */
+static void slots_take(size_t i)
+{
+	slots[i] = slots[--nr_slots];
+	uthread_tcb_sched(slots[i])->slot = i;
+}
+
+static bool slots_hold(struct uthread_tcb *tcb)
+{
+	size_t i = uthread_tcb_sched(tcb)->slot;
+
+	return i < nr_slots && slots[i] == tcb;
+}
+
+/* Move the pending threads to the array, in the order they were made ready */
+static int pending_migrate(void)
+{
+	struct uthread_tcb *tcb;
+
+	if (slots_reserve(nr_slots + queue_length(pending)) < 0)
+		return -1;
+
+	while (queue_dequeue(pending, (void **)&tcb) == 0)
+		slots_append(tcb);
+
+	return 0;
+}
+
+static int random_init(void)
+{
+	pending = queue_create();
+	if (!pending || slots_reserve(RANDOM_INITIAL) < 0) {
+		queue_destroy(pending);
+		pending = NULL;
+		return -1;
+	}
+
+	random_state = replaying ? replayed.seed : random_seed;
+	recorded.seed = random_state;
+	recorded.nr = 0;
+	recorded.len = 0;
+	recorded.valid = true;
+	replay_pos = 0;
+	diverged = false;
+	random_running = true;
+
+	return 0;
+}
+
+static void random_destroy(void)
+{
+	/* Decisions left over count as a divergence as well */
+	if (replaying && (diverged || replay_pos != replayed.len))
+		nr_divergences++;
+
+	mem_sub(MEM_QUEUE_NODES, slots_cap * sizeof(*slots));
+	free(slots);
+	slots = NULL;
+	nr_slots = slots_cap = 0;
+	queue_destroy(pending);
+	pending = NULL;
+	random_running = false;
+}
+
+static int random_enqueue(struct uthread_tcb *tcb, bool yielded)
+{
+	(void)yielded;
+
+	if (slots_reserve(nr_slots + 1) < 0)
+		return -1;
+
+	slots_append(tcb);
+	return 0;
+}
+
+static void random_enqueue_all(queue_t threads)
+{
+	queue_concat(pending, threads);
+}
+
+static struct uthread_tcb *random_pick_next(void)
+{
+	struct uthread_tcb *tcb;
+	size_t i = 0;
+
+	/* Out of memory: leave the draw for later */
+	if (pending_migrate() < 0 &&
+	    queue_dequeue(pending, (void **)&tcb) == 0)
+		return tcb;
+
+	if (!nr_slots)
+		return NULL;
+
+	if (nr_slots > 1)
+		i = random_decide(nr_slots);
+	tcb = slots[i];
+	slots_take(i);
+
+	return tcb;
+}
+
+static void random_remove(struct uthread_tcb *tcb)
+{
+	if (slots_hold(tcb))
+		slots_take(uthread_tcb_sched(tcb)->slot);
+	else
+		queue_remove_handle(pending, uthread_tcb_sched(tcb)->node);
+}
+
+static bool random_on_tick(struct uthread_tcb *tcb)
+{
+	(void)tcb;
+
+	return false;
+}
+
+/* Yield one time out of two, if there is some other thread to run */
+static bool random_on_yield_point(struct uthread_tcb *tcb)
+{
+	(void)tcb;
+
+	if (!nr_slots && !queue_length(pending))
+		return false;
+
+	return random_decide(2);
+}
+
+static size_t random_nr_ready(void)
+{
+	return nr_slots + queue_length(pending);
+}
+
+int uthread_set_sched_seed(unsigned long long seed)
+{
+	random_seed = seed;
+
+	return 0;
+}
+
+static int write_all(int fd, const void *buf, size_t len)
+{
+	const char *p = buf;
+	ssize_t n;
+
+	while (len) {
+		n = write(fd, p, len);
+		if (n <= 0)
+			return -1;
+		p += n;
+		len -= n;
+	}
+
+	return 0;
+}
+
+static int read_all(int fd, void *buf, size_t len)
+{
+	char *p = buf;
+	ssize_t n;
+
+	while (len) {
+		n = read(fd, p, len);
+		if (n <= 0)
+			return -1;
+		p += n;
+		len -= n;
+	}
+
+	return 0;
+}
+
+int uthread_sched_log_write(int fd)
+{
+	struct sched_log_header header = {
+		.seed = recorded.seed,
+		.nr = recorded.nr,
+		.len = recorded.len,
+	};
+
+	if (random_running || !recorded.valid)
+		return -1;
+
+	memcpy(header.magic, SCHED_LOG_MAGIC, sizeof(header.magic));
+	if (write_all(fd, &header, sizeof(header)) < 0 ||
+	    write_all(fd, recorded.bytes, recorded.len) < 0)
+		return -1;
+
+	return 0;
+}
+
+int uthread_sched_replay(int fd)
+{
+	struct sched_log_header header;
+	unsigned char *bytes;
+
+	if (random_running)
+		return -1;
+
+	if (fd < 0) {
+		free(replayed.bytes);
+		memset(&replayed, 0, sizeof(replayed));
+		replaying = false;
+		return 0;
+	}
+
+	if (read_all(fd, &header, sizeof(header)) < 0 ||
+	    memcmp(header.magic, SCHED_LOG_MAGIC, sizeof(header.magic)) ||
+	    header.len > SIZE_MAX)
+		return -1;
+
+	bytes = malloc(header.len ? header.len : 1);
+	if (!bytes)
+		return -1;
+	if (read_all(fd, bytes, header.len) < 0) {
+		free(bytes);
+		return -1;
+	}
+
+	free(replayed.bytes);
+	replayed.seed = header.seed;
+	replayed.nr = header.nr;
+	replayed.bytes = bytes;
+	replayed.len = replayed.cap = header.len;
+	replayed.valid = true;
+	replaying = true;
+
+	return 0;
+}
+
+void sched_get_stats(struct uthread_stats *stats)
+{
+	stats->sched_decisions = nr_decisions;
+	stats->sched_replay_divergences = nr_divergences;
+}
+
+static const struct uthread_sched_ops fifo_ops = {
+	.init = sched_init,
+	.destroy = sched_destroy,
+	.enqueue = fifo_enqueue,
+	.enqueue_all = sched_append_all,
+	.pick_next = sched_pick_next,
+	.remove = sched_remove,
+	.on_block = sched_on_block,
+	.on_tick = sched_on_tick,
+	.nr_ready = sched_nr_ready,
+};
+
+static const struct uthread_sched_ops lifo_ops = {
+	.init = sched_init,
+	.destroy = sched_destroy,
+	.enqueue = lifo_enqueue,
+	.enqueue_all = lifo_enqueue_all,
+	.pick_next = sched_pick_next,
+	.remove = sched_remove,
+	.on_block = sched_on_block,
+	.on_tick = sched_on_tick,
+	.nr_ready = sched_nr_ready,
+};
+
+static const struct uthread_sched_ops wrr_ops = {
+	.init = sched_init,
+	.destroy = sched_destroy,
+	.enqueue = wrr_enqueue,
+	.enqueue_all = sched_append_all,
+	.pick_next = sched_pick_next,
+	.remove = sched_remove,
+	.on_block = wrr_on_block,
+	.on_tick = sched_on_tick,
+	.nr_ready = sched_nr_ready,
+};
+
+static const struct uthread_sched_ops random_ops = {
+	.init = random_init,
+	.destroy = random_destroy,
+	.enqueue = random_enqueue,
+	.enqueue_all = random_enqueue_all,
+	.pick_next = random_pick_next,
+	.remove = random_remove,
+	.on_block = sched_on_block,
+	.on_tick = random_on_tick,
+	.on_yield_point = random_on_yield_point,
+	.nr_ready = random_nr_ready,
+};
+
+const struct uthread_sched_ops *uthread_sched_get(uthread_sched_t policy)
+{
+	switch (policy) {
+	case UTHREAD_SCHED_FIFO:
+		return &fifo_ops;
+	case UTHREAD_SCHED_LIFO:
+		return &lifo_ops;
+	case UTHREAD_SCHED_WRR:
+		return &wrr_ops;
+	case UTHREAD_SCHED_RANDOM:
+		return &random_ops;
+	}
+
+	return NULL;
+}
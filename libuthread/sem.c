@@ -1,25 +1,352 @@
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
 #include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <time.h>
+#include <unistd.h>
 
 #include "queue.h"
 #include "private.h" //for uthread_current()
+#include "probe.h"
 #include "sem.h"
 
 
+/*usage record of a profiled semaphore, kept after the semaphore is destroyed if it ever blocked*/
+struct sem_prof {
+	struct sem_profile stats;
+	char name[SEM_NAME_MAX];
+	struct sem_prof *prev;		//previous record, in creation order
+	struct sem_prof *next;		//next record, in creation order
+};
+
+/*a blocked sem_down() or sem_down_any() call, on the stack of its thread or, see wait_alloc(), on the heap*/
+struct sem_wait {
+	struct uthread_tcb *tcb;
+	sem_t *sems;			//semaphores waited on
+	struct sem_slot *slots;		//registration in the blocked queue of each
+	size_t n;
+	size_t woken;			//index of the semaphore that woke it up
+};
+
+/*entry of a blocked queue*/
+struct sem_slot {
+	struct sem_wait *wait;
+	queue_handle_t node;		//position in the blocked queue
+};
+
+/*registrations of sem_down_any() that live on the stack*/
+#define SEM_ANY_SLOTS 8
+
+/*
+wait of a thread on the shared stack, whose frames are copied away while it is
+blocked: the wait, its slots and the semaphores waited on go to the heap
+*/
+static struct sem_wait *wait_alloc(sem_t *sems, size_t n)
+{
+	struct sem_wait *wait = malloc(sizeof(*wait) + n * sizeof(struct sem_slot) +
+				       n * sizeof(sem_t));
+	if(wait == NULL){
+		return NULL;
+	}
+
+	wait->slots = (struct sem_slot *)(wait + 1);
+	wait->sems = (sem_t *)(wait->slots + n);
+	memcpy(wait->sems, sems, n * sizeof(sem_t));
+	wait->n = n;
+
+	return wait;
+}
+
 struct semaphore {
 	int count;
-	struct queue *blocked_queue;
+	struct queue *blocked_queue;	//of struct sem_slot
+	struct sem_prof *prof;		//NULL unless profiling was enabled
+
+	/*remote posts, made by threads outside of the runtime*/
+	atomic_size_t remote_ups;	//posts not applied yet
+	atomic_bool in_inbox;		//whether the semaphore is linked in the inbox
+	struct semaphore *inbox_next;
 };
 
+/*
+Remote posts
+
+sem_up_remote() can't touch the blocked queues, so it only counts the post in
+the semaphore and links the semaphore in a lock-free inbox (a stack that the
+runtime empties in one go). The runtime applies the posts with regular sem_up()
+calls at scheduling points, and sleeps on an eventfd when it has nothing to run.
+*/
+static _Atomic(struct semaphore *) inbox;
+static atomic_int remote_holds;		//foreign threads that may still post
+static atomic_bool runtime_sleeping;	//whether the eventfd must be signaled
+static int remote_fd = -1;
+static pthread_once_t remote_once = PTHREAD_ONCE_INIT;
+
+static void remote_init(void)
+{
+	remote_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+}
+
+static void remote_kick(void)
+{
+	uint64_t one = 1;
+
+	if(atomic_load(&runtime_sleeping)){
+		pthread_once(&remote_once, remote_init);
+		if(write(remote_fd, &one, sizeof(one)) < 0){
+			//counter saturated, the runtime will wake up anyway
+		}
+	}
+}
+
+/*
+Contention profiling
+
+Every profiled semaphore gets a record, linked in a list that is only walked to
+print the report. Records are only updated from the runtime, like the rest of
+the semaphore. Unprofiled semaphores have no record, so the only cost of the
+profiler when it is not in use is a test of the record pointer. The record of a
+semaphore that never blocked a thread has nothing to report, so it is freed with
+its semaphore: programs that keep creating short-lived semaphores don't grow the
+list without bound.
+*/
+static bool profiling;
+static struct sem_prof *profiles;
+static struct sem_prof *profiles_last;
+static size_t profiles_len;
+static size_t report_top;
+
+static unsigned long long prof_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static struct sem_prof *prof_create(void)
+{
+	struct sem_prof *prof = calloc(1, sizeof(*prof));
+	if(prof == NULL){
+		return NULL; //the semaphore just goes unprofiled
+	}
+
+	prof->prev = profiles_last;
+	if(profiles_last != NULL){
+		profiles_last->next = prof;
+	}else{
+		profiles = prof;
+	}
+	profiles_last = prof;
+	profiles_len++;
+
+	return prof;
+}
+
+static void prof_destroy(struct sem_prof *prof)
+{
+	if(prof->stats.peak_blocked > 0){
+		return; //kept for the report
+	}
+
+	if(prof->prev != NULL){
+		prof->prev->next = prof->next;
+	}else{
+		profiles = prof->next;
+	}
+	if(prof->next != NULL){
+		prof->next->prev = prof->prev;
+	}else{
+		profiles_last = prof->prev;
+	}
+	profiles_len--;
+
+	free(prof);
+}
+
+static void prof_blocked(struct semaphore *sem)
+{
+	size_t len = queue_length(sem->blocked_queue);
+
+	if(len > sem->prof->stats.peak_blocked){
+		sem->prof->stats.peak_blocked = len;
+	}
+}
+
+static void prof_down(struct sem_prof *prof, unsigned long long blocked_at)
+{
+	struct sem_profile *stats = &prof->stats;
+
+	stats->downs++;
+	if(blocked_at == 0){
+		return; //got the resource right away
+	}
+
+	unsigned long long wait = prof_now() - blocked_at;
+	unsigned long long us = wait / 1000;
+	size_t bucket = us ? 64 - __builtin_clzll(us) : 0; //first power of two above
+
+	if(bucket >= SEM_PROFILE_BUCKETS){
+		bucket = SEM_PROFILE_BUCKETS - 1;
+	}
+
+	stats->blocked_downs++;
+	stats->wait_ns += wait;
+	if(wait > stats->max_wait_ns){
+		stats->max_wait_ns = wait;
+	}
+	stats->wait_hist[bucket]++;
+}
+
+//most contended first: longest total wait, then most blocked downs
+static int prof_compare(const void *a, const void *b)
+{
+	const struct sem_profile *x = &(*(struct sem_prof *const *)a)->stats;
+	const struct sem_profile *y = &(*(struct sem_prof *const *)b)->stats;
+
+	if(x->wait_ns != y->wait_ns){
+		return x->wait_ns < y->wait_ns ? 1 : -1;
+	}
+	if(x->blocked_downs != y->blocked_downs){
+		return x->blocked_downs < y->blocked_downs ? 1 : -1;
+	}
+	return 0;
+}
+
+static void prof_report_at_exit(void)
+{
+	sem_profile_report(report_top);
+}
+
+int sem_profile_start(size_t top_n)
+{
+	static bool registered;
+
+	if(!registered && top_n > 0){
+		if(atexit(prof_report_at_exit) != 0){
+			return -1;
+		}
+		registered = true;
+	}
+
+	report_top = top_n;
+	profiling = true;
+
+	return 0;
+}
+
+void sem_profile_report(size_t top_n)
+{
+	struct sem_prof **sorted;
+	struct sem_prof *prof;
+	size_t i = 0, j;
+
+	if(profiles_len == 0 || top_n == 0){
+		return;
+	}
+
+	sorted = malloc(profiles_len * sizeof(*sorted));
+	if(sorted == NULL){
+		return;
+	}
+	for(prof = profiles; prof != NULL; prof = prof->next){
+		sorted[i++] = prof;
+	}
+	qsort(sorted, profiles_len, sizeof(*sorted), prof_compare);
+	if(top_n > profiles_len){
+		top_n = profiles_len;
+	}
+
+	fprintf(stderr, "semaphore contention, top %zu of %zu:\n",
+		top_n, profiles_len);
+	fprintf(stderr, "%-20s %10s %10s %10s %6s %12s %12s\n", "semaphore",
+		"downs", "ups", "blocked", "peak", "wait ms", "max wait us");
+
+	for(i = 0; i < top_n; i++){
+		const struct sem_profile *stats = &sorted[i]->stats;
+		char anon[32];
+		const char *name = sorted[i]->name;
+
+		if(name[0] == '\0'){
+			snprintf(anon, sizeof(anon), "#%zu", i);
+			name = anon;
+		}
+
+		fprintf(stderr, "%-20s %10zu %10zu %10zu %6zu %12.3f %12.1f\n",
+			name, stats->downs, stats->ups, stats->blocked_downs,
+			stats->peak_blocked, stats->wait_ns / 1e6,
+			stats->max_wait_ns / 1e3);
+
+		if(stats->blocked_downs == 0){
+			continue;
+		}
+		fprintf(stderr, "%-20s", "  waits");
+		for(j = 0; j < SEM_PROFILE_BUCKETS; j++){
+			if(stats->wait_hist[j] == 0){
+				continue;
+			}
+			if(j == SEM_PROFILE_BUCKETS - 1){
+				fprintf(stderr, " >=%lluus:%zu", 1ULL << (j - 1),
+					stats->wait_hist[j]);
+			}else{
+				fprintf(stderr, " <%lluus:%zu", 1ULL << j,
+					stats->wait_hist[j]);
+			}
+		}
+		fprintf(stderr, "\n");
+	}
+
+	free(sorted);
+}
+
+int sem_set_name(sem_t sem, const char *name)
+{
+	if(sem == NULL || name == NULL || sem->prof == NULL){
+		return -1; //the label would be dropped
+	}
+
+	strncpy(sem->prof->name, name, SEM_NAME_MAX - 1);
+
+	return 0;
+}
+
+int sem_get_profile(sem_t sem, struct sem_profile *profile)
+{
+	if(sem == NULL || profile == NULL || sem->prof == NULL){
+		return -1;
+	}
+
+	*profile = sem->prof->stats;
+
+	return 0;
+}
+
 sem_t sem_create(size_t count)
 {
+	preempt_disable(); //the allocator isn't reentrant
+
 	sem_t Semaphore = (sem_t) malloc(sizeof(struct semaphore)); 
 	if(Semaphore == NULL){ //memory allocation error
+		preempt_enable();
 		return NULL;
 	}
+	mem_add(MEM_SEMAPHORES, sizeof(struct semaphore));
 
 	Semaphore->count = count;
 	Semaphore->blocked_queue = queue_create();
+	atomic_init(&Semaphore->remote_ups, 0);
+	atomic_init(&Semaphore->in_inbox, false);
+	Semaphore->inbox_next = NULL;
+	Semaphore->prof = profiling ? prof_create() : NULL;
+
+	preempt_enable();
 
 	return Semaphore;
 }
@@ -34,6 +361,10 @@ int sem_destroy(sem_t sem)
 	preempt_disable();
 
 	if(queue_destroy(sem->blocked_queue) == 0){ //if the queue is destroyed properly
+		if(sem->prof != NULL){
+			prof_destroy(sem->prof);
+		}
+		mem_sub(MEM_SEMAPHORES, sizeof(struct semaphore));
 		free(sem);
 		preempt_enable();
 		return 0;
@@ -53,20 +384,151 @@ int sem_down(sem_t sem)
 
 	preempt_disable();
 
+	unsigned long long blocked_at = 0;
+	struct sem_slot slot;
+	struct sem_wait on_stack = { .sems = &sem, .slots = &slot, .n = 1 };
+	struct sem_wait *wait = &on_stack;
+
 	/*fix for the corner case*/
 	while (sem->count == 0){  //keep checking until a resource is available (the blocked thread resumes control here when switched back)
-        struct uthread_tcb *current_thread = uthread_current(); // find the current thread
-        queue_enqueue(sem->blocked_queue, current_thread);      // add the current thread to our blocked thread
+        if(wait == &on_stack && uthread_tcb_shared(uthread_current())){
+            wait = wait_alloc(&sem, 1);
+            if(wait == NULL){
+                preempt_enable();
+                return -1;
+            }
+        }
+        wait->tcb = uthread_current(); // find the current thread
+        wait->slots[0].wait = wait;
+        queue_enqueue_handle(sem->blocked_queue, &wait->slots[0], &wait->slots[0].node); // add the current thread to our blocked thread
+        if(sem->prof != NULL){
+            if(blocked_at == 0){
+                blocked_at = prof_now();
+            }
+            prof_blocked(sem);
+        }
+        UTHREAD_PROBE2(sem_down_block, uthread_tcb_id(wait->tcb), sem);
         uthread_block();										// block the current thread (from the private API) & yields
+        preempt_disable(); //uthread_block() enabled it
     }
 
 	sem->count--;  //finally take the resource once it's available
 
+	if(sem->prof != NULL){
+		prof_down(sem->prof, blocked_at);
+	}
+
+	if(wait != &on_stack){
+		free(wait); //the allocator isn't reentrant
+	}
+
 	preempt_enable();
 
+    uthread_yield_point();
+
     return 0;
 }
 
+/*take the first available semaphore of @sems, starting with @first*/
+static ssize_t sem_take_any(sem_t *sems, size_t n, size_t first)
+{
+	for(size_t j = 0; j < n; j++){
+		size_t i = (first + j) % n;
+
+		if(sems[i]->count > 0){
+			sems[i]->count--;
+			return i;
+		}
+	}
+
+	return -1;
+}
+
+ssize_t sem_down_any(sem_t *sems, size_t n)
+{
+	if(sems == NULL || n == 0){
+		return -1;
+	}
+	for(size_t i = 0; i < n; i++){
+		if(sems[i] == NULL){
+			return -1;
+		}
+	}
+
+	struct sem_slot stack_slots[SEM_ANY_SLOTS];
+	struct sem_wait on_stack = { .sems = sems, .slots = stack_slots, .n = n };
+	struct sem_wait *wait = &on_stack;
+	struct sem_slot *slots = stack_slots;
+	unsigned long long blocked_at = 0;
+	bool profiled = false;
+
+	preempt_disable();
+
+	ssize_t taken = sem_take_any(sems, n, 0);
+
+	if(taken < 0 && uthread_tcb_shared(uthread_current())){
+		wait = wait_alloc(sems, n);
+		if(wait == NULL){
+			preempt_enable();
+			return -1;
+		}
+		sems = wait->sems;
+		slots = wait->slots;
+	}
+	else if(taken < 0 && n > SEM_ANY_SLOTS){
+		slots = malloc(n * sizeof(*slots));
+		if(slots == NULL){
+			preempt_enable();
+			return -1;
+		}
+		on_stack.slots = slots;
+	}
+
+	while(taken < 0){
+		wait->tcb = uthread_current();
+		for(size_t i = 0; i < n; i++){
+			slots[i].wait = wait;
+			if(queue_enqueue_handle(sems[i]->blocked_queue, &slots[i], &slots[i].node) < 0){
+				while(i-- > 0){
+					queue_remove_handle(sems[i]->blocked_queue, slots[i].node);
+				}
+				taken = -1;
+				goto out;
+			}
+			if(sems[i]->prof != NULL){
+				prof_blocked(sems[i]);
+				profiled = true;
+			}
+		}
+		if(profiled && blocked_at == 0){
+			blocked_at = prof_now();
+		}
+
+		UTHREAD_PROBE3(sem_down_any_block, uthread_tcb_id(wait->tcb), sems, n);
+		uthread_block(); //sem_up() withdraws us from all the blocked queues
+		preempt_disable(); //uthread_block() enabled it
+
+		//prefer the semaphore that woke us up, another thread may have taken it
+		taken = sem_take_any(sems, n, wait->woken);
+	}
+
+	if(sems[taken]->prof != NULL){
+		prof_down(sems[taken]->prof, blocked_at);
+	}
+
+out:
+	if(wait != &on_stack){
+		free(wait); //the allocator isn't reentrant
+	}
+	else if(slots != stack_slots){
+		free(slots);
+	}
+
+	preempt_enable();
+
+	return taken;
+}
+
 int sem_up(sem_t sem)
 {
 
@@ -77,15 +539,122 @@ int sem_up(sem_t sem)
 	preempt_disable();
 	sem->count++;
 
+	if(sem->prof != NULL){
+		sem->prof->stats.ups++;
+	}
+
 	if(queue_length(sem->blocked_queue) > 0){ //if there is a thread in our blocked queue
-		struct uthread_tcb *thread_to_be_unblocked;
-		queue_dequeue(sem->blocked_queue, (void**)&thread_to_be_unblocked); //dequeue the oldest thread
+		struct sem_slot *slot;
+		queue_dequeue(sem->blocked_queue, (void**)&slot); //dequeue the oldest thread
+
+		struct sem_wait *wait = slot->wait;
+		wait->woken = slot - wait->slots;
 
-		uthread_unblock(thread_to_be_unblocked);
+		//withdraw from the other semaphores of a sem_down_any()
+		for(size_t i = 0; i < wait->n; i++){
+			if(i != wait->woken){
+				queue_remove_handle(wait->sems[i]->blocked_queue, wait->slots[i].node);
+			}
+		}
+
+		UTHREAD_PROBE3(sem_up_wake, uthread_tcb_id(wait->tcb), sem, uthread_self());
+		uthread_unblock(wait->tcb);
 	}
 
 	preempt_enable();
 
+    uthread_yield_point(); // the woken thread may run right away
+
 	return 0;
 }
 
+
+int sem_up_remote(sem_t sem)
+{
+	if(sem == NULL){
+		return -1;
+	}
+
+	atomic_fetch_add(&sem->remote_ups, 1);
+
+	if(!atomic_exchange(&sem->in_inbox, true)){ //link it, unless already waiting in the inbox
+		struct semaphore *head = atomic_load(&inbox);
+		do{
+			sem->inbox_next = head;
+		}while(!atomic_compare_exchange_weak(&inbox, &head, sem));
+	}
+
+	remote_kick();
+
+	return 0;
+}
+
+void sem_remote_hold(void)
+{
+	atomic_fetch_add(&remote_holds, 1);
+}
+
+void sem_remote_release(void)
+{
+	atomic_fetch_sub(&remote_holds, 1);
+	remote_kick(); //the runtime may be waiting for this
+}
+
+void sem_remote_drain(void)
+{
+	if(atomic_load_explicit(&inbox, memory_order_relaxed) == NULL){
+		return; //fast path, nothing was posted
+	}
+
+	struct semaphore *sem = atomic_exchange(&inbox, NULL);
+
+	while(sem != NULL){
+		struct semaphore *next = sem->inbox_next;
+
+		//unlink before collecting the posts, so later posts link it again
+		atomic_store(&sem->in_inbox, false);
+		size_t ups = atomic_exchange(&sem->remote_ups, 0);
+
+		while(ups-- > 0){
+			sem_up(sem);
+		}
+		sem = next;
+	}
+}
+
+int sem_remote_fd(void)
+{
+	pthread_once(&remote_once, remote_init);
+	return remote_fd;
+}
+
+bool sem_remote_wait(void)
+{
+	if(atomic_load(&remote_holds) == 0){
+		return false;
+	}
+
+	pthread_once(&remote_once, remote_init);
+	if(remote_fd < 0){
+		return false;
+	}
+
+	atomic_store(&runtime_sleeping, true);
+
+	//check again once remote threads are bound to signal us
+	if(atomic_load(&inbox) == NULL && atomic_load(&remote_holds) > 0){
+		struct pollfd pfd = { .fd = remote_fd, .events = POLLIN };
+		while(poll(&pfd, 1, -1) < 0 && errno == EINTR){
+			//interrupted, wait again
+		}
+	}
+
+	uint64_t value;
+	if(read(remote_fd, &value, sizeof(value)) < 0){
+		//nothing to consume
+	}
+
+	atomic_store(&runtime_sleeping, false);
+
+	return true;
+}
@@ -50,6 +50,24 @@ int sem_destroy(sem_t sem);
  */
 int sem_down(sem_t sem);
 
+/*
+ * sem_down_any - Take any of several semaphores
+ * @sems: Array of @n semaphores
+ * @n: Number of semaphores
+ *
+ * Take a resource from the first available semaphore of @sems, in array order.
+ *
+ * If none is available, the caller thread is blocked on all of them at once
+ * until one becomes available. The release that wakes the thread up withdraws
+ * it from the other semaphores, so that a thread only ever takes one resource
+ * per call.
+ *
+ * Return: -1 if @sems is NULL, @n is 0, one of the semaphores is NULL, or in
+ * case of memory allocation error. Otherwise, index in @sems of the semaphore
+ * that was taken.
+ */
+ssize_t sem_down_any(sem_t *sems, size_t n);
+
 /*
  * sem_up - Release a semaphore
  * @sem: Semaphore to release
@@ -64,4 +82,111 @@ int sem_down(sem_t sem);
  */
 int sem_up(sem_t sem);
 
+/*
+ * sem_up_remote - Release a semaphore from outside of the runtime
+ * @sem: Semaphore to release
+ *
+ * Release a resource to semaphore @sem, like sem_up(), but from any kernel
+ * thread, e.g. a pthread running outside of the uthread library. This function
+ * is thread-safe and lock-free.
+ *
+ * The release is applied by the runtime at its next scheduling point, or right
+ * away if the runtime is sleeping because it has no thread to run (see
+ * sem_remote_hold()).
+ *
+ * Return: -1 if @sem is NULL. 0 if the release was successfully posted.
+ */
+int sem_up_remote(sem_t sem);
+
+/*
+ * sem_remote_hold - Announce future remote releases
+ *
+ * When no thread is ready to run, the runtime normally returns from
+ * uthread_run(). As long as at least one hold is registered, it instead sleeps
+ * until a remote release arrives. A thread meant to call sem_up_remote() should
+ * register a hold before its first release, and drop it with
+ * sem_remote_release() after its last one. This function is thread-safe.
+ */
+void sem_remote_hold(void);
+
+/*
+ * sem_remote_release - Drop a hold registered with sem_remote_hold()
+ *
+ * This function is thread-safe.
+ */
+void sem_remote_release(void);
+
+/*
+ * Contention profiling
+ *
+ * When enabled, every semaphore created afterwards records how it is used, so
+ * that the semaphore stalling a pipeline can be told apart from the others.
+ * The profiles of semaphores that blocked threads outlive their semaphore, and
+ * are reported at exit.
+ */
+
+/* Number of buckets of the wait-time histograms */
+#define SEM_PROFILE_BUCKETS 16
+
+/* Maximum length of a semaphore label, terminating null byte included */
+#define SEM_NAME_MAX 32
+
+/*
+ * sem_profile - Usage record of a semaphore
+ *
+ * Bucket i of @wait_hist counts the blocked downs that waited less than 2^i
+ * microseconds (the last bucket also counts every longer wait).
+ */
+struct sem_profile {
+	size_t downs;			/* Calls to sem_down() */
+	size_t ups;			/* Calls to sem_up(), remote ones included */
+	size_t blocked_downs;		/* Downs that had to block */
+	size_t peak_blocked;		/* Longest waiting list */
+	unsigned long long wait_ns;	/* Total time spent blocked */
+	unsigned long long max_wait_ns;	/* Longest time spent blocked */
+	size_t wait_hist[SEM_PROFILE_BUCKETS];
+};
+
+/*
+ * sem_profile_start - Enable contention profiling
+ * @top_n: Number of semaphores listed in the report printed at exit, or 0 for
+ *	no report
+ *
+ * Only semaphores created after this call are profiled. At exit, the @top_n
+ * semaphores that kept threads blocked the longest are reported on stderr.
+ * When profiling is not enabled, semaphores only pay for one test of a null
+ * pointer per operation.
+ *
+ * Return: 0 in case of success, -1 if the report couldn't be registered
+ */
+int sem_profile_start(size_t top_n);
+
+/*
+ * sem_profile_report - Print the contention report now
+ * @top_n: Number of semaphores to list
+ */
+void sem_profile_report(size_t top_n);
+
+/*
+ * sem_set_name - Label a semaphore
+ * @sem: Semaphore to label
+ * @name: Label, truncated to SEM_NAME_MAX - 1 characters
+ *
+ * The label identifies @sem in the contention report, so it is only kept if
+ * @sem is profiled: name semaphores created after sem_profile_start().
+ *
+ * Return: -1 if @sem or @name is NULL, or if @sem isn't profiled. 0 otherwise.
+ */
+int sem_set_name(sem_t sem, const char *name);
+
+/*
+ * sem_get_profile - Get the usage record of a semaphore
+ * @sem: Semaphore to query
+ * @profile: Record to fill
+ *
+ * Return: -1 if @sem or @profile is NULL, or if @sem isn't profiled. 0
+ * otherwise.
+ */
+int sem_get_profile(sem_t sem, struct sem_profile *profile);
+
 #endif /* _SEMAPHORE_H */
@@ -0,0 +1,193 @@
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "private.h"
+
+/*
+ * Stack measurement
+ *
+ * Painted stacks are filled with a known byte before their thread first runs.
+ * The lowest word that doesn't hold it anymore is the deepest the thread ever
+ * went, its high-water mark. Pages released while a thread is blocked read
+ * back as zeroes, which are taken as untouched below the highest such page.
+ *
+ * Peak usages are remembered per entry function, in an open-addressed hash
+ * table, so that later threads of the same function get a stack sized after
+ * what it took.
+ */
+#define STACK_PAINT		0x5a
+#define STACK_PAINT_WORD	0x5a5a5a5a5a5a5a5aULL
+
+/* Bytes right below a switched-out thread's stack pointer kept resident */
+#define STACK_TRIM_SLACK	512
+
+/*
+ * Room left on top of one and a half times the peak usage of a function for
+ * signal handlers (preemption, profiler), which run on the stack of the
+ * interrupted thread
+ */
+#define STACK_SIGNAL_RESERVE	(8 * 1024)
+
+/* Initial number of slots of the table of peak usages */
+#define STACK_TABLE_INITIAL	64
+
+struct stack_entry {
+	uthread_func_t func;	/* NULL for a free slot */
+	size_t peak;		/* Highest usage measured, in bytes */
+};
+
+static struct stack_entry *table;
+static size_t table_size;
+static size_t table_used;
+
+static size_t measured;
+static size_t peak_max;
+static size_t peak_total;
+static size_t trim_events;
+static size_t trim_bytes;
+
+void stack_paint(void *low, void *high)
+{
+	memset(low, STACK_PAINT, (char *)high - (char *)low);
+}
+
+size_t stack_peak(void *low, void *high, void *clean)
+{
+	uintptr_t p = ((uintptr_t)low + 7) & ~(uintptr_t)7;
+	const uint64_t *w;
+
+	for (w = (const uint64_t *)p; (void *)w < high; w++) {
+		if (*w == STACK_PAINT_WORD)
+			continue;
+		if (*w == 0 && (const void *)w < clean)
+			continue;
+		break;
+	}
+
+	return (char *)high - (char *)w;
+}
+
+void *stack_trim(void *low, void *sp)
+{
+	uintptr_t page = sysconf(_SC_PAGESIZE);
+	uintptr_t start = ((uintptr_t)low + page - 1) & ~(page - 1);
+	uintptr_t end = ((uintptr_t)sp - STACK_TRIM_SLACK) & ~(page - 1);
+
+	if ((uintptr_t)sp < STACK_TRIM_SLACK || end <= start)
+		return NULL;
+	if (madvise((void *)start, end - start, MADV_DONTNEED))
+		return NULL;
+
+	trim_events++;
+	trim_bytes += end - start;
+
+	return (void *)end;
+}
+
+static size_t slot_of(uthread_func_t func, size_t size)
+{
+	return ((uintptr_t)func >> 4) * 0x9e3779b97f4a7c15ULL & (size - 1);
+}
+
+static struct stack_entry *table_find(uthread_func_t func)
+{
+	size_t i;
+
+	if (!table)
+		return NULL;
+
+	for (i = slot_of(func, table_size); table[i].func;
+	     i = (i + 1) & (table_size - 1))
+		if (table[i].func == func)
+			return &table[i];
+
+	return NULL;
+}
+
+/* Keep the table at most half full */
+static int table_grow(void)
+{
+	size_t size = table_size ? table_size * 2 : STACK_TABLE_INITIAL;
+	struct stack_entry *slots = calloc(size, sizeof(*slots));
+	size_t i, j;
+
+	if (!slots)
+		return -1;
+
+	for (i = 0; i < table_size; i++) {
+		if (!table[i].func)
+			continue;
+		for (j = slot_of(table[i].func, size); slots[j].func;
+		     j = (j + 1) & (size - 1))
+			;
+		slots[j] = table[i];
+	}
+
+	free(table);
+	table = slots;
+	table_size = size;
+
+	return 0;
+}
+
+static void table_learn(uthread_func_t func, size_t peak)
+{
+	struct stack_entry *entry = table_find(func);
+	size_t i;
+
+	if (entry) {
+		if (peak > entry->peak)
+			entry->peak = peak;
+		return;
+	}
+
+	if ((table_used + 1) * 2 > table_size && table_grow() < 0)
+		return;
+
+	for (i = slot_of(func, table_size); table[i].func;
+	     i = (i + 1) & (table_size - 1))
+		;
+	table[i].func = func;
+	table[i].peak = peak;
+	table_used++;
+}
+
+void stack_exit(uthread_func_t func, size_t peak, size_t size)
+{
+	measured++;
+	peak_total += peak;
+	if (peak > peak_max)
+		peak_max = peak;
+
+	/* The whole stack was used, it may well have needed more */
+	if (peak >= size)
+		peak = 2 * size;
+
+	table_learn(func, peak);
+}
+
+size_t stack_size_for(uthread_func_t func)
+{
+	struct stack_entry *entry;
+	size_t size = 0;
+
+	entry = table_find(func);
+	if (entry)
+		size = entry->peak + entry->peak / 2 + STACK_SIGNAL_RESERVE;
+
+	return size;
+}
+
+void stack_get_stats(struct uthread_stats *stats)
+{
+	stats->stack_measured = measured;
+	stats->stack_peak_max = peak_max;
+	stats->stack_peak_total = peak_total;
+	stats->stack_trim_events = trim_events;
+	stats->stack_trim_bytes = trim_bytes;
+}
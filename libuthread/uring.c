@@ -0,0 +1,444 @@
+#include <errno.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <linux/io_uring.h>
+
+#include "private.h"
+#include "queue.h"
+#include "sem.h"
+#include "uthread.h"
+
+/*
+File I/O through io_uring
+
+uthread_pread()/uthread_pwrite()/uthread_fsync() queue a request in the
+runtime's submission ring and block the calling thread. Requests are only
+submitted to the kernel by the idle context, once per scheduling round, so
+that all the threads blocking in the same round share a single io_uring_enter()
+system call. The idle context also reaps completions and unblocks the callers.
+The ring signals completions on the remote-release eventfd, so the idle
+context can sleep while only I/O is in flight.
+
+A request is only queued once both rings have room for it: the submission ring
+must not be full, and no more requests may be in flight than the completion
+ring holds. Callers finding no room park until the idle context reaps or
+submits something.
+
+When io_uring can't be set up, or the kernel lacks an operation, the calls are
+offloaded to the offload pool. IORING_OP_READ and IORING_OP_WRITE only came with
+Linux 5.6, a year after io_uring, so the operations are probed at setup.
+*/
+
+/* Number of entries of the submission ring */
+#define UTHREAD_URING_ENTRIES 256
+
+struct uring_req {
+	struct uthread_tcb *caller;
+	int res;
+	bool done;
+};
+
+static int ring_fd = -1;
+static bool ring_broken;	//setup failed, use the fallback
+
+//operations the kernel supports, up to the last one used here
+#define URING_NR_OPS (IORING_OP_WRITE + 1)
+static bool op_supported[URING_NR_OPS];
+
+static void *sq_ring, *cq_ring;
+static size_t sq_ring_size, cq_ring_size;
+static struct io_uring_sqe *sqes;
+static size_t sqes_size;
+
+static _Atomic unsigned *sq_head, *sq_tail;
+static unsigned *sq_mask, *sq_array;
+static _Atomic unsigned *cq_head, *cq_tail;
+static unsigned *cq_mask;
+static struct io_uring_cqe *cqes;
+static unsigned cq_entries;
+
+static queue_t room_waiters;	//callers waiting for room in the rings
+
+static unsigned to_submit;	//queued but not submitted yet
+static size_t inflight;		//submitted or queued, not reaped yet
+
+static size_t nr_ops, nr_submits;
+
+//called with preemption disabled
+static void uring_probe(void)
+{
+	struct io_uring_probe *probe;
+	size_t i;
+
+	probe = calloc(1, sizeof(*probe) + URING_NR_OPS * sizeof(probe->ops[0]));
+	if(probe != NULL && syscall(__NR_io_uring_register, ring_fd,
+				    IORING_REGISTER_PROBE, probe, URING_NR_OPS) == 0){
+		for(i = 0; i < URING_NR_OPS && i <= probe->last_op; i++){
+			op_supported[i] = probe->ops[i].flags & IO_URING_OP_SUPPORTED;
+		}
+	}
+	else{
+		//no probing before Linux 5.6, assume the operations of 5.1 only
+		op_supported[IORING_OP_FSYNC] = true;
+	}
+	free(probe);
+}
+
+//called with preemption disabled
+static int uring_start(void)
+{
+	struct io_uring_params p;
+	int efd;
+
+	memset(&p, 0, sizeof(p));
+	ring_fd = syscall(__NR_io_uring_setup, UTHREAD_URING_ENTRIES, &p);
+	if(ring_fd < 0){
+		return -1;
+	}
+
+	room_waiters = queue_create();
+	if(room_waiters == NULL){
+		return -1;
+	}
+
+	sq_ring_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+	cq_ring_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+	if(p.features & IORING_FEAT_SINGLE_MMAP){
+		if(cq_ring_size > sq_ring_size){
+			sq_ring_size = cq_ring_size;
+		}
+		cq_ring_size = sq_ring_size;
+	}
+
+	sq_ring = mmap(NULL, sq_ring_size, PROT_READ | PROT_WRITE,
+		       MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_SQ_RING);
+	if(sq_ring == MAP_FAILED){
+		sq_ring = NULL;
+		return -1;
+	}
+
+	if(p.features & IORING_FEAT_SINGLE_MMAP){
+		cq_ring = sq_ring;
+	}
+	else{
+		cq_ring = mmap(NULL, cq_ring_size, PROT_READ | PROT_WRITE,
+			       MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_CQ_RING);
+		if(cq_ring == MAP_FAILED){
+			cq_ring = NULL;
+			return -1;
+		}
+	}
+
+	sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+	sqes = mmap(NULL, sqes_size, PROT_READ | PROT_WRITE,
+		    MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_SQES);
+	if(sqes == MAP_FAILED){
+		sqes = NULL;
+		return -1;
+	}
+
+	sq_head = (void *)((char *)sq_ring + p.sq_off.head);
+	sq_tail = (void *)((char *)sq_ring + p.sq_off.tail);
+	sq_mask = (void *)((char *)sq_ring + p.sq_off.ring_mask);
+	sq_array = (void *)((char *)sq_ring + p.sq_off.array);
+	cq_head = (void *)((char *)cq_ring + p.cq_off.head);
+	cq_tail = (void *)((char *)cq_ring + p.cq_off.tail);
+	cq_mask = (void *)((char *)cq_ring + p.cq_off.ring_mask);
+	cqes = (void *)((char *)cq_ring + p.cq_off.cqes);
+	cq_entries = p.cq_entries;
+
+	//completions wake up the idle context like remote releases do
+	efd = sem_remote_fd();
+	if(efd < 0 || syscall(__NR_io_uring_register, ring_fd,
+			      IORING_REGISTER_EVENTFD, &efd, 1) < 0){
+		return -1;
+	}
+
+	uring_probe();
+
+	return 0;
+}
+
+void uring_stop(void)
+{
+	if(sqes){
+		munmap(sqes, sqes_size);
+	}
+	if(cq_ring && cq_ring != sq_ring){
+		munmap(cq_ring, cq_ring_size);
+	}
+	if(sq_ring){
+		munmap(sq_ring, sq_ring_size);
+	}
+	if(ring_fd >= 0){
+		close(ring_fd);
+	}
+	if(room_waiters){
+		queue_destroy(room_waiters);
+	}
+
+	sqes = NULL;
+	sq_ring = cq_ring = NULL;
+	ring_fd = -1;
+	room_waiters = NULL;
+	ring_broken = false;
+	memset(op_supported, 0, sizeof(op_supported));
+	to_submit = 0;
+	inflight = 0;
+}
+
+//called with preemption disabled
+static bool uring_supports(int op)
+{
+	if(ring_fd < 0 && !ring_broken && uring_start() < 0){
+		uring_stop();
+		ring_broken = true;
+	}
+	return !ring_broken && op < URING_NR_OPS && op_supported[op];
+}
+
+static int uring_enter(unsigned submit)
+{
+	int ret;
+
+	do{
+		ret = syscall(__NR_io_uring_enter, ring_fd, submit, 0, 0, NULL, 0);
+	}while(ret < 0 && errno == EINTR);
+
+	if(ret > 0){
+		nr_submits++;
+	}
+	return ret;
+}
+
+static bool uring_has_room(void)
+{
+	unsigned tail = atomic_load_explicit(sq_tail, memory_order_relaxed);
+
+	return tail - atomic_load_explicit(sq_head, memory_order_acquire) <= *sq_mask &&
+	       inflight < cq_entries;
+}
+
+static void uring_complete(struct uring_req *req, int res)
+{
+	preempt_disable();
+	req->res = res;
+	req->done = true;
+	preempt_enable();
+	uthread_unblock(req->caller);
+
+	inflight--;
+	sem_remote_release();
+}
+
+//fail the requests the kernel didn't take, and take them off the ring
+static void uring_fail_queued(int err)
+{
+	unsigned head = atomic_load_explicit(sq_head, memory_order_acquire);
+	unsigned tail = atomic_load_explicit(sq_tail, memory_order_relaxed);
+
+	atomic_store_explicit(sq_tail, head, memory_order_release);
+	to_submit = 0;
+
+	for(; head != tail; head++){
+		struct io_uring_sqe *sqe = &sqes[sq_array[head & *sq_mask]];
+
+		uring_complete((struct uring_req *)(uintptr_t)sqe->user_data, -err);
+	}
+}
+
+void uring_poll(void)
+{
+	if(ring_fd < 0 || inflight == 0){
+		return;
+	}
+
+	//submit everything queued during this scheduling round at once
+	if(to_submit > 0){
+		int ret = uring_enter(to_submit);
+		if(ret > 0){
+			to_submit -= ret;
+		}
+		else if(ret < 0 && ((errno != EBUSY && errno != EAGAIN) ||
+				    inflight == to_submit)){
+			//no completion to wait for before trying again
+			uring_fail_queued(errno);
+		}
+	}
+
+	unsigned head = atomic_load_explicit(cq_head, memory_order_relaxed);
+	unsigned tail = atomic_load_explicit(cq_tail, memory_order_acquire);
+
+	while(head != tail){
+		struct io_uring_cqe *cqe = &cqes[head & *cq_mask];
+
+		uring_complete((struct uring_req *)(uintptr_t)cqe->user_data, cqe->res);
+		head++;
+	}
+	atomic_store_explicit(cq_head, head, memory_order_release);
+
+	//let the callers waiting for room try again
+	if(queue_length(room_waiters) > 0){
+		preempt_disable();
+		uthread_unpark_all(room_waiters);
+		preempt_enable();
+	}
+}
+
+/*
+Fallback through the offload pool
+*/
+struct fallback_req {
+	int op;
+	int fd;
+	void *buf;
+	size_t count;
+	off_t offset;
+	ssize_t res;
+	int err;
+};
+
+static void fallback_call(void *arg)
+{
+	struct fallback_req *req = arg;
+
+	switch(req->op){
+	case IORING_OP_READ:
+		req->res = pread(req->fd, req->buf, req->count, req->offset);
+		break;
+	case IORING_OP_WRITE:
+		req->res = pwrite(req->fd, req->buf, req->count, req->offset);
+		break;
+	default:
+		req->res = fsync(req->fd);
+		break;
+	}
+	req->err = errno;
+}
+
+static ssize_t fallback_io(int op, int fd, void *buf, size_t count, off_t offset)
+{
+	//not on the caller's stack, which may be swapped out meanwhile
+	preempt_disable(); //the allocator isn't reentrant
+	struct fallback_req *req = malloc(sizeof(*req));
+	preempt_enable();
+	ssize_t res;
+
+	if(req == NULL){
+		errno = ENOMEM;
+		return -1;
+	}
+
+	*req = (struct fallback_req){ op, fd, buf, count, offset, -1, 0 };
+	if(uthread_offload(fallback_call, req) < 0){
+		fallback_call(req); //no pool either: block the whole runtime
+	}
+
+	res = req->res;
+	errno = req->err;
+	preempt_disable();
+	free(req);
+	preempt_enable();
+	return res;
+}
+
+static ssize_t uring_io(int op, int fd, void *buf, size_t count, off_t offset)
+{
+	if(uthread_current() == NULL){
+		return fallback_io(op, fd, buf, count, offset);
+	}
+
+	preempt_disable(); //other threads may be setting up the ring or queueing requests too, and the allocator isn't reentrant
+
+	if(!uring_supports(op)){
+		preempt_enable();
+		return fallback_io(op, fd, buf, count, offset);
+	}
+
+	//an entry of a full submission ring may not be submitted yet, and
+	//completions beyond the size of their ring would overflow it
+	while(!uring_has_room()){
+		if(uthread_park(room_waiters) < 0){
+			errno = ENOMEM;
+			return -1;
+		}
+		preempt_disable(); //uthread_park() enabled it
+	}
+
+	struct uring_req *req = malloc(sizeof(*req));
+	if(req == NULL){
+		preempt_enable();
+		errno = ENOMEM;
+		return -1;
+	}
+	req->caller = uthread_current();
+	req->done = false;
+
+	unsigned tail = atomic_load_explicit(sq_tail, memory_order_relaxed);
+	unsigned index = tail & *sq_mask;
+	struct io_uring_sqe *sqe = &sqes[index];
+
+	memset(sqe, 0, sizeof(*sqe));
+	sqe->opcode = op;
+	sqe->fd = fd;
+	sqe->addr = (uintptr_t)buf;
+	sqe->len = count;
+	sqe->off = offset;
+	sqe->user_data = (uintptr_t)req;
+	sq_array[index] = index;
+	atomic_store_explicit(sq_tail, tail + 1, memory_order_release);
+
+	to_submit++;
+	inflight++;
+	nr_ops++;
+	sem_remote_hold(); //keeps the idle context waiting for the completion
+
+	//block until the idle context reaps the completion, like sem_down()
+	while(!req->done){
+		uthread_block();
+		preempt_disable(); //uthread_block() enabled it
+	}
+
+	int res = req->res;
+	free(req);
+	preempt_enable();
+
+	if(res < 0){
+		errno = -res;
+		return -1;
+	}
+	return res;
+}
+
+void uring_get_stats(struct uthread_stats *stats)
+{
+	stats->file_io_ops = nr_ops;
+	stats->file_io_submits = nr_submits;
+}
+
+ssize_t uthread_pread(int fd, void *buf, size_t count, off_t offset)
+{
+	return uring_io(IORING_OP_READ, fd, buf, count, offset);
+}
+
+ssize_t uthread_pwrite(int fd, const void *buf, size_t count, off_t offset)
+{
+	return uring_io(IORING_OP_WRITE, fd, (void *)buf, count, offset);
+}
+
+int uthread_fsync(int fd)
+{
+	return uring_io(IORING_OP_FSYNC, fd, NULL, 0, 0);
+}
+
+/*Sources:
+https://man7.org/linux/man-pages/man7/io_uring.7.html
+https://kernel.dk/io_uring.pdf
+*/
@@ -4,10 +4,13 @@
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <sys/time.h>
+#include <time.h>
 #include <ucontext.h>    // for getcontext()
 
 #include "private.h"     // uthread_ctx_t, uthread_ctx_* API
+#include "probe.h"       // UTHREAD_PROBE*()
 #include "uthread.h"     // uthread_func_t, uthread_run, etc.
 #include "queue.h"       // queue_t
 
@@ -15,34 +18,312 @@
 // Phase 2: User‐level thread API 
 
 // Thread states 
-typedef enum { RUNNING, READY, BLOCKED, EXITED } uthread_state_t;
+// A PARKED thread waits on a list that is made ready in one go, so it may
+// already sit in the ready threads until it runs again
+typedef enum { RUNNING, READY, BLOCKED, PARKED, EXITED } uthread_state_t;
+
+#define UTHREAD_CACHE_LINE 64
+
+// size of a thread name, terminating null byte included
+#define UTHREAD_NAME_MAX 16
+
+// 1 in this many stacks sized after their function is still painted
+#define UTHREAD_STACK_SAMPLE 16
+
+// stack accounting, see uthread_set_stack_paint() and uthread_set_stack_trim()
+struct uthread_stack_acct {
+    uthread_func_t       func;       // entry function, to learn its stack size
+    bool                 painted;    // stack painted at creation
+    bool                 listed;     // in the list of blocked threads
+    size_t               stack_size; // size of a fitted stack, or 0
+    void                *trimmed;    // pages below were released, or NULL
+    size_t               peak;       // usage measured before releasing pages
+    unsigned long long   blocked_at; // when the thread blocked, in ns
+    struct uthread_tcb  *prev, *next; // in the list of blocked threads
+};
 
 // Thread Control Block 
+//
+// A thread with a stack of its own keeps its TCB, context included, at the top
+// of that stack, right above the first frames, so that a switch touches a
+// single allocation. The fields read by the scheduler on every switch come
+// first and share one cache line. The context, saved stack pointer included,
+// directly follows them. The members only used on creation, blocking, exit or
+// in some modes come last.
 struct uthread_tcb {
-    uthread_ctx_t   *uctx;   
-    void            *stack;  
     uthread_state_t  state;  
+    bool             shared;   // runs on the shared stack
+    void            *stack;    // stack segment holding this TCB, or NULL
+    struct uthread_slab *slab; // batch this TCB belongs to, or NULL
+    size_t           id;       // see uthread_self()
+    struct uthread_sched_entity se; // scheduling policy's data
+    uthread_ctx_t    uctx;   
+
+    char             name[UTHREAD_NAME_MAX];
+    struct uthread_stack_acct acct;
+    struct uthread_perf perf; // events counted while running
+    struct uthread_ctx_save save; // saved stack, in shared-stack mode
+} __attribute__((aligned(UTHREAD_CACHE_LINE)));
+
+_Static_assert(offsetof(struct uthread_tcb, uctx) <= UTHREAD_CACHE_LINE,
+               "the scheduler's fields must fit in the first cache line of a TCB");
+_Static_assert(offsetof(struct uthread_tcb, name) ==
+               offsetof(struct uthread_tcb, uctx) + sizeof(uthread_ctx_t),
+               "the context of a TCB must come right after the scheduler's fields");
+
+// Threads and stacks of a uthread_create_batch() call
+struct uthread_slab {
+    size_t               n;      // threads in the batch
+    size_t               refs;   // threads of the batch not reaped yet
+    struct uthread_tcb  *tcbs;   // TCBs, when the threads share a stack
+    void                *stacks;
 };
 
-// ready/zombie queue of TCB pointers 
-static queue_t               ready_q;
+// ready threads are kept by the scheduling policy, running only
+static uthread_sched_t       sched_policy = UTHREAD_SCHED_FIFO;
+static const struct uthread_sched_ops *sched;
+
+// zombie queue of TCB pointers 
 static queue_t				 zombie_q;
 
 // currently running thread 
 static struct uthread_tcb   *current;
 
 // idle (main) context 
-static uthread_ctx_t        *idle_uctx;
+static struct uthread_tcb    idle_tcb;
+
+// how thread stacks are provided, see uthread_set_stack_mode()
+static uthread_stack_mode_t  stack_mode = UTHREAD_STACK_PRIVATE;
+static size_t                stack_max;
+static uthread_stack_paint_t paint_mode = UTHREAD_STACK_PAINT_OFF;
+static unsigned long long    trim_ns;
+
+// events are counted per thread, see uthread_perf_start()
+static bool                  perf_counting;
+static size_t                nr_fitted; // stacks sized after their function
+
+// threads blocked with a stack to trim, oldest first
+static struct uthread_tcb   *blocked_head, *blocked_tail;
+
+// thread being switched away from, whose stack may still be executing 
+static struct uthread_tcb   *switching_from;
+
+static struct uthread_stats  stats;
+static size_t                last_id;
+
+static struct uthread_ctx_save *tcb_save(struct uthread_tcb *tcb)
+{
+    return tcb->shared ? &tcb->save : NULL;
+}
+
+static unsigned long long now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+// only fixed-size stacks get painted, painting growable ones would commit them
+static bool stacks_painted(void)
+{
+    return paint_mode != UTHREAD_STACK_PAINT_OFF &&
+           (stack_mode == UTHREAD_STACK_PRIVATE ||
+            stack_mode == UTHREAD_STACK_ARENA);
+}
+
+// huge pages of arena stacks are not worth splitting 
+static bool stacks_trimmed(void)
+{
+    return trim_ns && (stack_mode == UTHREAD_STACK_PRIVATE ||
+                       stack_mode == UTHREAD_STACK_GROWABLE);
+}
+
+// remember that the running thread blocks, to be called with preemption disabled
+static void blocked_add(struct uthread_tcb *tcb)
+{
+    if (!stacks_trimmed() || !tcb->stack || tcb->acct.listed)
+        return;
+
+    tcb->acct.blocked_at = now_ns();
+    tcb->acct.listed = true;
+    tcb->acct.next = NULL;
+    tcb->acct.prev = blocked_tail;
+    if (blocked_tail)
+        blocked_tail->acct.next = tcb;
+    else
+        blocked_head = tcb;
+    blocked_tail = tcb;
+}
+
+static void blocked_unlink(struct uthread_tcb *tcb)
+{
+    if (tcb->acct.prev)
+        tcb->acct.prev->acct.next = tcb->acct.next;
+    else
+        blocked_head = tcb->acct.next;
+    if (tcb->acct.next)
+        tcb->acct.next->acct.prev = tcb->acct.prev;
+    else
+        blocked_tail = tcb->acct.prev;
+    tcb->acct.listed = false;
+}
+
+// release the unused stack pages of the threads blocked for long enough 
+static void trim_blocked(void)
+{
+    unsigned long long now;
+
+    if (!stacks_trimmed())
+        return;
+
+    now = now_ns();
+	preempt_disable();
+    while (blocked_head && now - blocked_head->acct.blocked_at >= trim_ns) {
+        struct uthread_tcb *tcb = blocked_head;
+        void *sp = uthread_ctx_sp(&tcb->uctx);
+        void *end;
+
+        blocked_unlink(tcb);
+        if (!sp)
+            continue;
+
+        // what was used so far would read as released 
+        if (tcb->acct.painted) {
+            size_t peak = stack_peak(tcb->stack, tcb, tcb->acct.trimmed);
+            if (peak > tcb->acct.peak)
+                tcb->acct.peak = peak;
+        }
+        end = stack_trim(tcb->stack, sp);
+        if ((char *)end > (char *)tcb->acct.trimmed)
+            tcb->acct.trimmed = end;
+    }
+	preempt_enable();
+}
+
+static void acct_init(struct uthread_tcb *tcb, uthread_func_t func)
+{
+    tcb->acct.func = func;
+    tcb->acct.stack_size = 0;
+    tcb->acct.painted = false;
+    tcb->acct.listed = false;
+    tcb->acct.trimmed = NULL;
+    tcb->acct.peak = 0;
+    memset(&tcb->perf, 0, sizeof(tcb->perf));
+}
+
+// switch from @prev to @next, to be called with preemption disabled 
+static void uthread_switch(struct uthread_tcb *prev, struct uthread_tcb *next)
+{
+    stats.context_switches++;
+    UTHREAD_PROBE4(switch, prev->id, next->id, prev, next);
+    switching_from = prev;
+    if (perf_counting)
+        perf_switch(&prev->perf);
+
+    if (stack_mode == UTHREAD_STACK_SHARED)
+        uthread_ctx_shared_switch(&prev->uctx, tcb_save(prev),
+                                  &next->uctx, tcb_save(next));
+    else
+        uthread_ctx_switch(&prev->uctx, &next->uctx);
+
+    switching_from = NULL;
+
+    // @prev runs again, its stack is in use 
+    if (prev->acct.listed)
+        blocked_unlink(prev);
+}
+
+
+// place the TCB at the top of @stack, @size bytes long, cache-line aligned 
+static struct uthread_tcb *tcb_of_stack(void *stack, size_t size)
+{
+    uintptr_t top = (uintptr_t)stack + size;
+
+    return (struct uthread_tcb *)((top - sizeof(struct uthread_tcb)) &
+                                  ~(uintptr_t)(UTHREAD_CACHE_LINE - 1));
+}
+
+// usable part of @stack, below its TCB 
+static size_t tcb_stack_size(struct uthread_tcb *tcb)
+{
+    return (char *)tcb - (char *)tcb->stack;
+}
+
+static struct uthread_tcb *slab_tcb(struct uthread_slab *slab, size_t i)
+{
+    if (!slab->stacks)
+        return &slab->tcbs[i];
+    return tcb_of_stack(uthread_ctx_stack_at(slab->stacks, i),
+                        uthread_ctx_stack_size());
+}
+
+// memory taken by a slab for @n shared-stack TCBs 
+static size_t slab_shared_size(size_t n)
+{
+    return sizeof(struct uthread_slab) + n * sizeof(struct uthread_tcb) +
+           UTHREAD_CACHE_LINE;
+}
+
+static void slab_free(struct uthread_slab *slab)
+{
+    // TCBs live on the stacks, or right after the slab header 
+    if (slab->stacks) {
+        mem_move(MEM_TCBS, MEM_STACKS, slab->n * sizeof(struct uthread_tcb));
+        mem_sub(MEM_TCBS, sizeof(*slab));
+        uthread_ctx_destroy_stacks(slab->stacks, slab->n);
+    } else {
+        mem_sub(MEM_TCBS, slab_shared_size(slab->n));
+    }
+    free(slab);
+}
+
+// free the TCB of a thread created on its own, with its stack if it has one 
+static void tcb_free(struct uthread_tcb *tcb)
+{
+    if (tcb->stack) {
+        mem_move(MEM_TCBS, MEM_STACKS, sizeof(*tcb));
+        uthread_ctx_destroy_stack(tcb->stack, tcb->acct.stack_size);
+    } else {
+        mem_sub(MEM_TCBS, sizeof(*tcb));
+        free(tcb);
+    }
+}
+
+// account the stack usage of an exited thread 
+static void stack_account(struct uthread_tcb *tcb)
+{
+    size_t peak;
 
+    if (!tcb->acct.painted)
+        return;
+
+    peak = stack_peak(tcb->stack, tcb, tcb->acct.trimmed);
+    if (peak < tcb->acct.peak)
+        peak = tcb->acct.peak;
+    stack_exit(tcb->acct.func, peak, tcb_stack_size(tcb));
+}
 
 void cleanup_zombies(queue_t zombie_q)
 {
     struct uthread_tcb *zombie;
+
+    // exiting threads append to the queue, and the allocator isn't reentrant 
+	preempt_disable();
     while (queue_dequeue(zombie_q, (void **)&zombie) == 0) { //while the zombie queue is not empty
-        uthread_ctx_destroy_stack(zombie->stack);
-        free(zombie->uctx);
-        free(zombie);
+        stack_account(zombie);
+        if (perf_counting)
+            perf_exit(zombie->name, zombie->acct.func, &zombie->perf);
+        if (zombie->slab) {
+            // the slab goes away with the last thread of its batch
+            if (--zombie->slab->refs == 0)
+                slab_free(zombie->slab);
+            continue;
+        }
+        // the TCB goes away with its stack 
+        tcb_free(zombie);
     }
+	preempt_enable();
 }
 
 struct uthread_tcb * uthread_current(void)
@@ -50,24 +331,116 @@ struct uthread_tcb * uthread_current(void)
     return current;
 }
 
+size_t uthread_tcb_id(struct uthread_tcb *tcb)
+{
+    return tcb->id;
+}
 
-void uthread_yield(void)
+const char *uthread_tcb_name(struct uthread_tcb *tcb)
 {
+    return tcb->name;
+}
 
+int uthread_tcb_stack(struct uthread_tcb *tcb, void **low, void **high)
+{
+    // shared-stack threads have their frames copied around 
+    if (!tcb->stack)
+        return -1;
 
-    if (queue_length(ready_q) == 0){
-        return;
-	}
+    *low  = tcb->stack;
+    *high = tcb;
+    return 0;
+}
 
-	preempt_disable();  // protect ready_q + current
+bool uthread_tcb_shared(struct uthread_tcb *tcb)
+{
+    return tcb->shared;
+}
 
-    struct uthread_tcb *next;
-    queue_dequeue(ready_q, (void **)&next);
+struct uthread_sched_entity *uthread_tcb_sched(struct uthread_tcb *tcb)
+{
+    return &tcb->se;
+}
+
+size_t uthread_self(void)
+{
+    return current ? current->id : 0;
+}
+
+uthread_handle_t uthread_handle(void)
+{
+    return current;
+}
+
+int uthread_set_name(const char *name)
+{
+    if (!name || !current)
+        return -1;
+
+    strncpy(current->name, name, UTHREAD_NAME_MAX - 1);
+    current->name[UTHREAD_NAME_MAX - 1] = '\0';
+    return 0;
+}
 
-    // re‐enqueue current if it is still running 
+int uthread_active_stacks(void *stacks[2])
+{
+    int n = 0;
+
+    if (current && current->stack)
+        stacks[n++] = current->stack;
+    if (switching_from && switching_from->stack)
+        stacks[n++] = switching_from->stack;
+
+    return n;
+}
+
+int uthread_get_stats(struct uthread_stats *out)
+{
+    if (!out)
+        return -1;
+
+    *out = stats;
+    uthread_ctx_get_stats(out);
+    offload_get_stats(out);
+    uring_get_stats(out);
+    arena_get_stats(out);
+    stack_get_stats(out);
+    sched_get_stats(out);
+    perf_get_stats(out);
+
+    return 0;
+}
+
+
+// wake up the threads made ready from outside of the runtime 
+static void drain_remote(void)
+{
+    sem_remote_drain();
+    offload_drain();
+}
+
+void uthread_yield(void)
+{
+    // scheduling point, but not for a blocking thread: preempted while holding
+    // drained wake-ups, it would not run again to hand them out 
+    if (current->state == RUNNING) {
+        drain_remote();
+    }
+
+	preempt_disable();  // protect the ready threads + current
+
+    // re‐enqueue current if it is still running, the policy may pick it again
     if (current->state == RUNNING) {
         current->state = READY;
-        queue_enqueue(ready_q, current);
+        sched->enqueue(current, true);
+    }
+
+    struct uthread_tcb *next = sched->pick_next();
+    if (next == NULL || next == current) {
+        if (next)
+            next->state = RUNNING;
+        preempt_enable();
+        return;
     }
 
     // context switch 
@@ -75,11 +448,48 @@ void uthread_yield(void)
     struct uthread_tcb *prev = current;
     current = next;
 
-	preempt_enable();
+    // stay in the critical section until this thread is resumed 
+    uthread_switch(prev, next);
 
-    uthread_ctx_switch(prev->uctx, next->uctx);
+	preempt_enable();
 }
 
+int uthread_yield_to(uthread_handle_t target)
+{
+    if (!target)
+        return -1;
+
+    drain_remote(); // scheduling point
+
+	preempt_disable();  // protect the ready threads + current
+
+    if (target == current) {
+        preempt_enable();
+        return 0;
+    }
+    if (target->state != READY) {
+        preempt_enable();
+        uthread_yield();
+        return 0;
+    }
+
+    // jump the queue, and leave the caller to the policy 
+    sched->remove(target);
+    if (current->state == RUNNING) {
+        current->state = READY;
+        sched->enqueue(current, true);
+    }
+
+    target->state = RUNNING;
+    struct uthread_tcb *prev = current;
+    current = target;
+
+    uthread_switch(prev, target);
+
+	preempt_enable();
+
+    return 0;
+}
 
 void uthread_exit(void)
 {
@@ -89,63 +499,349 @@ void uthread_exit(void)
 
 	preempt_disable();
 	prev->state = EXITED;
+    UTHREAD_PROBE2(exit, prev->id, prev);
 
 	//add the exited thread to our zombie queue
-	queue_enqueue(zombie_q, prev); 
+	queue_enqueue(zombie_q, prev);
 
-	preempt_enable();
+    // the saved stack is not needed anymore, this thread won't resume 
+    if (prev->shared)
+        uthread_ctx_shared_release(&prev->save);
 
-    if (queue_length(ready_q) > 0) {
+    if ((next = sched->pick_next()) != NULL) {
         // pick the next READY thread 
-        queue_dequeue(ready_q, (void **)&next);
         next->state = RUNNING;
         current = next;
 
         // swap out of this thread into next 
-        uthread_ctx_switch(prev->uctx, next->uctx);
+        uthread_switch(prev, next);
         // never returns here 
     } else {
         // no more threads --> swap back to main 
-        uthread_ctx_switch(prev->uctx, idle_uctx);
+        current = &idle_tcb;
+        uthread_switch(prev, &idle_tcb);
         // never returns here 
     }
 
     __builtin_unreachable();
 }
 
-int uthread_create(uthread_func_t func, void *arg)
+int uthread_set_stack_mode(uthread_stack_mode_t mode)
+{
+    if (sched) // library already running
+        return -1;
+
+    switch (mode) {
+    case UTHREAD_STACK_PRIVATE:
+    case UTHREAD_STACK_SHARED:
+    case UTHREAD_STACK_GROWABLE:
+    case UTHREAD_STACK_ARENA:
+        stack_mode = mode;
+        return 0;
+    }
+
+    return -1;
+}
+
+int uthread_set_stack_paint(uthread_stack_paint_t paint)
+{
+    if (sched) // library already running
+        return -1;
+
+    switch (paint) {
+    case UTHREAD_STACK_PAINT_OFF:
+    case UTHREAD_STACK_PAINT_MEASURE:
+    case UTHREAD_STACK_PAINT_ADAPTIVE:
+        paint_mode = paint;
+        return 0;
+    }
+
+    return -1;
+}
+
+int uthread_set_stack_trim(unsigned int ms)
+{
+    if (sched) // library already running
+        return -1;
+
+    trim_ns = ms * 1000000ULL;
+    return 0;
+}
+
+int uthread_set_sched(uthread_sched_t policy)
 {
-    // allocate TCB 
-    struct uthread_tcb *tcb = malloc(sizeof(*tcb));
+    if (sched || !uthread_sched_get(policy))
+        return -1;
+
+    sched_policy = policy;
+    return 0;
+}
+
+int uthread_set_weight(unsigned int weight)
+{
+    if (!current || weight == 0)
+        return -1;
+
+    current->se.weight = weight;
+    return 0;
+}
+
+int uthread_set_stack_max(size_t max)
+{
+    if (sched) // library already running
+        return -1;
+
+    stack_max = max;
+    return 0;
+}
+
+/*
+ * Thread creation runs with preemption disabled: the allocator isn't reentrant,
+ * and another thread may free memory meanwhile (zombies, semaphores)
+ */
+
+// create a thread without a stack of its own, bound on its first run 
+static int uthread_create_shared(uthread_func_t func, void *arg,
+                                 uthread_handle_t *handle)
+{
+    if (!mem_fits(sizeof(struct uthread_tcb)))
+        return -1;
+
+    struct uthread_tcb *tcb = aligned_alloc(UTHREAD_CACHE_LINE, sizeof(*tcb));
     if (!tcb)
         return -1;
+    mem_add(MEM_TCBS, sizeof(*tcb));
+
+    if (handle)
+        *handle = tcb;
+    uthread_ctx_shared_init(&tcb->save, func, arg);
+    tcb->stack  = NULL;
+    tcb->shared = true;
+    tcb->state  = READY;
+    tcb->slab   = NULL;
+    tcb->name[0] = '\0';
+    tcb->se.weight = 1;
+    acct_init(tcb, func);
+
+    tcb->id = ++last_id;
+    if (sched->enqueue(tcb, false) < 0) {
+        tcb_free(tcb);
+        return -1;
+    }
+    stats.threads_created++;
+    UTHREAD_PROBE3(create, tcb->id, tcb, func);
 
-    // allocate a stack 
-    tcb->stack = uthread_ctx_alloc_stack();
-    if (!tcb->stack) {
-        free(tcb);
+    return 0;
+}
+
+int uthread_create(uthread_func_t func, void *arg)
+{
+    return uthread_create_handle(func, arg, NULL);
+}
+
+// create a thread on a stack of its own 
+static int uthread_create_stack(uthread_func_t func, void *arg,
+                                uthread_handle_t *handle)
+{
+    // size the stack after the previous threads of @func, if asked to 
+    size_t size = uthread_ctx_stack_size();
+    size_t fit = 0;
+    if (paint_mode == UTHREAD_STACK_PAINT_ADAPTIVE &&
+        stack_mode == UTHREAD_STACK_PRIVATE)
+        fit = stack_size_for(func);
+
+    if (fit)
+        size = fit + sizeof(struct uthread_tcb) + UTHREAD_CACHE_LINE;
+
+    // fail before allocating anything if over budget 
+    if (!mem_fits(fit ? size : uthread_ctx_stack_charge()))
+        return -1;
+
+    // allocate a stack, which holds the TCB at its top 
+    void *stack = fit ? uthread_ctx_alloc_stack_size(size)
+                      : uthread_ctx_alloc_stack();
+    if (!stack)
         return -1;
+
+    struct uthread_tcb *tcb = tcb_of_stack(stack, size);
+    tcb->stack = stack;
+    acct_init(tcb, func);
+    tcb->acct.stack_size = fit ? size : 0;
+    mem_move(MEM_STACKS, MEM_TCBS, sizeof(*tcb));
+    // keep learning from a sample only, painting commits the whole stack 
+    if (stacks_painted() && (!fit || nr_fitted++ % UTHREAD_STACK_SAMPLE == 0)) {
+        stack_paint(stack, tcb);
+        tcb->acct.painted = true;
     }
 
-    // allocate and initialize context 
-    tcb->uctx = malloc(sizeof(*tcb->uctx));
-    if (!tcb->uctx ||
-        uthread_ctx_init(tcb->uctx, tcb->stack, func, arg) < 0)
+    // initialize context below the TCB 
+    if (uthread_ctx_init_size(&tcb->uctx, stack, tcb_stack_size(tcb),
+                              func, arg) < 0)
     {
-        if (tcb->uctx) free(tcb->uctx);
-        uthread_ctx_destroy_stack(tcb->stack);
-        free(tcb);
+        tcb_free(tcb);
         return -1;
     }
 
-    tcb->state = READY;
+    if (handle)
+        *handle = tcb;
+    tcb->state  = READY;
+    tcb->slab   = NULL;
+    tcb->name[0] = '\0';
+    tcb->shared = false;
+    tcb->se.weight = 1;
+
+    tcb->id = ++last_id;
+    if (sched->enqueue(tcb, false) < 0) {
+        tcb_free(tcb);
+        return -1;
+    }
+    stats.threads_created++;
+    UTHREAD_PROBE3(create, tcb->id, tcb, func);
 
-	preempt_disable(); //protect ready_q (shared data)
-	queue_enqueue(ready_q, tcb);
-	preempt_enable();
+    return 0;
+}
+
+int uthread_create_handle(uthread_func_t func, void *arg,
+                          uthread_handle_t *handle)
+{
+    int ret;
+
+    preempt_disable();
+    if (stack_mode == UTHREAD_STACK_SHARED)
+        ret = uthread_create_shared(func, arg, handle);
+    else
+        ret = uthread_create_stack(func, arg, handle);
+    preempt_enable();
+
+    return ret;
+}
+
+static int create_batch(uthread_func_t *funcs, void **args, size_t n)
+{
+    struct uthread_slab *slab;
+    size_t i;
+
+    if (!funcs || n == 0)
+        return -1;
+    if (n > (SIZE_MAX - sizeof(*slab)) / sizeof(struct uthread_tcb))
+        return -1;
+
+    if (n > SIZE_MAX / uthread_ctx_stack_charge())
+        return -1;
+    if (!mem_fits(stack_mode == UTHREAD_STACK_SHARED ? slab_shared_size(n) :
+                  sizeof(*slab) + n * uthread_ctx_stack_charge()))
+        return -1;
+
+    if (stack_mode == UTHREAD_STACK_SHARED) {
+        // one allocation for the slab header and the TCBs 
+        slab = malloc(slab_shared_size(n));
+        if (!slab)
+            return -1;
+        mem_add(MEM_TCBS, slab_shared_size(n));
+        slab->tcbs = (struct uthread_tcb *)
+            (((uintptr_t)(slab + 1) + UTHREAD_CACHE_LINE - 1) &
+             ~(uintptr_t)(UTHREAD_CACHE_LINE - 1));
+        slab->stacks = NULL;
+
+        // contexts get initialized lazily, on the shared stack 
+        for (i = 0; i < n; i++)
+            uthread_ctx_shared_init(&slab->tcbs[i].save, funcs[i],
+                                    args ? args[i] : NULL);
+    } else {
+        uthread_ctx_t **uctxs = malloc(n * sizeof(*uctxs));
+        int ret = -1;
+
+        slab = malloc(sizeof(*slab));
+        if (!slab || !uctxs) {
+            free(slab);
+            free(uctxs);
+            return -1;
+        }
+
+        // one allocation for all the stacks, each holding its TCB 
+        slab->n = n;
+        slab->stacks = uthread_ctx_alloc_stacks(n);
+        if (slab->stacks) {
+            mem_add(MEM_TCBS, sizeof(*slab));
+            mem_move(MEM_STACKS, MEM_TCBS, n * sizeof(struct uthread_tcb));
+            // every TCB sits at the same offset in its stack 
+            size_t size = (char *)slab_tcb(slab, 0) - (char *)slab->stacks;
+
+            for (i = 0; i < n; i++) {
+                uctxs[i] = &slab_tcb(slab, i)->uctx;
+                if (stacks_painted())
+                    stack_paint(uthread_ctx_stack_at(slab->stacks, i),
+                                slab_tcb(slab, i));
+            }
+            ret = uthread_ctx_init_batch(uctxs, slab->stacks, size,
+                                         funcs, args, n);
+        }
+        free(uctxs);
+        if (!slab->stacks) {
+            free(slab);
+            return -1;
+        }
+        if (ret < 0) {
+            slab_free(slab);
+            return -1;
+        }
+    }
+    slab->n    = n;
+    slab->refs = n;
+
+    for (i = 0; i < n; i++) {
+        struct uthread_tcb *tcb = slab_tcb(slab, i);
+        tcb->stack  = slab->stacks ? uthread_ctx_stack_at(slab->stacks, i)
+                                   : NULL;
+        tcb->state  = READY;
+        tcb->slab   = slab;
+        tcb->name[0] = '\0';
+        tcb->shared = slab->stacks == NULL;
+        tcb->se.weight = 1;
+        tcb->se.budget = 1;
+        acct_init(tcb, funcs[i]);
+        tcb->acct.painted = tcb->stack && stacks_painted();
+    }
+
+    // line the batch up on its own, where failing leaves no thread behind 
+    queue_t batch = queue_create();
+    if (!batch) {
+        slab_free(slab);
+        return -1;
+    }
+    for (i = 0; i < n; i++) {
+        struct uthread_tcb *tcb = slab_tcb(slab, i);
+        if (queue_enqueue_handle(batch, tcb, &tcb->se.node) < 0) {
+            while (queue_dequeue(batch, (void **)&tcb) == 0)
+                ;
+            queue_destroy(batch);
+            slab_free(slab);
+            return -1;
+        }
+    }
+
+    // then splice it into the ready threads in one operation, which can't fail 
+    sched->enqueue_all(batch);
+    queue_destroy(batch);
+    for (i = 0; i < n; i++)
+        slab_tcb(slab, i)->id = ++last_id;
+    stats.threads_created += n;
+    for (i = 0; i < n; i++)
+        UTHREAD_PROBE3(create, slab_tcb(slab, i)->id, slab_tcb(slab, i),
+                       funcs[i]);
 
     return 0;
+}
 
+int uthread_create_batch(uthread_func_t *funcs, void **args, size_t n)
+{
+    int ret;
+
+    preempt_disable();
+    ret = create_batch(funcs, args, n);
+    preempt_enable();
+
+    return ret;
 }
 
 
@@ -154,48 +850,85 @@ int uthread_run(bool preempt, uthread_func_t func, void *arg)
 
 	preempt_start(preempt); //initialize preemption if user wants it
 
-    // initialize ready queue 
-    ready_q = queue_create();
-    if(!ready_q){
+    // initialize the scheduling policy 
+    sched = uthread_sched_get(sched_policy);
+    if (sched->init() < 0) {
+        sched = NULL;
         return -1;
-	}
+    }
 
 	zombie_q = queue_create(); //this is where exited threads go to and are freed after all threads finish
 	if(!zombie_q){
 		return -1;
 	}
 
-    // capture main context as idle_uctx 
-    idle_uctx = malloc(sizeof(*idle_uctx));
-    if (!idle_uctx)
+    if (stack_mode == UTHREAD_STACK_SHARED && uthread_ctx_shared_start() < 0)
         return -1;
-    if (getcontext(idle_uctx) < 0)
+    if (stack_mode == UTHREAD_STACK_GROWABLE &&
+        uthread_ctx_growable_start(stack_max) < 0)
         return -1;
-
-    // install TCB for current thread
-    current = malloc(sizeof(*current));
-    if (!current)
+    if (stack_mode == UTHREAD_STACK_ARENA && uthread_ctx_arena_start() < 0)
         return -1;
-    current->uctx  = idle_uctx;
-    current->stack = NULL;
-    current->state = RUNNING;
+
+    // install TCB for current thread, whose context is saved on first switch
+    current = &idle_tcb;
+    current->stack  = NULL;
+    current->state  = RUNNING;
+    current->slab   = NULL;
+    current->shared = false;
+    current->id     = 0;
+    current->se.weight = 1;
+    acct_init(current, NULL);
+    blocked_head = blocked_tail = NULL;
+    strcpy(current->name, "main");
+    perf_counting = perf_start();
 
     //create initial user thread 
     if (uthread_create(func, arg) < 0){
         return -1;
 	}
 
-    // go until READY threads remain 
-    while (queue_length(ready_q) > 0){
+    // go until READY threads remain, or remote wake-ups may still arrive 
+    while (1) {
 		cleanup_zombies(zombie_q);
-        uthread_yield();
+        trim_blocked();
+        uring_poll(); // one submission per scheduling round
+        drain_remote();
+        if (sched->nr_ready() > 0) {
+            uthread_yield();
+        } else if (!sem_remote_wait()) {
+            // the last hold may have been dropped right after a wake-up 
+            drain_remote();
+            if (sched->nr_ready() == 0)
+                break;
+        }
     }
 
 	preempt_stop(); //stop preemption before exiting
+    offload_stop();
+    uring_stop();
+
+    cleanup_zombies(zombie_q);
 
-    queue_destroy(ready_q);
+    if (perf_counting) {
+        // the idle context ran until now 
+        perf_running(&idle_tcb.perf);
+        perf_exit(idle_tcb.name, NULL, &idle_tcb.perf);
+        perf_stop();
+        perf_counting = false;
+    }
+
+    sched->destroy();
 	queue_destroy(zombie_q);
-	free(idle_uctx);
+    sched = NULL;
+    current = NULL;
+
+    if (stack_mode == UTHREAD_STACK_SHARED)
+        uthread_ctx_shared_stop();
+    if (stack_mode == UTHREAD_STACK_GROWABLE)
+        uthread_ctx_growable_stop();
+    if (stack_mode == UTHREAD_STACK_ARENA)
+        uthread_ctx_arena_stop();
 
     return 0;
 }
@@ -204,6 +937,9 @@ void uthread_block(void)
 {
 	preempt_disable();
 	current->state = BLOCKED; //mark thread as blocked
+    UTHREAD_PROBE2(block, current->id, current);
+    sched->on_block(current);
+    blocked_add(current);
 	preempt_enable();
     uthread_yield(); //switch execution to another READY thread
 }
@@ -213,8 +949,65 @@ void uthread_unblock(struct uthread_tcb *uthread)
 	preempt_disable();
     if(uthread && uthread->state == BLOCKED){
         uthread->state = READY;
-        queue_enqueue(ready_q, uthread); //re-add to scheduling queue
+        UTHREAD_PROBE2(unblock, uthread->id, uthread);
+        sched->enqueue(uthread, false); //hand back to the scheduling policy
     }
 	preempt_enable();
 }
 
+int uthread_park(queue_t waiters)
+{
+	preempt_disable();
+    struct uthread_sched_entity *se = &current->se;
+    if (queue_enqueue_handle(waiters, current, &se->node) < 0) {
+        preempt_enable();
+        return -1;
+    }
+	current->state = PARKED;
+    UTHREAD_PROBE2(block, current->id, current);
+    sched->on_block(current);
+    blocked_add(current);
+	preempt_enable();
+    uthread_yield(); //switch execution to another READY thread
+    return 0;
+}
+
+size_t uthread_unpark_all(queue_t waiters)
+{
+    size_t n = queue_length(waiters);
+    // the parked threads become READY when they run, not one by one here 
+    if (n > 0) {
+        UTHREAD_PROBE2(unpark, n, waiters);
+        sched->enqueue_all(waiters);
+    }
+    return n;
+}
+
+int uthread_get_perf(uthread_handle_t thread, struct uthread_perf *perf)
+{
+    if (!perf || !current || !perf_counting)
+        return -1;
+
+    preempt_disable();
+    if (!thread)
+        thread = current;
+    *perf = thread->perf;
+    if (thread == current)
+        perf_running(perf);
+    preempt_enable();
+
+    return 0;
+}
+
+void uthread_tick(void)
+{
+    if (sched && current && sched->on_tick(current))
+        uthread_yield(); //force a context switch
+}
+
+void uthread_yield_point(void)
+{
+    if (sched && sched->on_yield_point && current &&
+        sched->on_yield_point(current))
+        uthread_yield();
+}
@@ -2,6 +2,8 @@
 #define _UTHREAD_H
 
 #include <stdbool.h>
+#include <stddef.h>
+#include <sys/types.h>
 
 /*
  * uthread_func_t - Thread function type
@@ -9,6 +11,349 @@
  */
 typedef void (*uthread_func_t)(void *arg);
 
+/*
+ * uthread_handle_t - Thread handle
+ *
+ * A handle designates a thread until it exits.
+ */
+typedef struct uthread_tcb *uthread_handle_t;
+
+/*
+ * uthread_stack_mode_t - Thread stack mode
+ *
+ * UTHREAD_STACK_PRIVATE: each thread owns a fixed-size stack, allocated when
+ * the thread is created (default).
+ *
+ * UTHREAD_STACK_SHARED: threads run on one large stack shared by all of them.
+ * When another thread needs the shared stack, the used part of the previous
+ * one is copied out to a right-sized buffer, and copied back in before it
+ * resumes. A thread holds no stack memory until it first runs. This trades
+ * copying on context switches for much less memory per blocked thread.
+ *
+ * UTHREAD_STACK_GROWABLE: each thread reserves a large address range for its
+ * stack but only a small part of it is usable at first. The stack is extended
+ * on the fly when the thread runs past it, up to a cap set with
+ * uthread_set_stack_max().
+ *
+ * UTHREAD_STACK_ARENA: like UTHREAD_STACK_PRIVATE, but stacks, contexts and
+ * thread control blocks are carved out of 2 MiB huge pages, explicit ones if the
+ * system has some reserved or transparent ones otherwise, so that switching
+ * between many threads needs fewer TLB entries. Regular pages are used when
+ * huge pages are not available.
+ */
+typedef enum {
+	UTHREAD_STACK_PRIVATE,
+	UTHREAD_STACK_SHARED,
+	UTHREAD_STACK_GROWABLE,
+	UTHREAD_STACK_ARENA,
+} uthread_stack_mode_t;
+
+/*
+ * uthread_set_stack_mode - Select how thread stacks are provided
+ * @mode: Stack mode
+ *
+ * This function must be called before uthread_run(), and applies to every
+ * thread created afterwards.
+ *
+ * Return: 0 in case of success, -1 if @mode is invalid or if the library is
+ * already running.
+ */
+int uthread_set_stack_mode(uthread_stack_mode_t mode);
+
+/*
+ * uthread_set_stack_max - Set the maximum size of growable stacks
+ * @max: Maximum size of each thread's stack in bytes, or 0 for the default of
+ *	1 MiB
+ *
+ * This function must be called before uthread_run(), and only applies to the
+ * UTHREAD_STACK_GROWABLE mode. A thread overflowing this size is killed by a
+ * segmentation fault, as with a regular stack overflow.
+ *
+ * Return: 0 in case of success, -1 if the library is already running.
+ */
+int uthread_set_stack_max(size_t max);
+
+/*
+ * uthread_stack_paint_t - Stack usage measurement
+ *
+ * UTHREAD_STACK_PAINT_OFF: stacks are left as allocated (default).
+ *
+ * UTHREAD_STACK_PAINT_MEASURE: stacks are filled with a pattern when their
+ * thread is created, and the deepest point each thread reached is found when
+ * it exits, see the @stack_* fields of uthread_stats. Painting commits the
+ * whole stack up front.
+ *
+ * UTHREAD_STACK_PAINT_ADAPTIVE: like UTHREAD_STACK_PAINT_MEASURE, and the peak
+ * usage is remembered per thread function. Threads created one at a time, not
+ * with uthread_create_batch(), for a function whose threads already exited
+ * get a stack of one and a half times that peak, plus room for signal
+ * handlers, instead of the default size. Only a sample of these stacks is
+ * painted, to follow changes in usage. A thread using up all of its stack
+ * doubles the size of the next ones.
+ *
+ * Painting applies to the UTHREAD_STACK_PRIVATE and UTHREAD_STACK_ARENA
+ * modes, adaptive sizing to the UTHREAD_STACK_PRIVATE mode only.
+ */
+typedef enum {
+	UTHREAD_STACK_PAINT_OFF,
+	UTHREAD_STACK_PAINT_MEASURE,
+	UTHREAD_STACK_PAINT_ADAPTIVE,
+} uthread_stack_paint_t;
+
+/*
+ * uthread_set_stack_paint - Select how stack usage is measured
+ * @paint: Measurement mode
+ *
+ * This function must be called before uthread_run(), and applies to every
+ * thread created afterwards. Peak usages learnt in adaptive mode are kept over
+ * the following calls to uthread_run().
+ *
+ * Return: 0 in case of success, -1 if @paint is invalid or if the library is
+ * already running.
+ */
+int uthread_set_stack_paint(uthread_stack_paint_t paint);
+
+/*
+ * uthread_set_stack_trim - Release the unused stack pages of blocked threads
+ * @ms: Time in milliseconds a thread must stay blocked before its stack is
+ *	trimmed, or 0 to never trim stacks (default)
+ *
+ * The pages of a blocked thread's stack below the frames it uses are given
+ * back to the system once the thread is blocked for @ms, and come back zeroed
+ * if the thread goes that deep again. Stacks are looked at once per scheduling
+ * round. This applies to the UTHREAD_STACK_PRIVATE and UTHREAD_STACK_GROWABLE
+ * modes.
+ *
+ * This function must be called before uthread_run().
+ *
+ * Return: 0 in case of success, -1 if the library is already running.
+ */
+int uthread_set_stack_trim(unsigned int ms);
+
+/*
+ * uthread_sched_t - Scheduling policy
+ *
+ * UTHREAD_SCHED_FIFO runs ready threads in the order they became ready. This
+ * is the default policy.
+ *
+ * UTHREAD_SCHED_LIFO runs threads that were just created or woken up first,
+ * while the data they were handed is still in cache, which favors latency.
+ * Threads that yield or are preempted go to the back.
+ *
+ * UTHREAD_SCHED_WRR is a weighted round-robin: in each round, a thread runs for
+ * as many turns in a row as its weight (see uthread_set_weight()), a turn
+ * ending when the thread yields or is preempted.
+ *
+ * UTHREAD_SCHED_RANDOM draws the next thread among all the ready ones, from a
+ * pseudo-random generator restarted from a seed on every run (see
+ * uthread_set_sched_seed()). A yielding thread takes part in the draw, so a
+ * yield may go on with the same thread. Preemption ticks never switch threads,
+ * semaphore operations (sem_up() and sem_down()) are drawn to yield or not
+ * instead. Runs of a program whose threads only wait for each other thus make
+ * the same scheduling decisions every time, and can be recorded and replayed
+ * (see uthread_sched_log_write()). Wake-ups coming from outside of the runtime
+ * (uthread_offload(), file I/O, sem_up_remote()) are not reproduced.
+ */
+typedef enum {
+	UTHREAD_SCHED_FIFO,
+	UTHREAD_SCHED_LIFO,
+	UTHREAD_SCHED_WRR,
+	UTHREAD_SCHED_RANDOM,
+} uthread_sched_t;
+
+/*
+ * uthread_set_sched - Select the scheduling policy
+ * @policy: Policy to use
+ *
+ * This function must be called before uthread_run(), and the policy remains in
+ * effect for the following calls to uthread_run().
+ *
+ * Return: 0 in case of success, -1 if @policy is invalid or if the library is
+ * already running
+ */
+int uthread_set_sched(uthread_sched_t policy);
+
+/*
+ * uthread_set_weight - Set the weight of the currently running thread
+ * @weight: Number of turns the thread gets per round (1 by default)
+ *
+ * The weight is only used by the UTHREAD_SCHED_WRR policy.
+ *
+ * Return: 0 in case of success, -1 if @weight is 0 or outside of the runtime
+ */
+int uthread_set_weight(unsigned int weight);
+
+/*
+ * uthread_set_sched_seed - Seed the UTHREAD_SCHED_RANDOM policy
+ * @seed: Seed of the scheduling decisions (1 by default)
+ *
+ * The seed applies from the next call to uthread_run(), and every following
+ * run starts over from it.
+ *
+ * Return: 0
+ */
+int uthread_set_sched_seed(unsigned long long seed);
+
+/*
+ * uthread_sched_log_write - Save the scheduling decisions of the last run
+ * @fd: File descriptor to write the decisions to
+ *
+ * The decisions of the last run under the UTHREAD_SCHED_RANDOM policy are
+ * written along with its seed, in a compact binary form: about one byte per
+ * decision among fewer than 128 ready threads. Runs with a single ready thread
+ * make no decision.
+ *
+ * Return: 0 in case of success, -1 if no run was recorded, if the library is
+ * running or if writing fails
+ */
+int uthread_sched_log_write(int fd);
+
+/*
+ * uthread_sched_replay - Replay recorded scheduling decisions
+ * @fd: File descriptor to read decisions written by uthread_sched_log_write()
+ *	from, or -1 to go back to drawing decisions from the seed
+ *
+ * The following runs under the UTHREAD_SCHED_RANDOM policy take their
+ * decisions from the log instead of drawing them. A run that asks for a
+ * decision the log doesn't have, or leaves some unused, diverged from the
+ * recorded one: it goes on drawing decisions, and is counted in
+ * @sched_replay_divergences (see uthread_get_stats()).
+ *
+ * Return: 0 in case of success, -1 if the log can't be read or if the library
+ * is running
+ */
+int uthread_sched_replay(int fd);
+
+/*
+ * uthread_stats - Runtime statistics
+ * @threads_created: Number of threads created
+ * @context_switches: Number of context switches
+ * @stack_grow_events: Number of times a growable stack was extended
+ * @stack_grow_bytes: Total number of bytes growable stacks were extended by
+ * @offload_calls: Number of calls made with uthread_offload()
+ * @offload_queue_depth: Number of offloaded calls waiting for a pool thread
+ * @offload_queue_peak: Highest number of offloaded calls waiting at once
+ * @offload_queue_ns: Total time offloaded calls waited for a pool thread
+ * @offload_latency_ns: Total time between offloading a call and resuming the
+ *	caller, for completed calls
+ * @file_io_ops: Number of file I/O requests made through io_uring
+ * @file_io_submits: Number of io_uring submissions, each possibly carrying
+ *	several requests
+ * @arena_huge_chunks: Number of arena chunks backed by reserved huge pages
+ * @arena_hinted_chunks: Number of arena chunks advised to use transparent huge
+ *	pages, which the kernel may or may not back them with
+ * @arena_regular_chunks: Number of arena chunks backed by regular pages
+ * @stack_measured: Number of exited threads whose peak stack usage was
+ *	measured, see uthread_set_stack_paint()
+ * @stack_peak_max: Highest peak stack usage measured, in bytes
+ * @stack_peak_total: Sum of the peak stack usages measured, in bytes
+ * @stack_trim_events: Number of times the unused pages of a blocked thread's
+ *	stack were released, see uthread_set_stack_trim()
+ * @stack_trim_bytes: Total number of bytes of stack released, resident or not
+ * @sched_decisions: Number of scheduling decisions taken among several ready
+ *	threads by the UTHREAD_SCHED_RANDOM policy
+ * @sched_replay_divergences: Number of replayed runs that diverged from their
+ *	log, see uthread_sched_replay()
+ * @perf_reads: Number of times the thread counters were read with read(), see
+ *	uthread_perf_start()
+ * @perf_rdpmc_reads: Number of times the thread counters were read with rdpmc
+ */
+struct uthread_stats {
+	size_t threads_created;
+	size_t context_switches;
+	size_t stack_grow_events;
+	size_t stack_grow_bytes;
+	size_t offload_calls;
+	size_t offload_queue_depth;
+	size_t offload_queue_peak;
+	unsigned long long offload_queue_ns;
+	unsigned long long offload_latency_ns;
+	size_t file_io_ops;
+	size_t file_io_submits;
+	size_t arena_huge_chunks;
+	size_t arena_hinted_chunks;
+	size_t arena_regular_chunks;
+	size_t stack_measured;
+	size_t stack_peak_max;
+	size_t stack_peak_total;
+	size_t stack_trim_events;
+	size_t stack_trim_bytes;
+	size_t sched_decisions;
+	size_t sched_replay_divergences;
+	size_t perf_reads;
+	size_t perf_rdpmc_reads;
+};
+
+/*
+ * uthread_get_stats - Get runtime statistics
+ * @stats: Structure receiving the statistics
+ *
+ * Statistics accumulate over all the calls to uthread_run().
+ *
+ * Return: -1 if @stats is NULL, 0 otherwise.
+ */
+int uthread_get_stats(struct uthread_stats *stats);
+
+/*
+ * uthread_mem_usage - Memory held by the library for one purpose
+ * @live: Number of bytes held now
+ * @peak: Highest number of bytes held at once
+ */
+struct uthread_mem_usage {
+	size_t live;
+	size_t peak;
+};
+
+/*
+ * uthread_mem_stats - Memory held by the library
+ * @stacks: Thread stacks, as allocated or, for growable stacks, as made
+ *	accessible so far, along with the shared stack and the save areas of
+ *	shared-stack mode
+ * @tcbs: Thread control blocks, which hold the execution contexts
+ * @queue_nodes: Nodes of the queues of queue.h, which include the ready,
+ *	blocked and zombie threads
+ * @semaphores: Semaphores
+ * @pooled: Memory kept for reuse but currently free, such as the free slots
+ *	of the huge-page stack arena
+ * @total: All of the above
+ * @budget: Memory budget, see uthread_set_mem_budget(), or 0
+ *
+ * Sizes are the ones requested from the allocator or mapped, whether the
+ * memory is resident or not.
+ */
+struct uthread_mem_stats {
+	struct uthread_mem_usage stacks;
+	struct uthread_mem_usage tcbs;
+	struct uthread_mem_usage queue_nodes;
+	struct uthread_mem_usage semaphores;
+	struct uthread_mem_usage pooled;
+	struct uthread_mem_usage total;
+	size_t budget;
+};
+
+/*
+ * uthread_mem_stats - Get the memory held by the library
+ * @stats: Structure receiving the memory usage
+ *
+ * Peaks accumulate over all the calls to uthread_run().
+ *
+ * Return: -1 if @stats is NULL, 0 otherwise.
+ */
+int uthread_mem_stats(struct uthread_mem_stats *stats);
+
+/*
+ * uthread_set_mem_budget - Cap the memory held by the library
+ * @bytes: Maximum number of bytes, as counted in the @total field of
+ *	uthread_mem_stats, or 0 for no cap (default)
+ *
+ * Thread creation fails right away, without allocating anything, when the
+ * memory the new threads need would take the total over @bytes. Other
+ * allocations are not capped. The budget can be changed at any time.
+ *
+ * Return: 0
+ */
+int uthread_set_mem_budget(size_t bytes);
+
 /*
  * uthread_run - Run the multithreading library
  * @preempt: Preemption enable
@@ -39,6 +384,37 @@ int uthread_run(bool preempt, uthread_func_t func, void *arg);
  */
 int uthread_create(uthread_func_t func, void *arg);
 
+/*
+ * uthread_create_handle - Create a new thread and get its handle
+ * @func: Function to be executed by the thread
+ * @arg: Argument to be passed to the thread
+ * @handle: Handle of the new thread, can be NULL
+ *
+ * Same as uthread_create(), and if @handle is not NULL, it is set to the handle
+ * of the new thread.
+ *
+ * Return: 0 in case of success, -1 in case of failure (e.g., memory allocation,
+ * context creation).
+ */
+int uthread_create_handle(uthread_func_t func, void *arg,
+                          uthread_handle_t *handle);
+
+/*
+ * uthread_create_batch - Create several threads at once
+ * @funcs: Array of @n functions to be executed by the threads
+ * @args: Array of @n arguments, @args[i] being passed to @funcs[i]. If @args
+ *	is NULL, every thread receives NULL.
+ * @n: Number of threads to create
+ *
+ * This function creates @n new threads in one go. Thread control blocks,
+ * contexts and stacks are carved out of contiguous allocations, and all the
+ * new threads are made ready at once, in the order of @funcs.
+ *
+ * Return: 0 in case of success, -1 in case of failure (e.g., memory allocation,
+ * context creation). In case of failure, no thread is created.
+ */
+int uthread_create_batch(uthread_func_t *funcs, void **args, size_t n);
+
 /*
  * uthread_yield - Yield execution
  *
@@ -47,6 +423,21 @@ int uthread_create(uthread_func_t func, void *arg);
  */
 void uthread_yield(void);
 
+/*
+ * uthread_yield_to - Yield execution to a given thread
+ * @target: Handle of the thread to run
+ *
+ * This function is to be called from the currently active and running thread.
+ * If @target is ready to run, it is taken out of the ready threads and run
+ * right away, regardless of the scheduling policy, while the calling thread is
+ * made ready again. This lets a thread that just handed data to another one
+ * (e.g., through a semaphore) run it immediately. If @target isn't ready to
+ * run, this function behaves like uthread_yield().
+ *
+ * Return: -1 if @target is NULL, 0 otherwise
+ */
+int uthread_yield_to(uthread_handle_t target);
+
 /*
  * uthread_exit - Exit from currently running thread
  *
@@ -57,4 +448,199 @@ void uthread_yield(void);
  */
 void uthread_exit(void);
 
+/*
+ * uthread_self - Get the identifier of the currently running thread
+ *
+ * Threads are numbered from 1 in creation order. The thread that called
+ * uthread_run() is numbered 0.
+ *
+ * Return: Identifier of the running thread
+ */
+size_t uthread_self(void);
+
+/*
+ * uthread_handle - Get the handle of the currently running thread
+ *
+ * Return: Handle of the running thread
+ */
+uthread_handle_t uthread_handle(void);
+
+/*
+ * uthread_set_name - Name the currently running thread
+ * @name: Name, truncated to 15 characters
+ *
+ * The name identifies the thread in profiles (see uthread_profile_write()).
+ *
+ * Return: 0 in case of success, -1 if @name is NULL or outside of the runtime
+ */
+int uthread_set_name(const char *name);
+
+/*
+ * uthread_set_offload_threads - Set the size of the offload pool
+ * @n: Number of kernel threads running offloaded calls (4 by default)
+ *
+ * This function must be called before the first call to uthread_offload().
+ *
+ * Return: 0 in case of success, -1 if @n is 0 or if the pool already started.
+ */
+int uthread_set_offload_threads(size_t n);
+
+/*
+ * uthread_offload - Run a blocking call outside of the runtime
+ * @func: Function to call
+ * @arg: Argument to be passed to @func
+ *
+ * This function is to be called from the currently active and running thread.
+ * It runs @func on a kernel thread from an internal pool while the calling
+ * thread is blocked, so that a blocking system call (e.g., open(), fsync(),
+ * getaddrinfo()) doesn't stall the other threads. The calling thread resumes
+ * once @func has returned; results can be passed back through @arg.
+ *
+ * @func runs concurrently with the runtime, so it must not call any function of
+ * this library apart from sem_up_remote(). In shared-stack mode, @arg must not
+ * point to the caller's stack.
+ *
+ * Return: 0 once @func was called, -1 in case of failure (e.g., memory
+ * allocation, thread creation), in which case @func was not called.
+ */
+int uthread_offload(uthread_func_t func, void *arg);
+
+/*
+ * uthread_pread - Read from a file at a given offset
+ * @fd: File descriptor to read from
+ * @buf: Buffer receiving the data
+ * @count: Number of bytes to read
+ * @offset: Offset in the file
+ *
+ * This function behaves like pread(), but only blocks the calling thread. The
+ * read is submitted through an io_uring owned by the runtime, along with the
+ * requests of every other thread blocking in the same scheduling round. When
+ * io_uring is not available, the read is run by the offload pool instead (see
+ * uthread_offload()).
+ *
+ * In shared-stack mode, @buf must not be on the caller's stack.
+ *
+ * Return: Number of bytes read, or -1 with errno set in case of error
+ */
+ssize_t uthread_pread(int fd, void *buf, size_t count, off_t offset);
+
+/*
+ * uthread_pwrite - Write to a file at a given offset
+ * @fd: File descriptor to write to
+ * @buf: Data to write
+ * @count: Number of bytes to write
+ * @offset: Offset in the file
+ *
+ * This function behaves like pwrite(), but only blocks the calling thread, as
+ * described for uthread_pread().
+ *
+ * Return: Number of bytes written, or -1 with errno set in case of error
+ */
+ssize_t uthread_pwrite(int fd, const void *buf, size_t count, off_t offset);
+
+/*
+ * uthread_fsync - Flush a file to its storage device
+ * @fd: File descriptor to flush
+ *
+ * This function behaves like fsync(), but only blocks the calling thread, as
+ * described for uthread_pread().
+ *
+ * Return: 0 in case of success, or -1 with errno set in case of error
+ */
+int uthread_fsync(int fd);
+
+/*
+ * uthread_profile_start - Start the sampling CPU profiler
+ * @hz: Number of samples per second of CPU time, or 0 for the default (997)
+ *
+ * A SIGPROF timer interrupts the process periodically, and each sample records
+ * which thread was running along with its call stack, walked through frame
+ * pointers (so the code to profile should be compiled with
+ * -fno-omit-frame-pointer). Samples are kept in memory until
+ * uthread_profile_write() is called. The profiler must be started from the
+ * kernel thread that runs uthread_run(), and coexists with preemption.
+ *
+ * Return: 0 in case of success, -1 if the profiler is already running or not
+ * supported on this architecture, or in case of failure.
+ */
+int uthread_profile_start(unsigned int hz);
+
+/*
+ * uthread_profile_stop - Stop the sampling CPU profiler
+ *
+ * Samples taken so far are kept for uthread_profile_write().
+ */
+void uthread_profile_stop(void);
+
+/*
+ * uthread_profile_write - Write the samples as folded stacks
+ * @fd: File descriptor to write to
+ * @by_name: Group the samples by thread name rather than by thread
+ *
+ * Each line holds a call stack, from its root to the sampled function, with
+ * frames separated by semicolons, followed by the number of samples that
+ * captured it; this is the input format of flame graph generators. The root of
+ * each stack is the thread, as "name#id" (or "uthread#id" for unnamed threads),
+ * or only its name if @by_name is true. Functions are named after the closest
+ * dynamic symbol (link with -rdynamic to resolve the program's own functions),
+ * or else as addresses.
+ *
+ * Return: Number of distinct stacks written, or -1 in case of failure
+ */
+int uthread_profile_write(int fd, bool by_name);
+
+/*
+ * uthread_perf - Events counted while a thread ran
+ * @instructions: Number of instructions retired
+ * @cycles: Number of CPU cycles
+ * @cache_misses: Number of last-level cache misses
+ * @branch_misses: Number of mispredicted branches
+ * @task_clock_ns: CPU time in nanoseconds, only counted when no hardware
+ *	counter is available
+ * @switches: Number of times the thread was switched out
+ *
+ * Events are counted in user space only. Counters the system doesn't provide
+ * stay at 0.
+ */
+struct uthread_perf {
+	unsigned long long instructions;
+	unsigned long long cycles;
+	unsigned long long cache_misses;
+	unsigned long long branch_misses;
+	unsigned long long task_clock_ns;
+	size_t switches;
+};
+
+/*
+ * uthread_perf_start - Count hardware events per thread
+ * @top_n: Number of entries of the report printed at exit, or 0 for none
+ *
+ * From the next call to uthread_run(), a group of perf events is read at
+ * every context switch, and the counts since the previous switch are added to
+ * the thread switched out. Counters are read with the rdpmc instruction when
+ * the system allows it, with one read() per switch otherwise. At exit, the
+ * @top_n entries with the most cycles are printed on stderr, exited threads
+ * being summed up per name, or per entry function for unnamed threads.
+ *
+ * Return: 0 in case of success, -1 if no event can be counted (see
+ * perf_event_open(2) and /proc/sys/kernel/perf_event_paranoid)
+ */
+int uthread_perf_start(size_t top_n);
+
+/*
+ * uthread_perf_report - Print the thread counter report now
+ * @top_n: Number of entries to print
+ */
+void uthread_perf_report(size_t top_n);
+
+/*
+ * uthread_get_perf - Get the events counted for a thread so far
+ * @thread: Handle of the thread, or NULL for the calling thread
+ * @perf: Counts to fill
+ *
+ * Return: 0 in case of success, -1 if @perf is NULL, if called outside of the
+ * runtime or if threads are not counted
+ */
+int uthread_get_perf(uthread_handle_t thread, struct uthread_perf *perf);
+
 #endif /* _THREAD_H */